@@ -15,6 +15,12 @@ public:
   AnalysisEvent() {}
   ~AnalysisEvent() {}
 
+  // Restores all member variables to their default values so that the same
+  // object can be reused for the next event. The vectors are emptied without
+  // releasing their storage, and the owned objects are not reallocated, so
+  // any branch addresses set using this object remain valid.
+  void reset();
+
   // Event scores needed for numu CC selection
   float topological_score_ = BOGUS;
   float cosmic_impact_parameter_ = BOGUS;
@@ -161,6 +167,11 @@ public:
   // of the weights map. Hacky, but it works.
   // TODO: revisit this to make something more elegant
   std::map< std::string, std::vector<double>* > mc_weights_ptr_map_;
+  // Storage for the output copies of the elements of the weights map (keys
+  // are the same as in the input map). ROOT recreates the map elements each
+  // time that the input branch is read, so the output branches point here
+  // instead.
+  std::map< std::string, std::vector<double> > mc_weights_out_map_;
 
   // GENIE weights
   float spline_weight_ = DEFAULT_WEIGHT;
@@ -199,3 +210,124 @@ public:
   // ** Reconstructed observables **
 
 };
+
+// Empties a container owned by a MyPointer (if it is present)
+template < typename T > inline void clear_if_present( MyPointer<T>& ptr ) {
+  if ( ptr ) ptr->clear();
+}
+
+inline void AnalysisEvent::reset() {
+
+  topological_score_ = BOGUS;
+  cosmic_impact_parameter_ = BOGUS;
+  contained_fraction_ = BOGUS;
+  nu_completeness_from_pfp_ = BOGUS;
+  nu_purity_from_pfp_ = BOGUS;
+  nu_pdg_ = BOGUS_INT;
+  nslice_ = BOGUS_INT;
+  nu_vx_ = BOGUS;
+  nu_vy_ = BOGUS;
+  nu_vz_ = BOGUS;
+  num_pf_particles_ = BOGUS_INT;
+  num_tracks_ = BOGUS_INT;
+  num_showers_ = BOGUS_INT;
+
+  clear_if_present( pfp_generation_ );
+  clear_if_present( pfp_trk_daughters_count_ );
+  clear_if_present( pfp_shr_daughters_count_ );
+  clear_if_present( pfp_track_score_ );
+  clear_if_present( pfp_reco_pdg_ );
+  clear_if_present( pfp_hits_ );
+  clear_if_present( pfp_hitsU_ );
+  clear_if_present( pfp_hitsV_ );
+  clear_if_present( pfp_hitsY_ );
+  clear_if_present( pfp_true_pdg_ );
+  clear_if_present( pfp_true_E_ );
+  clear_if_present( pfp_true_px_ );
+  clear_if_present( pfp_true_py_ );
+  clear_if_present( pfp_true_pz_ );
+
+  clear_if_present( shower_pfp_id_ );
+  clear_if_present( shower_startx_ );
+  clear_if_present( shower_starty_ );
+  clear_if_present( shower_startz_ );
+  clear_if_present( shower_start_distance_ );
+
+  shr_id_ = BOGUS_INT;
+  shr_energy_cali_ = BOGUS;
+  shr_score_ = BOGUS;
+  shrsubclusters_ = BOGUS_INT;
+  hits_ratio_ = BOGUS;
+  shrmoliereavg_ = BOGUS;
+  shr_distance_ = BOGUS;
+  shr_tkfit_gap10_dedx_Y_ = BOGUS;
+  shr_tkfit_2cm_dedx_Y_ = BOGUS;
+
+  clear_if_present( track_pfp_id_ );
+  clear_if_present( track_length_ );
+  clear_if_present( track_startx_ );
+  clear_if_present( track_starty_ );
+  clear_if_present( track_startz_ );
+  clear_if_present( track_start_distance_ );
+  clear_if_present( track_endx_ );
+  clear_if_present( track_endy_ );
+  clear_if_present( track_endz_ );
+  clear_if_present( track_dirx_ );
+  clear_if_present( track_diry_ );
+  clear_if_present( track_dirz_ );
+  clear_if_present( track_theta_ );
+  clear_if_present( track_phi_ );
+  clear_if_present( track_kinetic_energy_p_ );
+  clear_if_present( track_range_mom_mu_ );
+  clear_if_present( track_mcs_mom_mu_ );
+  clear_if_present( track_chi2_proton_ );
+  clear_if_present( track_llr_pid_ );
+  clear_if_present( track_llr_pid_U_ );
+  clear_if_present( track_llr_pid_V_ );
+  clear_if_present( track_llr_pid_Y_ );
+  clear_if_present( track_llr_pid_score_ );
+
+  mc_nu_pdg_ = BOGUS_INT;
+  mc_nu_vx_ = BOGUS;
+  mc_nu_vy_ = BOGUS;
+  mc_nu_vz_ = BOGUS;
+  mc_nu_sce_vx_ = BOGUS;
+  mc_nu_sce_vy_ = BOGUS;
+  mc_nu_sce_vz_ = BOGUS;
+  mc_nu_energy_ = BOGUS;
+  mc_nu_ccnc_ = false;
+  mc_nu_interaction_type_ = BOGUS_INT;
+
+  clear_if_present( mc_nu_daughter_pdg_ );
+  clear_if_present( mc_nu_daughter_energy_ );
+  clear_if_present( mc_nu_daughter_px_ );
+  clear_if_present( mc_nu_daughter_py_ );
+  clear_if_present( mc_nu_daughter_pz_ );
+
+  // The weights map itself is refilled from scratch whenever its input
+  // branch is read, so it is left alone here
+  spline_weight_ = DEFAULT_WEIGHT;
+  tuned_cv_weight_ = DEFAULT_WEIGHT;
+  ppfx_cv_weight_ = DEFAULT_WEIGHT;
+  normalisation_weight_ = DEFAULT_WEIGHT;
+
+  beamlineVarWeightsPresent_ = false;
+  Horn_2kA.clear();
+  Horn1_x_3mm.clear();
+  Horn1_y_3mm.clear();
+  Beam_spot_1_1mm.clear();
+  Beam_spot_1_5mm.clear();
+  Horn2_x_3mm.clear();
+  Horn2_y_3mm.clear();
+  Horns_0mm_water.clear();
+  Horns_2mm_water.clear();
+  Beam_shift_x_1mm.clear();
+  Beam_shift_y_1mm.clear();
+  Target_z_7mm.clear();
+
+  is_mc_ = false;
+
+  mc_nelec_ = BOGUS_INT;
+  mc_npi0_ = BOGUS_INT;
+  mc_elec_e_ = BOGUS;
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+// Standard library includes
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// **** Per-event cache of bin assignments used by UniverseMaker ****
+//
+// Evaluating the bin and category definitions for every ntuple entry is often
+// a large part of the cost of running UniverseMaker. When only the event
+// weights change between runs (or the reverse), the results of those
+// evaluations can be reused. A bin assignment cache file stores, for each
+// entry of a single input ntuple file, the matched true bins, reco bins, and
+// event categories together with the weight from the corresponding formula
+// evaluation. The file layout is
+//
+//   header:  8-byte magic string, then the format version, the hash of the
+//            bin configuration, the size and modification time of the input
+//            ntuple file, the number of entries, and the offset of the entry
+//            table (all uint64_t)
+//   records: one per entry, holding the number of true bin, reco bin, and
+//            category matches (uint32_t each), followed by each match as a
+//            uint32_t index and a double weight
+//   table:   the offset of each record (uint64_t) in entry order
+//
+// The hash identifies the bin configuration, so a cache file is only used by
+// a later run with identical bin definitions. The input file size and
+// modification time guard against reusing a cache after the ntuple changes.
+
+// Returns a 64-bit FNV-1a hash of a string
+inline uint64_t fnv1a_hash( const std::string& str ) {
+  uint64_t hash = 14695981039346656037ull;
+  for ( unsigned char c : str ) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// Size and modification time of an input ntuple file. These are recorded in
+// a cache file to detect changes to the ntuple.
+struct NtupleFileStamp {
+
+  // Reads the stamp for an existing file. Throws an exception if the file
+  // cannot be found.
+  static NtupleFileStamp from_file( const std::string& file_name );
+
+  inline bool operator==( const NtupleFileStamp& other ) const
+    { return size_ == other.size_ && mtime_ == other.mtime_; }
+
+  uint64_t size_ = 0u;
+  uint64_t mtime_ = 0u;
+};
+
+// Matches found for a single entry that are stored in (or read from) a bin
+// assignment cache. The three kinds are listed in the order true bins, reco
+// bins, and categories.
+enum BinAssignmentKind {
+  kTrueBinAssignment = 0,
+  kRecoBinAssignment = 1,
+  kCategoryAssignment = 2
+};
+
+constexpr size_t NUM_BIN_ASSIGNMENT_KINDS = 3u;
+
+// Calls on_match( kind, index, weight ) for every match in the record that
+// begins at pos, in the order in which they were written
+template < typename Func > void read_bin_assignment_record( const char* pos,
+  Func&& on_match )
+{
+  uint32_t counts[ NUM_BIN_ASSIGNMENT_KINDS ];
+  std::memcpy( counts, pos, sizeof(counts) );
+  pos += sizeof( counts );
+
+  for ( size_t k = 0u; k < NUM_BIN_ASSIGNMENT_KINDS; ++k ) {
+    auto kind = static_cast< BinAssignmentKind >( k );
+    for ( uint32_t m = 0u; m < counts[k]; ++m ) {
+      uint32_t index;
+      double weight;
+      std::memcpy( &index, pos, sizeof(index) );
+      pos += sizeof( index );
+      std::memcpy( &weight, pos, sizeof(weight) );
+      pos += sizeof( weight );
+      on_match( kind, index, weight );
+    }
+  }
+}
+
+// Accumulates the records for a contiguous range of entries. Each
+// BinMatchWorker fills one of these for each range that it processes.
+class BinAssignmentBuffer {
+
+  public:
+
+    // Starts the record for a new entry with the given numbers of matches
+    inline void begin_entry( uint32_t num_true, uint32_t num_reco,
+      uint32_t num_categ )
+    {
+      offsets_.push_back( data_.size() );
+      this->append( num_true );
+      this->append( num_reco );
+      this->append( num_categ );
+    }
+
+    // Adds a single match to the current record. Matches must be added in the
+    // order true bins, reco bins, and categories, using the counts given to
+    // begin_entry().
+    inline void add_match( uint32_t index, double weight ) {
+      this->append( index );
+      this->append( weight );
+    }
+
+    inline void clear() {
+      data_.clear();
+      offsets_.clear();
+    }
+
+    inline const std::vector< char >& data() const { return data_; }
+    inline const std::vector< uint64_t >& offsets() const { return offsets_; }
+
+    inline size_t num_entries() const { return offsets_.size(); }
+
+    // Calls on_match( kind, index, weight ) for every match stored for the
+    // i-th entry in the buffer
+    template < typename Func > inline void read_entry( size_t i,
+      Func&& on_match ) const
+    {
+      read_bin_assignment_record( data_.data() + offsets_.at(i),
+        std::forward< Func >(on_match) );
+    }
+
+  protected:
+
+    template < typename T > inline void append( const T& value ) {
+      const char* bytes = reinterpret_cast< const char* >( &value );
+      data_.insert( data_.end(), bytes, bytes + sizeof(T) );
+    }
+
+    std::vector< char > data_;
+
+    // Start of each entry's record within data_
+    std::vector< uint64_t > offsets_;
+};
+
+// Writes a new cache file. Records must be appended in entry order. To avoid
+// leaving an incomplete cache behind, the file is written under a temporary
+// name and only moved into place once close() has written the entry table.
+class BinAssignmentCacheWriter {
+
+  public:
+
+    BinAssignmentCacheWriter( const std::string& file_name,
+      uint64_t config_hash, const NtupleFileStamp& stamp,
+      uint64_t num_entries );
+
+    ~BinAssignmentCacheWriter();
+
+    void append( const BinAssignmentBuffer& buffer );
+
+    void close();
+
+  protected:
+
+    std::string file_name_;
+    std::string temp_file_name_;
+    std::ofstream out_;
+    uint64_t num_entries_;
+    std::vector< uint64_t > offsets_;
+    uint64_t current_offset_ = 0u;
+    bool closed_ = false;
+};
+
+// Read-only view of a bin assignment cache file mapped into memory
+class MappedBinAssignmentCache {
+
+  public:
+
+    MappedBinAssignmentCache( const std::string& file_name );
+    ~MappedBinAssignmentCache();
+
+    MappedBinAssignmentCache( const MappedBinAssignmentCache& ) = delete;
+    MappedBinAssignmentCache& operator=( const MappedBinAssignmentCache& )
+      = delete;
+
+    inline uint64_t config_hash() const { return config_hash_; }
+    inline const NtupleFileStamp& stamp() const { return stamp_; }
+    inline uint64_t num_entries() const { return num_entries_; }
+
+    // Calls on_match( kind, index, weight ) for every match stored for an
+    // entry, in the order in which they were written
+    template < typename Func > void read_entry( uint64_t entry,
+      Func&& on_match ) const;
+
+  protected:
+
+    std::string file_name_;
+    void* mapped_data_ = nullptr;
+    size_t mapped_size_ = 0u;
+
+    uint64_t config_hash_ = 0u;
+    NtupleFileStamp stamp_;
+    uint64_t num_entries_ = 0u;
+
+    // Start of the mapped entry table
+    const char* table_ = nullptr;
+};
+
+template < typename Func > void MappedBinAssignmentCache::read_entry(
+  uint64_t entry, Func&& on_match ) const
+{
+  if ( entry >= num_entries_ ) throw std::runtime_error( "Entry "
+    + std::to_string(entry) + " is missing from the bin assignment cache "
+    + file_name_ );
+
+  uint64_t offset;
+  std::memcpy( &offset, table_ + entry * sizeof(uint64_t), sizeof(offset) );
+  const char* pos = static_cast< const char* >( mapped_data_ ) + offset;
+
+  read_bin_assignment_record( pos, std::forward< Func >(on_match) );
+}
+
+// Opens an existing cache file if it matches the given bin configuration
+// hash, input ntuple file stamp, and number of entries. Returns nullptr if
+// the file does not exist or does not match.
+std::unique_ptr< MappedBinAssignmentCache > open_bin_assignment_cache(
+  const std::string& file_name, uint64_t config_hash,
+  const NtupleFileStamp& stamp, uint64_t num_entries );
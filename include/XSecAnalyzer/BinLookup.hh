@@ -0,0 +1,187 @@
+#pragma once
+
+// Standard library includes
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// ROOT includes
+#include "TTree.h"
+
+// XSecAnalyzer includes
+#include "XSecAnalyzer/CutProgram.hh"
+
+// Keyword that marks the start of the optional bin edge table in a
+// UniverseMaker configuration file
+const std::string BIN_EDGE_TABLE_KEYWORD = "bin_edge_table";
+
+// A half-open interval [low_, high_) on the value of a TTreeFormula
+// expression
+struct BinInterval {
+
+  inline BinInterval( const std::string& variable = "", double low = 0.,
+    double high = 0. ) : variable_( variable ), low_( low ), high_( high ) {}
+
+  std::string variable_;
+  double low_;
+  double high_;
+};
+
+// Structured form of a bin definition written by MakeConfig. The bin with
+// index bin_index_ contains every event that passes the selection (which may
+// be empty) and whose variables lie within all of the listed intervals. The
+// interval edges are stored exactly as they appear in the bin's cut string.
+struct BinEdgeRecord {
+
+  size_t bin_index_ = 0u;
+  std::string selection_;
+  std::vector< BinInterval > intervals_;
+};
+
+inline std::ostream& operator<<( std::ostream& out, const BinEdgeRecord& ber )
+{
+  // Write the edges with enough digits to be read back exactly
+  auto old_precision = out.precision(
+    std::numeric_limits<double>::max_digits10 );
+
+  out << ber.bin_index_ << ' ' << ber.intervals_.size() << " \""
+    << ber.selection_ << '\"';
+  for ( const auto& bi : ber.intervals_ ) {
+    out << " \"" << bi.variable_ << "\" " << bi.low_ << ' ' << bi.high_;
+  }
+
+  out.precision( old_precision );
+  return out;
+}
+
+inline std::istream& operator>>( std::istream& in, BinEdgeRecord& ber ) {
+
+  size_t num_intervals;
+  in >> ber.bin_index_ >> num_intervals;
+
+  // Use two calls to std::getline using a double quote delimiter
+  // in order to get the contents of the next double-quoted string
+  std::string temp_line;
+  std::getline( in, temp_line, '\"' );
+  std::getline( in, temp_line, '\"' );
+  ber.selection_ = temp_line;
+
+  ber.intervals_.clear();
+  for ( size_t i = 0u; i < num_intervals; ++i ) {
+    BinInterval bi;
+    std::getline( in, temp_line, '\"' );
+    std::getline( in, temp_line, '\"' );
+    bi.variable_ = temp_line;
+    in >> bi.low_ >> bi.high_;
+    ber.intervals_.push_back( bi );
+  }
+
+  return in;
+}
+
+// Finds the bin(s) that contain the current TTree entry. Bins described by
+// the optional edge table are grouped according to their selection and
+// binned variables. Within each group, the matching bin (if any) is found by
+// binary search over the sorted interval edges of each variable in turn.
+// An edge table entry is only used if it compiles to the same expression as
+// the cut string for its bin (see CutProgram::same_expression()). All other
+// bins, and any group whose intervals overlap, are tested one by one using a
+// CutProgram instead.
+class BinLookup {
+
+  public:
+
+    BinLookup( const std::vector<std::string>& cuts,
+      const std::vector<BinEdgeRecord>& edges, TTree& tree,
+      const std::string& formula_name_prefix );
+
+    // Must be called whenever the TTree owned by a TChain changes
+    void notify();
+
+    // Evaluates all bin definitions for the current entry, which must already
+    // have been read using TTree::GetEntry(). The behavior is the same as
+    // CutProgram::evaluate(). In particular, on_match( index, weight ) is
+    // called in order of increasing bin index.
+    template < typename Func > void evaluate( Func&& on_match );
+
+    // Adds the names of the TTree branches needed to evaluate the bin
+    // definitions to a set. See CutProgram::add_used_branches().
+    void add_used_branches( std::set<std::string>& branch_names ) const;
+
+    // Number of bins that are found using the edge table
+    inline size_t num_indexed_bins() const { return num_indexed_bins_; }
+
+  protected:
+
+    // One level of the search tree for a group of bins. Each interval
+    // points either to the node for the next variable (child >= 0) or
+    // directly to a bin with index -( child + 1 ).
+    struct IntervalNode {
+      size_t variable_;
+      std::vector< double > lows_;
+      std::vector< double > highs_;
+      std::vector< int > children_;
+    };
+
+    // Bins sharing a selection and list of binned variables
+    struct BinGroup {
+      // Index of the selection in value_program_ (or -1 if there isn't one)
+      int selection_;
+      // Index of the first IntervalNode to search
+      int root_;
+    };
+
+    // Builds the search tree for a set of edge records starting at the given
+    // interval. The variable_slots vector gives the index in value_program_
+    // of each binned variable. Returns -1 if the intervals overlap.
+    int build_node( std::vector<const BinEdgeRecord*> records, size_t level,
+      const std::vector<size_t>& variable_slots );
+
+    // Appends the matches found using the edge table to matches_
+    void find_indexed_bins();
+
+    // Selections and binned variables used by the edge table
+    std::unique_ptr< CutProgram > value_program_;
+
+    // Cuts for the bins that are not handled by the edge table, together
+    // with their original bin indices
+    std::unique_ptr< CutProgram > cut_program_;
+    std::vector< size_t > cut_program_bins_;
+
+    std::vector< IntervalNode > nodes_;
+    std::vector< BinGroup > groups_;
+    size_t num_indexed_bins_ = 0u;
+
+    // Reusable storage for the matches found for the current entry
+    std::vector< std::pair<size_t, double> > matches_;
+};
+
+template < typename Func > void BinLookup::evaluate( Func&& on_match ) {
+  // Without any indexed bins, the matches from the CutProgram are already
+  // in the right order
+  if ( groups_.empty() ) {
+    cut_program_->evaluate( [ & ]( size_t c, double wgt ) {
+      on_match( cut_program_bins_[c], wgt );
+    } );
+    return;
+  }
+
+  matches_.clear();
+  this->find_indexed_bins();
+
+  cut_program_->evaluate( [ & ]( size_t c, double wgt ) {
+    matches_.emplace_back( cut_program_bins_[c], wgt );
+  } );
+
+  // A bin is handled either by the edge table or by the CutProgram, so the
+  // stable sort only keeps multiple formula instances for a bin in order
+  std::stable_sort( matches_.begin(), matches_.end(),
+    []( const auto& a, const auto& b ) { return a.first < b.first; } );
+
+  for ( const auto& match : matches_ ) on_match( match.first, match.second );
+}
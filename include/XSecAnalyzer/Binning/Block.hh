@@ -17,6 +17,9 @@
 #include "TParameter.h"
 #include "TStyle.h"
 
+// XSecAnalyzer includes
+#include "XSecAnalyzer/BinLookup.hh"
+
 class Block: public TNamed {
 
   public:
@@ -31,6 +34,11 @@ class Block: public TNamed {
     virtual std::string GetBinDef(const int idx)  = 0;
     virtual std::string GetBinDef(const int x, const int y) = 0;
     virtual std::string GetBinDef(const int x, const int y, const int z) = 0;
+    // Intervals on the binned variables equivalent to the bin definitions
+    // (apart from the selection)
+    virtual std::vector<BinInterval> GetBinIntervals(const int idx) = 0;
+    virtual std::vector<BinInterval> GetBinIntervals(const int x, const int y) = 0;
+    virtual std::vector<BinInterval> GetBinIntervals(const int x, const int y, const int z) = 0;
     virtual int GetBinType() = 0;
     virtual Double_t GetBinXLow(const int i) = 0;
     virtual Double_t GetBinXHigh(const int i) = 0;
@@ -113,6 +121,9 @@ class Block1D: public Block {
     std::string GetBinDef( const int idx ){ return binDef[idx]; }
     std::string GetBinDef( const int x, const int y ){ return GetBinDef( x ); }
     std::string GetBinDef( const int x, const int y, const int z ){ return GetBinDef( x ); }
+    std::vector<BinInterval> GetBinIntervals( const int idx ){ return binIntervals[idx]; }
+    std::vector<BinInterval> GetBinIntervals( const int x, const int y ){ return GetBinIntervals( x ); }
+    std::vector<BinInterval> GetBinIntervals( const int x, const int y, const int z ){ return GetBinIntervals( x ); }
     int GetBinType() { return int(binType); }
 
     Double_t GetBinXLow( const int i ) { return -9999999; }
@@ -178,6 +189,7 @@ class Block1D: public Block {
     std::string zTexTitleUnit;
 
     std::vector< std::string > binDef;
+    std::vector< std::vector<BinInterval> > binIntervals;
 
   private:
     void Init();
@@ -209,14 +221,14 @@ class Block2D : public Block {
     int GetNBinsZ( const int idx, const int idy ) { return 0; }
     std::string GetBinDef( const int x, const int y, const int z ) {return this->GetBinDef(x, y);}
     std::string GetBinDef( const int x, const int y ) {
-      int index = 0;
-      for( auto i = 0; i < x; i++ ) {
-        index += (fblock_vv_[i].size() - 1);
-      }
-      index += y;
-      return this->GetBinDef( index );
+      return this->GetBinDef( this->GetBinIndex(x, y) );
     }
     std::string GetBinDef( const int idx ){ return binDef[idx]; }
+    std::vector<BinInterval> GetBinIntervals( const int x, const int y, const int z ) {return this->GetBinIntervals(x, y);}
+    std::vector<BinInterval> GetBinIntervals( const int x, const int y ) {
+      return this->GetBinIntervals( this->GetBinIndex(x, y) );
+    }
+    std::vector<BinInterval> GetBinIntervals( const int idx ){ return binIntervals[idx]; }
     int GetBinType(){ return int(binType); }
 
     Double_t GetBinXLow( const int i ) { return xbin[i]; }
@@ -254,6 +266,16 @@ class Block2D : public Block {
 
   private:
 
+    // Position of bin (x, y) in the flattened list of bin definitions
+    int GetBinIndex( const int x, const int y ) {
+      int index = 0;
+      for( auto i = 0; i < x; i++ ) {
+        index += (fblock_vv_[i].size() - 1);
+      }
+      index += y;
+      return index;
+    }
+
     std::string fName;
     std::string fTitle;
     std::string fTexTitle;
@@ -284,6 +306,7 @@ class Block2D : public Block {
     std::string zTexTitleUnit;
 
     std::vector< std::string > binDef;
+    std::vector< std::vector<BinInterval> > binIntervals;
 
   private:
     void Init();
@@ -314,27 +337,18 @@ class Block3D : public Block {
     int GetNBinsY( const int idx ) { return fblock_map_[idx].size(); }
     int GetNBinsZ( const int idx, const int idy ) { return fblock_map_[idx][idy].size() - 1; }
     std::string GetBinDef( const int x, const int y, const int z ) {
-      int index = 0;
-      for( auto i = 0; i < x; i++ ) {
-        for(auto j = 0; j < fblock_map_[i].size(); j++){
-          index+= (fblock_map_[i][j].size() - 1);
-        }
-      }
-        for( auto j = 0; j < y; j++ ) {
-          index += (fblock_map_[x][j].size() - 1);
-        }
-      index += z;
-      return this->GetBinDef( index );
+      return this->GetBinDef( this->GetBinIndex(x, y, z) );
     }
     std::string GetBinDef( const int x, const int y ) {
-      int index = 0;
-      for( auto i = 0; i < x; i++ ) {
-        for( auto j = 0; j < y; j++ ) {
-          index += (fblock_map_[i][j].size() - 1);
-        }
-      }
-      return this->GetBinDef( index );
+      return this->GetBinDef( this->GetBinIndex(x, y) );
     }
+    std::vector<BinInterval> GetBinIntervals( const int x, const int y, const int z ) {
+      return this->GetBinIntervals( this->GetBinIndex(x, y, z) );
+    }
+    std::vector<BinInterval> GetBinIntervals( const int x, const int y ) {
+      return this->GetBinIntervals( this->GetBinIndex(x, y) );
+    }
+    std::vector<BinInterval> GetBinIntervals( const int idx ){ return binIntervals[idx]; }
 
 
 
@@ -378,6 +392,31 @@ class Block3D : public Block {
 
   private:
 
+    // Position of bin (x, y, z) in the flattened list of bin definitions
+    int GetBinIndex( const int x, const int y, const int z ) {
+      int index = 0;
+      for( auto i = 0; i < x; i++ ) {
+        for(auto j = 0; j < fblock_map_[i].size(); j++){
+          index+= (fblock_map_[i][j].size() - 1);
+        }
+      }
+        for( auto j = 0; j < y; j++ ) {
+          index += (fblock_map_[x][j].size() - 1);
+        }
+      index += z;
+      return index;
+    }
+
+    int GetBinIndex( const int x, const int y ) {
+      int index = 0;
+      for( auto i = 0; i < x; i++ ) {
+        for( auto j = 0; j < y; j++ ) {
+          index += (fblock_map_[i][j].size() - 1);
+        }
+      }
+      return index;
+    }
+
     std::string fName;
     std::string fTitle;
     std::string fTexTitle;
@@ -412,6 +451,7 @@ class Block3D : public Block {
     std::string zTexTitleUnit;
 
     std::vector< std::string > binDef;
+    std::vector< std::vector<BinInterval> > binIntervals;
 
   private:
     void Init();
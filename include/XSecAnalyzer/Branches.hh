@@ -1,9 +1,48 @@
 #pragma once
 
+// Standard library includes
+#include <set>
+#include <string>
+
 // ROOT includes
 #include "TTree.h"
 #include "AnalysisEvent.hh"
 
+// Input branches that are copied directly to the output TTree by
+// set_event_output_branch_addresses(). These are always read (when present)
+// regardless of which selections are being applied.
+const std::set< std::string > OUTPUT_COPY_INPUT_BRANCH_NAMES = {
+  "nslice", "topological_score", "CosmicIP", "contained_fraction",
+  "reco_nu_vtx_sce_x", "reco_nu_vtx_sce_y", "reco_nu_vtx_sce_z",
+  "pfp_generation_v", "pfp_trk_daughters_v", "pfp_shr_daughters_v",
+  "trk_score_v", "pfpdg", "pfnhits", "pfnplanehits_U", "pfnplanehits_V",
+  "pfnplanehits_Y", "backtracked_pdg", "backtracked_e", "backtracked_px",
+  "backtracked_py", "backtracked_pz", "shr_start_x_v", "shr_start_y_v",
+  "shr_start_z_v", "shr_dist_v", "shr_id", "shr_score", "shr_energy_cali",
+  "hits_ratio", "shrmoliereavg", "shr_distance", "shr_tkfit_gap10_dedx_Y",
+  "shr_tkfit_2cm_dedx_Y", "trk_len_v", "trk_sce_start_x_v",
+  "trk_sce_start_y_v", "trk_sce_start_z_v", "trk_distance_v",
+  "trk_sce_end_x_v", "trk_sce_end_y_v", "trk_sce_end_z_v", "trk_dir_x_v",
+  "trk_dir_y_v", "trk_dir_z_v", "trk_energy_proton_v",
+  "trk_range_muon_mom_v", "trk_mcs_muon_mom_v", "trk_pid_chipr_v",
+  "trk_llr_pid_v", "trk_llr_pid_u_v", "trk_llr_pid_v_v", "trk_llr_pid_y_v",
+  "trk_llr_pid_score_v", "nu_pdg", "true_nu_vtx_x", "true_nu_vtx_y",
+  "true_nu_vtx_z", "nu_e", "ccnc", "interaction", "mc_pdg", "mc_E", "mc_px",
+  "mc_py", "mc_pz", "weightSpline", "weightTune", "ppfx_cv", "weights",
+  "nu_completeness_from_pfp", "nu_purity_from_pfp"
+};
+
+// Input branches that contain MC truth information. These are never read
+// for real data (or EXT) ntuples.
+const std::set< std::string > TRUTH_INPUT_BRANCH_NAMES = {
+  "backtracked_pdg", "backtracked_e", "backtracked_px", "backtracked_py",
+  "backtracked_pz", "nu_pdg", "true_nu_vtx_x", "true_nu_vtx_y",
+  "true_nu_vtx_z", "nu_e", "ccnc", "interaction", "true_nu_vtx_sce_x",
+  "true_nu_vtx_sce_y", "true_nu_vtx_sce_z", "mc_pdg", "mc_E", "mc_px",
+  "mc_py", "mc_pz", "weightSpline", "weightTune", "ppfx_cv", "weights",
+  "nu_completeness_from_pfp", "nu_purity_from_pfp", "nelec", "npi0", "elec_e"
+};
+
 void SetBranchAddress(TTree& etree, std::string BranchName, void* Variable) {
   etree.SetBranchAddress(BranchName.c_str(),Variable);
 }
@@ -216,6 +255,38 @@ void set_event_branch_addresses(TTree& etree, AnalysisEvent& ev)
   SetBranchAddress(etree, "elec_e", &ev.mc_elec_e_ ); // Electron energy
 }
 
+// Helper function that disables reading of all branches in the Event TTree
+// except for those that are copied to the output TTree and those listed in
+// extra_branch_names. When is_mc is false, the MC truth branches are also
+// skipped. Disabled branches keep the default values assigned by
+// AnalysisEvent::reset().
+void set_event_branch_statuses( TTree& etree,
+  const std::set< std::string >& extra_branch_names, bool is_mc )
+{
+  std::set< std::string > branch_names = OUTPUT_COPY_INPUT_BRANCH_NAMES;
+  branch_names.insert( extra_branch_names.cbegin(),
+    extra_branch_names.cend() );
+
+  etree.SetBranchStatus( "*", false );
+
+  for ( const auto& name : branch_names ) {
+    if ( !is_mc && TRUTH_INPUT_BRANCH_NAMES.count(name) ) continue;
+
+    // Some branches are excluded from certain ntuples (see
+    // set_event_branch_addresses() above), so skip any that are missing
+    TBranch* br = etree.GetBranch( name.c_str() );
+    if ( !br ) continue;
+
+    etree.SetBranchStatus( name.c_str(), true );
+
+    // Also enable any sub-branches (e.g., for a split std::map)
+    if ( br->GetListOfBranches()->GetEntries() > 0 ) {
+      std::string sub_branch_pattern = name + ".*";
+      etree.SetBranchStatus( sub_branch_pattern.c_str(), true );
+    }
+  }
+}
+
 // Helper function to set branch addresses for the output TTree
 void set_event_output_branch_addresses(TTree& out_tree, AnalysisEvent& ev,
   bool create = false)
@@ -268,9 +339,16 @@ void set_event_output_branch_addresses(TTree& out_tree, AnalysisEvent& ev,
       // Prepend "weight_" to the name of the vector of weights in the map
       std::string weight_branch_name = "weight_" + pair.first;
 
+      // Copy the current vector of weights into its output storage. The
+      // address of the copy remains valid as long as the event object exists,
+      // so later events just need to update its contents (see
+      // copy_event_output_weights() below).
+      auto& out_weights = ev.mc_weights_out_map_[ pair.first ];
+      out_weights = pair.second;
+
       // Store a pointer to the vector of weights (needed to set the branch
       // address properly) in the temporary map of pointers
-      ev.mc_weights_ptr_map_[ weight_branch_name ] = &pair.second;
+      ev.mc_weights_ptr_map_[ weight_branch_name ] = &out_weights;
 
       // Set the branch address for this vector of weights
       set_object_output_branch_address< std::vector<double> >( out_tree,
@@ -491,3 +569,16 @@ void set_event_output_branch_addresses(TTree& out_tree, AnalysisEvent& ev,
   set_object_output_branch_address< std::vector<float> >( out_tree, "mc_pz",
     ev.mc_nu_daughter_pz_, create );
 }
+
+// Helper function that copies the systematic variation weights for the current
+// event into the storage used by the output TTree branches. This allows the
+// output branch addresses to be set only once rather than for every event.
+void copy_event_output_weights( AnalysisEvent& ev ) {
+  if ( !ev.mc_weights_map_ ) return;
+
+  for ( auto& pair : ev.mc_weights_out_map_ ) {
+    auto iter = ev.mc_weights_map_->find( pair.first );
+    if ( iter != ev.mc_weights_map_->end() ) pair.second = iter->second;
+    else pair.second.clear();
+  }
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+// Standard library includes
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// XSecAnalyzer includes
+#include "XSecAnalyzer/UniverseMaker.hh"
+
+// **** Compact columnar storage for universe histograms ****
+//
+// As an alternative to writing six named TH1D/TH2D objects per universe, the
+// summed event weights for all universes that share a weight branch (a
+// "family") may be stored in a single binary file as contiguous arrays. The
+// file layout is
+//
+//   header:  8-byte magic string, then the format version, index offset,
+//            and index size (all uint64_t)
+//   data:    one block per family (see below)
+//   index:   the metadata (ntuple name, root TDirectoryFile name, bin
+//            specifications, and categorization selection name) followed by
+//            the name, dimensions, histogram mask, and data offset of each
+//            family
+//
+// The data block for a family holds the kinds of universe histograms listed
+// in its mask (see UniverseHistMask) in the order used by the UniverseHistKind
+// enum. Files written before the mask was added (format version 1) always
+// hold all six kinds. Each kind is stored as the
+// summed weights laid out as [universe][bin], then the summed squared weights
+// in the same layout, then the number of entries for each universe, and
+// finally the NUM_UNIVERSE_HIST_STATS histogram statistics (see
+// TH1::GetStats()) for each universe. The bins of 2D histograms are
+// flattened as x * num_y_bins + y. All values are native (little-endian)
+// doubles. Underflow and overflow bins are not stored, since they are never
+// filled by UniverseMaker. Files written before the statistics were added
+// (format versions 1 and 2) lack them, so the statistics of histograms read
+// from those files are recomputed from the bin contents.
+//
+// The reader maps the file into memory, so opening it is cheap and only the
+// pages for the families actually used are read from disk. Universe objects
+// built from the mapped arrays are identical to those built by
+// UniverseStore::make_universe(). Note that the true-space arrays are simply
+// zero for ntuples without MC truth information, whose histogram layout omits
+// the corresponding histograms.
+
+// Suffix appended to the name of a universe ROOT file to get the name of the
+// matching columnar file
+const std::string COLUMNAR_UNIVERSE_FILE_SUFFIX = ".univcol";
+
+inline std::string columnar_universe_file_name(
+  const std::string& root_file_name )
+{
+  return root_file_name + COLUMNAR_UNIVERSE_FILE_SUFFIX;
+}
+
+// Configuration settings that describe the universes stored in a columnar
+// file. These match the objects saved by UniverseMaker to the root
+// TDirectoryFile of a universe ROOT file.
+struct ColumnarUniverseMetadata {
+  std::string ntuple_name_;
+  std::string directory_name_;
+  std::string true_bin_spec_;
+  std::string reco_bin_spec_;
+  std::string sel_for_categ_;
+};
+
+// Location and dimensions of the arrays for a single family of universes
+struct ColumnarUniverseFamily {
+
+  // Number of bins in a single universe histogram of the given kind
+  size_t num_bins( UniverseHistKind kind ) const;
+
+  // Returns true if histograms of the given kind are stored for this family
+  inline bool has_hist( UniverseHistKind kind ) const
+    { return hist_mask_ & universe_hist_bit( kind ); }
+
+  // Number of bins along the y axis for the given kind of histogram (zero for
+  // 1D histograms)
+  size_t num_y_bins( UniverseHistKind kind ) const;
+
+  // Pointers to the mapped arrays for universe u
+  const double* sum( UniverseHistKind kind, size_t u ) const;
+  const double* sumw2( UniverseHistKind kind, size_t u ) const;
+  double entries( UniverseHistKind kind, size_t u ) const;
+
+  // Pointer to the NUM_UNIVERSE_HIST_STATS histogram statistics for universe
+  // u, or nullptr if they are not stored
+  const double* stats( UniverseHistKind kind, size_t u ) const;
+
+  std::string subdirectory_name_;
+  std::string universe_name_;
+  size_t num_universes_ = 0u;
+  size_t num_true_bins_ = 0u;
+  size_t num_reco_bins_ = 0u;
+  size_t num_categories_ = 0u;
+  UniverseHistMask hist_mask_ = ALL_UNIVERSE_HISTS;
+  bool has_stats_ = true;
+
+  // Start of each kind of array within the mapped file (null for kinds that
+  // are not stored)
+  const double* kind_data_[ NUM_UNIVERSE_HIST_KINDS ] = { nullptr };
+};
+
+// Writes universes to a new columnar file. Families are appended one at a
+// time, and the index is written when close() is called (or upon
+// destruction).
+class ColumnarUniverseWriter {
+
+  public:
+
+    ColumnarUniverseWriter( const std::string& file_name,
+      const ColumnarUniverseMetadata& metadata );
+
+    ~ColumnarUniverseWriter();
+
+    // Writes the contents of every universe in a UniverseStore
+    void write_store( const std::string& subdirectory_name,
+      const UniverseStore& store );
+
+    // Writes a family of universes stored as histograms (e.g., loaded from
+    // an existing universe ROOT file). The universe indices must match their
+    // positions in the vector, and every universe must own the same kinds of
+    // histograms.
+    void write_universes( const std::string& subdirectory_name,
+      const std::vector< const Universe* >& universes );
+
+    void close();
+
+  protected:
+
+    // Callback used to fill one dense row of summed weights and squared
+    // weights, and the histogram statistics, for a given kind of histogram
+    // and universe. Any of the pointers may be null if the values are not
+    // needed. The return value is the number of entries.
+    using RowFunction = std::function< double( UniverseHistKind, size_t,
+      double*, double*, double* ) >;
+
+    void write_family( const std::string& subdirectory_name,
+      const std::string& universe_name, size_t num_universes,
+      size_t num_true_bins, size_t num_reco_bins, size_t num_categories,
+      UniverseHistMask hist_mask, const RowFunction& get_row );
+
+    std::string file_name_;
+    std::ofstream out_;
+    ColumnarUniverseMetadata metadata_;
+    std::vector< ColumnarUniverseFamily > families_;
+    std::vector< uint64_t > family_offsets_;
+    uint64_t current_offset_ = 0u;
+    bool closed_ = false;
+};
+
+// Read-only view of a columnar universe file mapped into memory
+class MappedUniverseFile {
+
+  public:
+
+    MappedUniverseFile( const std::string& file_name );
+    ~MappedUniverseFile();
+
+    MappedUniverseFile( const MappedUniverseFile& ) = delete;
+    MappedUniverseFile& operator=( const MappedUniverseFile& ) = delete;
+
+    inline const ColumnarUniverseMetadata& metadata() const
+      { return metadata_; }
+
+    inline const std::vector< ColumnarUniverseFamily >& families() const
+      { return families_; }
+
+    // Returns the requested family, or nullptr if it is not present
+    const ColumnarUniverseFamily* find_family(
+      const std::string& subdirectory_name,
+      const std::string& universe_name ) const;
+
+    // Returns the names of all families stored for a given subdirectory
+    std::vector< std::string > family_names(
+      const std::string& subdirectory_name ) const;
+
+    // Creates a Universe object holding the histograms for universe u of a
+    // family. The histograms are not attached to any TDirectory. This may be
+    // called from several threads at once provided that TH1::AddDirectory
+    // has been disabled beforehand.
+    std::unique_ptr< Universe > make_universe(
+      const ColumnarUniverseFamily& family, size_t u ) const;
+
+    // Replaces the contents of the histograms owned by an existing Universe
+    // object (with matching binning and kinds of histograms) by those of
+    // universe u of a family
+    void copy_to_universe( const ColumnarUniverseFamily& family, size_t u,
+      Universe& univ ) const;
+
+  protected:
+
+    std::string file_name_;
+    void* mapped_data_ = nullptr;
+    size_t mapped_size_ = 0u;
+
+    ColumnarUniverseMetadata metadata_;
+    std::vector< ColumnarUniverseFamily > families_;
+
+    // Keys are (subdirectory name, universe name) pairs, values are indices
+    // in families_
+    std::map< std::pair< std::string, std::string >, size_t > family_map_;
+};
@@ -420,30 +420,34 @@ CrossSectionResult CrossSectionExtractor::get_unfolded_events() {
     const TMatrixD& A_C = *xsec.result_.add_smear_matrix_;
 
    // Update each of the owned predictions by multiplying them by the
-   // additional smearing matrix
+   // additional smearing matrix. All predictions are transformed together.
+    std::vector< TMatrixD* > truth_preds;
     for ( auto& pair : pred_map_ ) {
-      //const auto& model_description = pair.first;
-      TMatrixD& truth_pred = pair.second->get_prediction();
-
-      TMatrixD ac_temp( A_C, TMatrixD::kMult, truth_pred );
-      truth_pred = ac_temp;
+      truth_preds.push_back( &pair.second->get_prediction() );
     }
+    batch_transform_columns( A_C, truth_preds );
   }
 
   // Propagate all defined covariance matrices through the unfolding procedure
-  // using the "error propagation matrix" and its transpose
+  // using the "error propagation matrix" and its transpose. The matrices are
+  // transformed in batches to avoid many small matrix multiplications.
   const TMatrixD& err_prop = *xsec.result_.err_prop_matrix_;
-  TMatrixD err_prop_tr( TMatrixD::kTransposed, err_prop );
 
+  std::vector< std::string > matrix_keys;
+  std::vector< std::unique_ptr< TMatrixD > > reco_cov_mats;
+  std::vector< const TMatrixD* > reco_cov_ptrs;
   for ( const auto& matrix_pair : *matrix_map ) {
-    const std::string& matrix_key = matrix_pair.first;
-    auto temp_cov_mat = matrix_pair.second.get_matrix();
+    matrix_keys.push_back( matrix_pair.first );
+    reco_cov_mats.push_back( matrix_pair.second.get_matrix() );
+    reco_cov_ptrs.push_back( reco_cov_mats.back().get() );
+  }
 
-    TMatrixD temp_mat( *temp_cov_mat, TMatrixD::EMatrixCreatorsOp2::kMult,
-      err_prop_tr );
+  auto unfolded_cov_mats = batch_similarity_transform( err_prop,
+    reco_cov_ptrs, unfolder_->num_threads() );
 
-    xsec.unfolded_cov_matrix_map_[ matrix_key ] = std::make_unique< TMatrixD >(
-      err_prop, TMatrixD::EMatrixCreatorsOp2::kMult, temp_mat );
+  for ( size_t m = 0u; m < matrix_keys.size(); ++m ) {
+    xsec.unfolded_cov_matrix_map_[ matrix_keys.at( m ) ]
+      = std::move( unfolded_cov_mats.at( m ) );
   }
 
   // Decompose the block-diagonal pieces of the total covariance matrix
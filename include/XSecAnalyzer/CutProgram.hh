@@ -0,0 +1,280 @@
+#pragma once
+
+// Standard library includes
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// ROOT includes
+#include "TLeaf.h"
+#include "TTree.h"
+#include "TTreeFormula.h"
+
+// Evaluates a list of cut expressions (e.g., the bin definitions used by
+// UniverseMaker) for the current entry of a TTree. Each expression is parsed
+// once into a small expression graph whose nodes are shared between all of the
+// expressions. Scalar numeric branches are read directly from their TLeaf
+// objects, and sub-expressions that are common to several cuts (a shared
+// selection, a kinematic variable, etc.) are evaluated at most once per entry.
+//
+// Pieces of an expression that the parser does not handle itself (method calls
+// like "p3_mu.CosTheta()", function calls, etc.) are delegated to a single
+// TTreeFormula per distinct piece of text. Expressions that cannot be
+// compiled at all, for instance because they refer to array-valued branches,
+// fall back to a dedicated TTreeFormula so that the results are always the
+// same as a direct TTreeFormula evaluation of the full expression. Any nodes
+// created while trying to compile such an expression are discarded, so only
+// TTreeFormula objects that are actually evaluated are kept.
+//
+// The function compare_cuts() (used by the CheckCuts executable) checks that
+// the compiled expressions give the same results as TTreeFormula for the
+// entries of an ntuple.
+class CutProgram {
+
+  public:
+
+    // Compiles the cut expressions using the branches of the input TTree.
+    // Names of any TTreeFormula objects that are created will begin with the
+    // given prefix. If use_fallbacks is false, then no fallback TTreeFormula
+    // is created for an expression that cannot be compiled. In that case,
+    // evaluate() ignores the expression, and value() must not be used for it.
+    CutProgram( const std::vector<std::string>& cuts, TTree& tree,
+      const std::string& formula_name_prefix, bool use_fallbacks = true );
+
+    // Must be called whenever the TTree owned by a TChain changes
+    void notify();
+
+    // Evaluates all of the cut expressions for the current entry, which must
+    // already have been read using TTree::GetEntry(). The function object
+    // on_match( index, weight ) is called in order of increasing cut index
+    // for each expression that evaluates to a nonzero value. Expressions
+    // handled by a fallback TTreeFormula may produce several matches, one per
+    // nonzero formula instance.
+    template < typename Func > void evaluate( Func&& on_match );
+
+    // Marks the start of a new entry by discarding all cached node values.
+    // Only needed before calls to value(), since evaluate() does this itself.
+    inline void begin_entry() { ++epoch_; }
+
+    // Returns the value of a single compiled expression for the current
+    // entry. Values computed since the last call to begin_entry() are reused.
+    inline double value( size_t index ) { return this->eval( roots_[index] ); }
+
+    // Returns true if the expression with the given index was compiled, i.e.,
+    // if it may be passed to value()
+    inline bool is_compiled( size_t index ) const
+      { return roots_.at( index ) >= 0; }
+
+    // Returns true if two cut expressions were compiled into the same node
+    // of the graph. Since identical expressions always share a node, this
+    // means that they have the same value for every entry.
+    inline bool same_expression( size_t c1, size_t c2 ) const {
+      int root = roots_.at( c1 );
+      return root >= 0 && root == roots_.at( c2 );
+    }
+
+    // Number of cut expressions handled by the compiled graph
+    inline size_t num_compiled() const { return num_compiled_; }
+
+    // Number of cut expressions that fell back to a full TTreeFormula (or
+    // that are ignored if fallbacks are disabled)
+    inline size_t num_fallback() const { return num_cuts_ - num_compiled_; }
+
+    // Number of distinct nodes in the compiled expression graph
+    inline size_t num_nodes() const { return nodes_.size(); }
+
+    // Adds the names of the top-level TTree branches that hold the leaves
+    // read by any of the expressions (including via TTreeFormula) to a set.
+    // Only these branches need to be enabled for evaluate() to work.
+    void add_used_branches( std::set<std::string>& branch_names ) const;
+
+  protected:
+
+    enum class Op {
+      kConstant, kLeaf, kFormula, kNot, kNegate, kAnd, kOr, kEqual,
+      kNotEqual, kLess, kLessEqual, kGreater, kGreaterEqual, kAdd, kSubtract,
+      kMultiply, kDivide, kModulo
+    };
+
+    struct Node {
+      Op op_;
+      // Child node indices (or -1 if unused)
+      int left_;
+      int right_;
+      // Value of a constant node
+      double value_;
+      // Index in leaves_ or formulas_ for leaf and formula nodes
+      size_t slot_;
+    };
+
+    // Helper class that turns a single cut string into nodes of the graph.
+    // Defined in the source file.
+    class Parser;
+
+    // Adds a node to the graph, reusing an identical existing node if one
+    // is found
+    int add_node( Op op, int left, int right, double value = 0.,
+      size_t slot = 0u );
+
+    // Returns the node that reads the named scalar leaf, or -1 if the name
+    // does not refer to one
+    int leaf_node( const std::string& name );
+
+    // Returns the node that evaluates an arbitrary expression using a shared
+    // TTreeFormula. Throws an exception if the expression cannot be handled
+    // in this way.
+    int formula_node( const std::string& expr );
+
+    // Removes every node, leaf, and shared TTreeFormula created after the
+    // graph had the given sizes. Used to undo a failed compilation.
+    void truncate( size_t num_nodes, size_t num_leaves, size_t num_formulas );
+
+    // Evaluates a node (and, as needed, its children) for the current entry
+    double eval( int node );
+
+    TTree* tree_;
+    std::string prefix_;
+
+    // The graph itself. Children always appear before their parents.
+    std::vector< Node > nodes_;
+
+    // Key: (op, left, right, value, slot), value: index in nodes_
+    std::map< std::tuple<int, int, int, double, size_t>, int > node_index_;
+
+    // Scalar leaves read directly by the graph
+    std::vector< std::string > leaf_names_;
+    std::vector< TLeaf* > leaves_;
+    std::map< std::string, int > leaf_node_index_;
+
+    // Shared TTreeFormula objects used for opaque sub-expressions
+    std::vector< std::unique_ptr<TTreeFormula> > formulas_;
+    std::map< std::string, int > formula_node_index_;
+
+    // Root node of each compiled cut expression (or -1 if the cut uses a
+    // fallback TTreeFormula instead)
+    std::vector< int > roots_;
+
+    // Fallback TTreeFormula objects (null for compiled cuts and when
+    // fallbacks are disabled)
+    std::vector< std::unique_ptr<TTreeFormula> > fallbacks_;
+
+    size_t num_cuts_ = 0u;
+    size_t num_compiled_ = 0u;
+
+    // Per-entry cache of node values. A node's value is current if its stamp
+    // matches epoch_.
+    std::vector< double > values_;
+    std::vector< uint64_t > stamps_;
+    uint64_t epoch_ = 0u;
+};
+
+// Checks the results of a CutProgram (or of any other object with the same
+// notify() and evaluate() member functions, such as a BinLookup) against a
+// direct TTreeFormula evaluation of each of the cut expressions that it was
+// built from. The first max_entries entries of the TTree are used (or all of
+// them if max_entries is negative). A match counts as the same only if the
+// cut index and the weight are identical. Each entry with a difference is
+// reported to the output stream, and the number of such entries is returned.
+template < typename Program > long long compare_cuts( Program& program,
+  const std::vector<std::string>& cuts, TTree& tree, long long max_entries,
+  std::ostream& out, const std::string& formula_name_prefix );
+
+template < typename Func > void CutProgram::evaluate( Func&& on_match ) {
+  // Invalidate all cached node values from the previous entry
+  this->begin_entry();
+
+  for ( size_t c = 0u; c < num_cuts_; ++c ) {
+    int root = roots_[ c ];
+    if ( root >= 0 ) {
+      double result = this->eval( root );
+      if ( result ) on_match( c, result );
+    }
+    else if ( fallbacks_[c] ) {
+      auto& formula = fallbacks_[ c ];
+      int num_formula_elements = formula->GetNdata();
+      for ( int el = 0; el < num_formula_elements; ++el ) {
+        double formula_wgt = formula->EvalInstance( el );
+        if ( formula_wgt ) on_match( c, formula_wgt );
+      }
+    }
+  }
+}
+
+template < typename Program > long long compare_cuts( Program& program,
+  const std::vector<std::string>& cuts, TTree& tree, long long max_entries,
+  std::ostream& out, const std::string& formula_name_prefix )
+{
+  // Use the same evaluation strategy as the original UniverseMaker event
+  // loop as a reference
+  std::vector< std::unique_ptr<TTreeFormula> > formulas;
+  for ( size_t c = 0u; c < cuts.size(); ++c ) {
+    std::string formula_name = formula_name_prefix + std::to_string( c );
+    formulas.emplace_back( std::make_unique<TTreeFormula>(
+      formula_name.c_str(), cuts.at(c).c_str(), &tree ) );
+  }
+
+  long long num_entries = tree.GetEntries();
+  if ( max_entries >= 0 && max_entries < num_entries ) {
+    num_entries = max_entries;
+  }
+
+  std::vector< std::pair<size_t, double> > expected;
+  std::vector< std::pair<size_t, double> > found;
+  int tree_number = -1;
+  long long num_bad_entries = 0;
+
+  for ( long long entry = 0; entry < num_entries; ++entry ) {
+    if ( tree.GetEntry(entry) <= 0 ) break;
+
+    if ( tree_number != tree.GetTreeNumber() ) {
+      tree_number = tree.GetTreeNumber();
+      program.notify();
+      for ( auto& formula : formulas ) formula->Notify();
+    }
+
+    expected.clear();
+    for ( size_t c = 0u; c < formulas.size(); ++c ) {
+      auto& formula = formulas[ c ];
+      int num_formula_elements = formula->GetNdata();
+      for ( int el = 0; el < num_formula_elements; ++el ) {
+        double formula_wgt = formula->EvalInstance( el );
+        if ( formula_wgt ) expected.emplace_back( c, formula_wgt );
+      }
+    }
+
+    found.clear();
+    program.evaluate( [ & ]( size_t c, double wgt ) {
+      found.emplace_back( c, wgt );
+    } );
+
+    // NaN weights are considered equal to each other
+    bool same = ( expected.size() == found.size() );
+    for ( size_t m = 0u; same && m < found.size(); ++m ) {
+      const auto& e = expected[ m ];
+      const auto& f = found[ m ];
+      same = e.first == f.first && ( e.second == f.second
+        || (e.second != e.second && f.second != f.second) );
+    }
+
+    if ( same ) continue;
+    ++num_bad_entries;
+
+    out << "Entry " << entry << ": expected matches";
+    for ( const auto& e : expected ) {
+      out << " (" << e.first << ", " << e.second << ')';
+    }
+    out << ", found";
+    for ( const auto& f : found ) {
+      out << " (" << f.first << ", " << f.second << ')';
+    }
+    out << '\n';
+  }
+
+  return num_bad_entries;
+}
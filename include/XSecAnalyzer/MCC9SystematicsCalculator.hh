@@ -2,6 +2,10 @@
 
 // Standard library includes
 #include <algorithm>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 // STV analysis includes
 #include "SystematicsCalculator.hh"
@@ -29,6 +33,9 @@ class MCC9SystematicsCalculator : public SystematicsCalculator {
     virtual double evaluate_observable( const Universe& univ, int reco_bin,
       std::string event_category, int flux_universe_index = -1 ) const override;
 
+    virtual std::vector< double > evaluate_observables( const Universe& univ,
+      int flux_universe_index = -1 ) const override;
+
     virtual double evaluate_mc_stat_covariance( const Universe& univ,
       int reco_bin_a, int reco_bin_b ) const override;
 
@@ -38,12 +45,52 @@ class MCC9SystematicsCalculator : public SystematicsCalculator {
     inline void set_syst_mode( SystMode mode )
       { syst_mode_ = mode; }
 
+    virtual void clear_observable_cache() const override;
+
+    virtual bool has_cached_observables( const Universe& univ,
+      int flux_universe_index = -1 ) const override;
+
   protected:
 
     // Default to using the standard recipe of calculating covariance matrix
     // elements for a cross-section measurement
     SystMode syst_mode_ = SystMode::ForXSec;
 
+    // Keys are reco bin block indices, values are the (ascending) indices of
+    // the true bins that contribute to reco bins in each block. These include
+    // all background true bins and the signal true bins in the same block.
+    // This is computed once on construction for use by
+    // evaluate_observables().
+    std::map< int, std::vector< size_t > > block_true_bins_;
+
+    // Reco bin sums for a single universe from which evaluate_observables()
+    // assembles the observable in any SystMode
+    struct ObservableParts {
+
+      // Signal and background events taken directly from the universe's 2D
+      // histogram
+      std::vector< double > signal_;
+      std::vector< double > background_;
+
+      // Signal events predicted by applying the universe's smearceptance
+      // matrix to the CV event counts in the signal true bins
+      std::vector< double > signal_response_;
+    };
+
+    // Returns the (possibly cached) ObservableParts for a universe. The second
+    // argument selects whether the CV true event counts are used in the
+    // smearceptance matrix denominator (as is done for flux universes).
+    const ObservableParts& get_observable_parts( const Universe& univ,
+      bool use_cv_denominator ) const;
+
+    // Cached ObservableParts keyed by the universe address and the
+    // use_cv_denominator flag. Entries are never modified after insertion,
+    // so they may be shared between the three passes over the universes
+    // made by CrossSectionExtractor (and between threads).
+    mutable std::map< std::pair< const Universe*, bool >, ObservableParts >
+      observable_cache_;
+    mutable std::mutex observable_cache_mutex_;
+
 };
 
 MCC9SystematicsCalculator::MCC9SystematicsCalculator(
@@ -53,7 +100,20 @@ MCC9SystematicsCalculator::MCC9SystematicsCalculator(
   : SystematicsCalculator( input_respmat_file_name,
   syst_cfg_file_name, respmat_tdirectoryfile_name )
 {
-
+  for ( const auto& rbin : reco_bins_ ) {
+    int block = rbin.block_index_;
+    if ( block_true_bins_.count(block) ) continue;
+
+    auto& tb_indices = block_true_bins_[ block ];
+    for ( size_t tb = 0u; tb < true_bins_.size(); ++tb ) {
+      const auto& tbin = true_bins_.at( tb );
+      if ( tbin.type_ == kBackgroundTrueBin || ( tbin.type_ == kSignalTrueBin
+        && tbin.block_index_ == block ) )
+      {
+        tb_indices.push_back( tb );
+      }
+    }
+  }
 }
 
 double MCC9SystematicsCalculator::evaluate_observable( const Universe& univ,
@@ -199,6 +259,177 @@ double MCC9SystematicsCalculator::evaluate_observable( const Universe& univ,
   return reco_bin_events;
 }
 
+void MCC9SystematicsCalculator::clear_observable_cache() const {
+  std::lock_guard< std::mutex > lock( observable_cache_mutex_ );
+  observable_cache_.clear();
+}
+
+bool MCC9SystematicsCalculator::has_cached_observables( const Universe& univ,
+  int flux_universe_index ) const
+{
+  // The CV parts are always needed as well, but they are computed from
+  // histograms that are never unloaded
+  std::lock_guard< std::mutex > lock( observable_cache_mutex_ );
+  return observable_cache_.count(
+    std::make_pair(&univ, flux_universe_index >= 0) ) > 0;
+}
+
+// Computes the separate signal and background sums needed to evaluate the
+// observable in every reco bin for a single universe. The contribution of
+// each signal true bin to the signal response sum has the form (N_2d / d) * f,
+// where N_2d is the 2D histogram content and the divisor d and factor f depend
+// only on the true bin. These are tabulated once, after which the reco bin sums
+// are done directly on the histogram arrays.
+const MCC9SystematicsCalculator::ObservableParts&
+  MCC9SystematicsCalculator::get_observable_parts( const Universe& univ,
+  bool use_cv_denominator ) const
+{
+  auto key = std::make_pair( &univ, use_cv_denominator );
+  {
+    std::lock_guard< std::mutex > lock( observable_cache_mutex_ );
+    auto iter = observable_cache_.find( key );
+    if ( iter != observable_cache_.end() ) return iter->second;
+  }
+
+  size_t num_true_bins = true_bins_.size();
+  size_t num_reco_bins = reco_bins_.size();
+
+  // See evaluate_observable() for the choice of CV universe
+  const Universe* cv_univ = nullptr;
+  if ( this->is_detvar_universe(univ) ) {
+    cv_univ = detvar_universes_.at( NFT::kDetVarMCCV ).get();
+  }
+  else {
+    cv_univ = &this->cv_universe();
+  }
+
+  for ( const auto* u : { &univ, cv_univ } ) {
+    if ( static_cast<size_t>( u->hist_2d_->GetNbinsX() ) != num_true_bins
+      || static_cast<size_t>( u->hist_2d_->GetNbinsY() ) != num_reco_bins )
+    {
+      throw std::runtime_error( "Universe binning mismatch in"
+        " MCC9SystematicsCalculator::get_observable_parts()" );
+    }
+  }
+
+  // Access the histogram contents directly. Note that the ROOT arrays
+  // include underflow and overflow bins. Global bin numbers for the 2D
+  // histograms are computed as x_bin + ( num_x_bins + 2 ) * y_bin.
+  const double* univ_true = univ.hist_true_->GetArray();
+  const double* cv_true = cv_univ->hist_true_->GetArray();
+  const double* univ_2d = univ.hist_2d_->GetArray();
+  size_t row_stride = num_true_bins + 2u;
+
+  // Tabulate the smearceptance coefficients for the signal true bins
+  std::vector< double > divisor( num_true_bins, 1. );
+  std::vector< double > factor( num_true_bins, 0. );
+  std::vector< char > is_signal( num_true_bins, false );
+
+  for ( size_t tb = 0u; tb < num_true_bins; ++tb ) {
+    if ( true_bins_.at(tb).type_ != kSignalTrueBin ) continue;
+    is_signal[ tb ] = true;
+
+    double denom_CV = cv_true[ tb + 1 ];
+    double denom = univ_true[ tb + 1 ];
+    if ( use_cv_denominator ) denom = denom_CV;
+
+    if ( denom > 0. ) {
+      divisor[ tb ] = denom;
+      factor[ tb ] = denom_CV;
+    }
+  }
+
+  ObservableParts parts;
+  parts.signal_.assign( num_reco_bins, 0. );
+  parts.background_.assign( num_reco_bins, 0. );
+  parts.signal_response_.assign( num_reco_bins, 0. );
+
+  for ( size_t rb = 0u; rb < num_reco_bins; ++rb ) {
+
+    const auto& tb_indices = block_true_bins_.at(
+      reco_bins_[ rb ].block_index_ );
+
+    const double* univ_row = univ_2d + ( rb + 1u ) * row_stride + 1u;
+
+    double signal = 0.;
+    double background = 0.;
+    double signal_response = 0.;
+    for ( size_t tb : tb_indices ) {
+      double events = univ_row[ tb ];
+      if ( is_signal[ tb ] ) {
+        signal += events;
+        signal_response += events / divisor[ tb ] * factor[ tb ];
+      }
+      else background += events;
+    }
+
+    parts.signal_[ rb ] = signal;
+    parts.background_[ rb ] = background;
+    parts.signal_response_[ rb ] = signal_response;
+  }
+
+  // If another thread got here first, then its entry is kept
+  std::lock_guard< std::mutex > lock( observable_cache_mutex_ );
+  auto result = observable_cache_.emplace( key, std::move(parts) );
+  return result.first->second;
+}
+
+// Faster version of evaluate_observable() that computes the observable in all
+// reco bins for a single universe. Results are assembled from the cached
+// signal and background sums for the universe and its CV, so evaluating the
+// same universe again (e.g., in a different SystMode) does not require another
+// pass over the histograms. Note that the signal and background are summed
+// separately, so results may differ from evaluate_observable() by rounding.
+std::vector< double > MCC9SystematicsCalculator::evaluate_observables(
+  const Universe& univ, int flux_universe_index ) const
+{
+  const Universe* cv_univ = nullptr;
+  if ( this->is_detvar_universe(univ) ) {
+    cv_univ = detvar_universes_.at( NFT::kDetVarMCCV ).get();
+  }
+  else {
+    cv_univ = &this->cv_universe();
+  }
+
+  const auto& parts = this->get_observable_parts( univ,
+    flux_universe_index >= 0 );
+  const auto& cv_parts = this->get_observable_parts( *cv_univ, false );
+
+  const std::vector< double >* signal = nullptr;
+  const std::vector< double >* background = nullptr;
+
+  if ( syst_mode_ == SystMode::ForXSec ) {
+    signal = &parts.signal_response_;
+    background = &parts.background_;
+  }
+  else if ( syst_mode_ == SystMode::VaryOnlyBackground ) {
+    signal = &cv_parts.signal_;
+    background = &parts.background_;
+  }
+  else if ( syst_mode_ == SystMode::VaryOnlySignalResponse ) {
+    signal = &parts.signal_response_;
+    background = &cv_parts.background_;
+  }
+  else if ( syst_mode_ == SystMode::VaryOnlySignal ) {
+    signal = &parts.signal_;
+    background = &cv_parts.background_;
+  }
+  else if ( syst_mode_ == SystMode::VaryBackgroundAndSignalDirectly ) {
+    signal = &parts.signal_;
+    background = &parts.background_;
+  }
+  else throw std::runtime_error( "Unrecognized SystMode enum value"
+    " in MCC9SystematicsCalculator::evaluate_observables()" );
+
+  size_t num_reco_bins = reco_bins_.size();
+  std::vector< double > result( num_reco_bins, 0. );
+  for ( size_t rb = 0u; rb < num_reco_bins; ++rb ) {
+    result[ rb ] = signal->at( rb ) + background->at( rb );
+  }
+
+  return result;
+}
+
 // overloaded version to only evaluate specific event category
 double MCC9SystematicsCalculator::evaluate_observable( const Universe& univ,
   int reco_bin, std::string event_category, int flux_universe_index ) const
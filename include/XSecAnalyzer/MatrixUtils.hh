@@ -7,6 +7,7 @@
 #include <iomanip>
 #include <limits>
 #include <memory>
+#include <vector>
 
 // ROOT includes
 #include "TDecompQRH.h"
@@ -41,3 +42,18 @@ TMatrixD direct_sum( const std::vector< const TMatrixD* >& matrices );
 
 // Overloaded version for a pair of input matrices
 TMatrixD direct_sum( const TMatrixD& m1, const TMatrixD& m2 );
+
+// Computes A * M * A^T for every input matrix M using the same transformation
+// matrix A. The input matrices are packed together so that each step of the
+// calculation is done using a few large matrix multiplications, and groups of
+// them are processed concurrently on up to num_threads threads. All input
+// matrices must be square with a dimension equal to the number of columns of
+// A. The results are returned in the same order as the inputs.
+std::vector< std::unique_ptr< TMatrixD > > batch_similarity_transform(
+  const TMatrixD& transform, const std::vector< const TMatrixD* >& matrices,
+  size_t num_threads );
+
+// Replaces each input column vector v by A * v. The vectors are multiplied
+// together as the columns of a single matrix.
+void batch_transform_columns( const TMatrixD& transform,
+  const std::vector< TMatrixD* >& column_vectors );
@@ -16,6 +16,7 @@ public:
   virtual void compute_true_observables( AnalysisEvent* event ) override final;
   virtual void define_output_branches() override final;
   virtual void define_constants() override final;
+  virtual void define_input_branches() override final;
   virtual void define_category_map() override final;
   virtual void reset() override final;
 
@@ -1,8 +1,10 @@
 #pragma once
 
 // Standard library includes
+#include <set>
 #include <string>
 #include <type_traits>
+#include <vector>
 
 // ROOT includes
 #include "TTree.h"
@@ -26,6 +28,11 @@ public:
   void apply_selection( AnalysisEvent* event );
   void summary();
 
+  // Adds the event counters from another instance of the same selection. This
+  // is used to combine the results from several worker threads before calling
+  // summary().
+  void add_counts( const SelectionBase& other );
+
   virtual void final_tasks() {};
 
   inline bool is_event_mc_signal() { return mc_signal_; }
@@ -33,6 +40,15 @@ public:
 
   inline const std::string& name() const { return selection_name_; }
 
+  // Names of the input ntuple branches read by this selection. If
+  // reads_all_input_branches() returns true, then the selection did not
+  // declare its inputs and every branch should be read.
+  inline const std::set< std::string >& input_branches() const
+    { return input_branches_; }
+
+  inline bool reads_all_input_branches() const
+    { return reads_all_input_branches_; }
+
   inline const std::map< int, std::pair< std::string, int > >&
     category_map() const { return categ_map_; }
 
@@ -98,6 +114,10 @@ protected:
   void setup_tree();
   void reset_base();
 
+  // Adds to the set of input ntuple branches needed by this selection. This
+  // should be called from within define_input_branches().
+  void add_input_branches( const std::vector< std::string >& branch_names );
+
   inline int get_event_number() { return event_number_; }
 
   inline void define_true_FV( double XMin, double XMax, double YMin,
@@ -142,6 +162,11 @@ protected:
   virtual void reset() = 0;
   void define_additional_input_branches() {};
 
+  // Selections that override this function should declare all of the input
+  // ntuple branches that they use via add_input_branches(). The default
+  // implementation leaves every input branch enabled.
+  virtual void define_input_branches() {};
+
   TTree* out_tree_;
   bool need_to_create_branches_;
 
@@ -168,4 +193,7 @@ private:
 
   int event_number_;
 
+  std::set< std::string > input_branches_;
+  bool reads_all_input_branches_ = true;
+
 };
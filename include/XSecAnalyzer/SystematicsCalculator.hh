@@ -1,10 +1,15 @@
 #pragma once
 
 // Standard library includes
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
 #include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
 
 // ROOT includes
 #include "TDirectoryFile.h"
@@ -15,7 +20,9 @@
 #include "TParameter.h"
 
 // XSecAnalyzer includes
+#include "ColumnarUniverseFile.hh"
 #include "FilePropertiesManager.hh"
+#include "ThreadUtils.hh"
 #include "UniverseMaker.hh"
 
 #include "Selections/SelectionBase.hh"
@@ -132,6 +139,21 @@ struct MeasuredEvents {
 
 };
 
+// Definition of a single covariance matrix read from a systematics
+// configuration file
+struct CovMatrixDefinition {
+
+  std::string name_;
+  std::string type_;
+
+  // Any remaining configuration values for this matrix (e.g., the weight
+  // name for a "RW" matrix or the terms for a "sum" matrix)
+  std::vector< std::string > args_;
+
+  // For "sum" matrices, indices of the terms in the full list of definitions
+  std::vector< size_t > dependencies_;
+};
+
 using CovMatrixMap = std::map< std::string, CovMatrix >;
 using NFT = NtupleFileType;
 
@@ -147,10 +169,33 @@ class SystematicsCalculator {
 
     void load_universes( TDirectoryFile& total_subdir );
 
-    void build_universes( TDirectoryFile& root_tdir );
+    // If a columnar universe file is provided, then the reweightable
+    // universes for each ntuple are read from it whenever possible (falling
+    // back to the histograms in root_tdir otherwise). The results are the
+    // same either way. Worker threads read the file that owns root_tdir
+    // through their own handles, so it must not be open for writing.
+    void build_universes( TDirectoryFile& root_tdir,
+      const MappedUniverseFile* columnar_file = nullptr );
 
     void save_universes( TDirectoryFile& out_tdf );
 
+    // Most reweightable systematic universes are loaded from the input file
+    // only when they are needed. Code that needs the histograms for a Universe
+    // owned by this object should call acquire_universe() first and then
+    // release_universe() when it is finished. These calls are reference
+    // counted and may be made from several threads at once, in which case
+    // different universes are loaded concurrently. They have no
+    // effect for Universe objects that are always kept in memory. The
+    // UniverseGuard class below offers a convenient way of doing this.
+    void acquire_universe( const Universe& univ ) const;
+    void release_universe( const Universe& univ ) const;
+
+    // Returns true if the observables for the given universe have already
+    // been cached by evaluate_observables(), in which case the universe
+    // histograms do not need to be loaded to evaluate them again
+    virtual bool has_cached_observables( const Universe& /*univ*/,
+      int /*flux_universe_index*/ = -1 ) const { return false; }
+
     const Universe& cv_universe() const {
       return *rw_universes_.at( CV_UNIV_NAME ).front();
     }
@@ -161,6 +206,11 @@ class SystematicsCalculator {
 
     std::unique_ptr< CovMatrixMap > get_covariances() const;
 
+    // Sets the maximum number of threads used to compute independent
+    // covariance matrices in get_covariances()
+    inline void set_num_threads( size_t num_threads )
+      { num_threads_ = std::max( num_threads, size_t(1u) ); }
+
     // Returns a background-subtracted measurement in all ordinary reco bins
     // with the total covariance matrix and the background event counts that
     // were subtracted.
@@ -223,6 +273,16 @@ class SystematicsCalculator {
 
     CovMatrix make_covariance_matrix( const std::string& hist_name ) const;
 
+    // Parses the systematics configuration file. Definitions are returned in
+    // the same order as they appear in the file.
+    std::vector< CovMatrixDefinition > read_covariance_definitions() const;
+
+    // Computes a single covariance matrix that does not depend on any others
+    // (i.e., anything other than a "sum" matrix). This function may be called
+    // concurrently for different matrices.
+    void fill_covariance_matrix( const CovMatrixDefinition& def,
+      CovMatrix& cov_mat ) const;
+
     // Evaluate the observable described by the covariance matrices in
     // a given universe and reco-space bin. NOTE: the reco bin index given
     // as an argument to this function is zero-based.
@@ -233,6 +293,18 @@ class SystematicsCalculator {
     virtual double evaluate_observable( const Universe& univ, int reco_bin,
       std::string event_category, int flux_universe_index = -1 ) const = 0;
 
+    // Evaluate the observable in every covariance matrix bin for a given
+    // universe at once. The default implementation simply calls
+    // evaluate_observable() for each bin. Derived classes may override it
+    // with a faster version that avoids the per-bin overhead.
+    virtual std::vector< double > evaluate_observables( const Universe& univ,
+      int flux_universe_index = -1 ) const;
+
+    // Discards any observable values that were cached by a derived class in
+    // evaluate_observables(). This is called whenever the owned Universe
+    // objects are replaced.
+    virtual void clear_observable_cache() const {}
+
     // Evaluate a covariance matrix element for the data statistical
     // uncertainty on the observable of interest for a given pair of reco bins.
     // In cases where every event falls into a unique reco bin, only the
@@ -262,6 +334,14 @@ class SystematicsCalculator {
     // Central value universe name
     const std::string CV_UNIV_NAME = "weight_TunedCentralValue_UBGenie";
 
+    // Name of the object that lists the universes stored in the TDirectoryFile
+    // with the POT-summed universe histograms. Each line contains a universe
+    // name and index.
+    const std::string UNIVERSE_INDEX_NAME = "universe_index";
+
+    // Loads the histograms for a Universe object from a TDirectory
+    void read_universe_histograms( TDirectory& dir, Universe& univ ) const;
+
     // Beginning of the subdirectory name for the TDirectoryFile containing the
     // POT-summed histograms for the various universes across all analysis
     // ntuples. The full name is formed from this prefix and the name of the
@@ -316,4 +396,58 @@ class SystematicsCalculator {
     // std::unique_ptr< SelectionBase > sel_for_categ_;
     // FIXME: using normal pointer to avoid invalid pointer error
     SelectionBase *sel_for_categ_;
+
+    // Maximum number of threads to use in get_covariances()
+    size_t num_threads_ = default_num_threads();
+
+    // Name of the file and path of the TDirectoryFile within it that store
+    // the POT-summed histograms for universes that are loaded on demand
+    std::string universe_file_name_;
+    std::string universe_dir_path_;
+
+    // Idle handles for the input file used to load universes on demand. A
+    // TFile object may only be read by one thread at a time, so each load
+    // borrows its own handle. New ones are opened as needed.
+    mutable std::vector< std::unique_ptr<TFile> > universe_files_;
+    mutable std::mutex universe_file_mutex_;
+
+    // Borrows an idle handle for the universe input file (opening a new one
+    // if there are none) and returns it afterwards
+    std::unique_ptr< TFile > take_universe_file() const;
+    void return_universe_file( std::unique_ptr<TFile> file ) const;
+
+    // State of a Universe object whose histograms are loaded on demand. The
+    // mutex is held only while the histograms are loaded, so different
+    // universes may be loaded at the same time.
+    struct LazyUniverseState {
+      int use_count_ = 0;
+      std::mutex load_mutex_;
+    };
+
+    // Universe objects whose histograms are loaded on demand. The mutex
+    // guards the map itself and the use counts.
+    mutable std::map< const Universe*, std::unique_ptr<LazyUniverseState> >
+      lazy_universes_;
+    mutable std::mutex universe_load_mutex_;
+};
+
+// Keeps the histograms for a Universe owned by a SystematicsCalculator in
+// memory while the guard object exists
+class UniverseGuard {
+
+  public:
+
+    inline UniverseGuard( const SystematicsCalculator& sc,
+      const Universe& univ ) : sc_( sc ), univ_( univ )
+      { sc_.acquire_universe( univ_ ); }
+
+    inline ~UniverseGuard() { sc_.release_universe( univ_ ); }
+
+    UniverseGuard( const UniverseGuard& ) = delete;
+    UniverseGuard& operator=( const UniverseGuard& ) = delete;
+
+  private:
+
+    const SystematicsCalculator& sc_;
+    const Universe& univ_;
 };
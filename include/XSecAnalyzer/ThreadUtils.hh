@@ -0,0 +1,68 @@
+#pragma once
+
+// Standard library includes
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// **** Helper code for running simple loops on several threads ****
+
+// Returns the number of worker threads to use when the user did not request a
+// specific value. This is just the number of hardware threads reported by the
+// standard library (or one if that number is unknown).
+inline size_t default_num_threads() {
+  size_t num_hw_threads = std::thread::hardware_concurrency();
+  if ( num_hw_threads == 0u ) return 1u;
+  return num_hw_threads;
+}
+
+// Calls func( i ) for every task index i in the half-open interval
+// [0, num_tasks) using up to num_threads concurrent std::threads. The task
+// indices are handed out dynamically, so the order in which they are
+// processed is not fixed. Callers that need deterministic results should
+// therefore write the output of each task to its own storage and combine the
+// results afterwards in task order. If num_threads is less than two, then all
+// tasks are run in order on the calling thread.
+//
+// If any of the tasks throws an exception, then no new tasks are started and
+// the exception thrown by the task with the lowest index is rethrown on the
+// calling thread once all workers have finished.
+template < typename Func >
+  void parallel_for( size_t num_tasks, size_t num_threads, Func&& func )
+{
+  if ( num_tasks == 0u ) return;
+
+  num_threads = std::min( num_threads, num_tasks );
+  if ( num_threads < 2u ) {
+    for ( size_t t = 0u; t < num_tasks; ++t ) func( t );
+    return;
+  }
+
+  std::atomic< size_t > next_task( 0u );
+  std::atomic< bool > failed( false );
+  std::vector< std::exception_ptr > errors( num_tasks );
+
+  auto work = [ & ]() {
+    while ( !failed.load() ) {
+      size_t t = next_task.fetch_add( 1u );
+      if ( t >= num_tasks ) break;
+      try {
+        func( t );
+      }
+      catch ( ... ) {
+        errors.at( t ) = std::current_exception();
+        failed.store( true );
+      }
+    }
+  };
+
+  std::vector< std::thread > threads;
+  for ( size_t w = 0u; w < num_threads; ++w ) threads.emplace_back( work );
+  for ( auto& thr : threads ) thr.join();
+
+  for ( const auto& err : errors ) {
+    if ( err ) std::rethrow_exception( err );
+  }
+}
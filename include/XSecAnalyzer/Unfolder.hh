@@ -1,6 +1,7 @@
 #pragma once
 
 // Standard library includes
+#include <algorithm>
 #include <memory>
 #include <set>
 #include <stdexcept>
@@ -8,6 +9,9 @@
 // ROOT includes
 #include "TMatrixD.h"
 
+// XSecAnalyzer includes
+#include "ThreadUtils.hh"
+
 // Forward-declare some needed objects
 struct TrueBin;
 struct RecoBin;
@@ -79,6 +83,13 @@ class Unfolder {
       const TMatrixD& smearcept, const TMatrixD& prior_true_signal,
       std::ifstream& in_block_file ) const final;
 
+    // Sets the maximum number of worker threads used by unfolding algorithms
+    // that support multithreading. The results do not depend on this choice.
+    inline void set_num_threads( size_t num_threads )
+      { num_threads_ = std::max( num_threads, size_t(1u) ); }
+
+    inline size_t num_threads() const { return num_threads_; }
+
   protected:
 
     // Helper function that does some sanity checks on the dimensions of the
@@ -86,4 +97,11 @@ class Unfolder {
     static void check_matrices( const TMatrixD& data_signal,
       const TMatrixD& data_covmat, const TMatrixD& smearcept,
       const TMatrixD& prior_true_signal );
+
+    // Number of threads that a multithreaded unfolding algorithm should use
+    // in the current context. This is smaller than num_threads() when several
+    // blocks of bins are being unfolded at once by blockwise_unfold().
+    size_t worker_threads() const;
+
+    size_t num_threads_ = default_num_threads();
 };
@@ -4,10 +4,12 @@
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <stdexcept>
 #include <string>
 #include <sstream>
+#include <unordered_map>
 #include <vector>
 
 // ROOT includes
@@ -19,6 +21,9 @@
 #include "TTreeFormula.h"
 
 // XSecAnalyzer includes
+#include "XSecAnalyzer/BinAssignmentCache.hh"
+#include "XSecAnalyzer/BinLookup.hh"
+#include "XSecAnalyzer/CutProgram.hh"
 #include "XSecAnalyzer/WeightHandler.hh"
 
 #include "Selections/SelectionBase.hh"
@@ -34,11 +39,21 @@
 R__LOAD_LIBRARY(libTreePlayer.so)
 #endif
 
+// Default number of TChain entries whose bin assignments are found together
+// (and held in memory) by UniverseMaker::build_universes() before the
+// universes are filled. The entries are always added to each universe in
+// TChain order, so the results do not depend on this value.
+constexpr long long DEFAULT_ENTRIES_PER_CHUNK = 50000;
+
 // Keys used to identify true and reco bin configurations in a universe output
 // ROOT file
 const std::string TRUE_BIN_SPEC_NAME = "true_bin_spec";
 const std::string RECO_BIN_SPEC_NAME = "reco_bin_spec";
 
+// Name of the parameter that stores the simulated POT for an MC ntuple file.
+// UniverseMaker copies it into the TDirectoryFile used for each input file.
+const std::string SUMMED_POT_NAME = "summed_pot";
+
 // Converts the name of an analysis ntuple file (typically with the full path)
 // into a TDirectoryFile name to use as a subfolder of the main output
 // TDirectoryFile used for saving universes. Since the forward slash
@@ -64,6 +79,21 @@ const std::string PPFX_WEIGHT_NAME = "weight_ppfx_cv_UBPPFXCV";
 // Special weight name to store the unweighted event counts
 const std::string UNWEIGHTED_NAME = "unweighted";
 
+// Keyword that begins the optional section of a UniverseMaker configuration
+// file that limits the histograms stored for some families of universes. The
+// keyword is followed by the number of entries in the section. Each entry
+// gives a weight branch name (or "*" to match every branch not listed
+// explicitly), the number of histogram kinds to store, and the kinds
+// themselves, labeled by their histogram name suffixes. For example,
+//
+//   universe_hists 1
+//   * 4 true reco 2d categ
+//
+// omits the reco vs. reco and true vs. true histograms for all reweightable
+// universes. The full set is always kept for the unweighted and CV universes.
+const std::string UNIVERSE_HISTS_KEYWORD = "universe_hists";
+const std::string ANY_WEIGHT_NAME = "*";
+
 constexpr double MIN_WEIGHT = 0.;
 constexpr double MAX_WEIGHT = 30.;
 
@@ -86,25 +116,50 @@ inline bool string_has_end( const std::string& str, const std::string& end ) {
   return false;
 }
 
-// Multiplies a given event weight by extra correction factors as appropriate.
+// Computes out[u] = safe_weight( in[u] * factor ) for each of the n elements
+// of the input array. This is used to process a full vector of universe
+// weights at once, and an AVX2 version is used when the CPU supports it.
+void apply_safe_weights( const double* in, size_t n, double factor,
+  double* out );
+
+// Enum used to label the kinds of CV correction needed by the various weight
+// branches
+enum CVCorrectionType {
+
+  // GENIE reweighting knobs
+  kGenieCVCorrection = 0,
+
+  // NuMI PPFX flux universes
+  kPPFXCVCorrection = 1,
+
+  // Other universes that need both the spline and tune weights (BNB) or all
+  // of the NuMI CV weights
+  kFullCVCorrection = 2,
+
+  // NuMI beamline variations
+  kBeamlineCVCorrection = 3,
+
+  // The spline weight itself
+  kSplineCVCorrection = 4
+
+};
+
+// Determines the kind of CV correction that applies to a given weight branch.
+// This involves several string comparisons, so it is best done once per
+// branch rather than once per event.
 // TODO: include the rootino_fix weight as a correction to the central value
-inline void apply_cv_correction_weights( const std::string& wgt_name,
-  double& wgt, double spline_weight, double tune_weight, double ppfx_weight = 1, double normalisation_weight = 1 )
+inline CVCorrectionType get_cv_correction_type( const std::string& wgt_name )
 {
-  if ( string_has_end(wgt_name, "UBGenie") ) {
-    if (useNuMI) wgt *= ppfx_weight * normalisation_weight;
-    else wgt *= spline_weight;
-  }
+  if ( string_has_end(wgt_name, "UBGenie") ) return kGenieCVCorrection;
   // PPFX
   else if ( useNuMI && (string_has_end(wgt_name, "UBPPFXCV") || wgt_name == "weight_ppfx_all") ) {
-    wgt *= tune_weight * normalisation_weight;
+    return kPPFXCVCorrection;
   }
   else if ( (!useNuMI && wgt_name == "weight_flux_all")
     || wgt_name == "weight_reint_all"
     || wgt_name == "weight_xsr_scc_Fa3_SCC"
     || wgt_name == "weight_xsr_scc_Fv3_SCC" ) {
-    if (useNuMI) wgt *= tune_weight * ppfx_weight * normalisation_weight;
-    else wgt *= spline_weight * tune_weight;
+    return kFullCVCorrection;
   }
   // NuMI beamline variations
   else if ( useNuMI && (wgt_name == "weight_Horn_2kA"
@@ -120,16 +175,45 @@ inline void apply_cv_correction_weights( const std::string& wgt_name,
         || wgt_name == "weight_Beam_shift_y_1mm"
         || wgt_name == "weight_Target_z_7mm") )
   {
-    wgt *= tune_weight * ppfx_weight * normalisation_weight;
-  }
-  else if ( wgt_name == SPLINE_WEIGHT_NAME ) {
-    if (useNuMI) wgt *= ppfx_weight * normalisation_weight * tune_weight;
-    // BNB: No extra weight factors needed (Q: is this correct? shouldn't tune_weight be applied?)
-    return;
+    return kBeamlineCVCorrection;
   }
+  else if ( wgt_name == SPLINE_WEIGHT_NAME ) return kSplineCVCorrection;
   else throw std::runtime_error( "Unrecognized weight name: " + wgt_name );
 }
 
+// Returns the overall factor that should multiply an event weight of the
+// given kind to apply the needed CV corrections
+inline double cv_correction_factor( CVCorrectionType type,
+  double spline_weight, double tune_weight, double ppfx_weight = 1,
+  double normalisation_weight = 1 )
+{
+  switch ( type ) {
+    case kGenieCVCorrection:
+      if (useNuMI) return ppfx_weight * normalisation_weight;
+      else return spline_weight;
+    case kPPFXCVCorrection:
+      return tune_weight * normalisation_weight;
+    case kFullCVCorrection:
+      if (useNuMI) return tune_weight * ppfx_weight * normalisation_weight;
+      else return spline_weight * tune_weight;
+    case kBeamlineCVCorrection:
+      return tune_weight * ppfx_weight * normalisation_weight;
+    case kSplineCVCorrection:
+      if (useNuMI) return ppfx_weight * normalisation_weight * tune_weight;
+      // BNB: No extra weight factors needed (Q: is this correct? shouldn't tune_weight be applied?)
+      return 1.;
+  }
+  throw std::runtime_error( "Unrecognized CV correction type" );
+}
+
+// Multiplies a given event weight by extra correction factors as appropriate.
+inline void apply_cv_correction_weights( const std::string& wgt_name,
+  double& wgt, double spline_weight, double tune_weight, double ppfx_weight = 1, double normalisation_weight = 1 )
+{
+  wgt *= cv_correction_factor( get_cv_correction_type(wgt_name),
+    spline_weight, tune_weight, ppfx_weight, normalisation_weight );
+}
+
 // Enum used to label bin types in true space
 enum TrueBinType {
 
@@ -262,6 +346,42 @@ inline std::istream& operator>>( std::istream& in, RecoBin& rb ) {
   return in;
 }
 
+// Labels the six kinds of histograms owned by a Universe object
+enum UniverseHistKind {
+  kTrueUniverseHist = 0,
+  kRecoUniverseHist = 1,
+  k2DUniverseHist = 2,
+  kCategUniverseHist = 3,
+  kReco2DUniverseHist = 4,
+  kTrue2DUniverseHist = 5
+};
+
+constexpr size_t NUM_UNIVERSE_HIST_KINDS = 6u;
+
+// Bit mask listing the kinds of histograms stored for a family of universes.
+// Bit k is set if the histogram with UniverseHistKind k is present.
+using UniverseHistMask = unsigned int;
+
+constexpr UniverseHistMask universe_hist_bit( UniverseHistKind kind )
+  { return 1u << kind; }
+
+constexpr UniverseHistMask ALL_UNIVERSE_HISTS
+  = ( 1u << NUM_UNIVERSE_HIST_KINDS ) - 1u;
+
+// The reco vs. reco and true vs. true histograms are only needed for the
+// MC statistical uncertainties, which SystematicsCalculator evaluates using
+// the CV universe alone. The others are required for every universe.
+constexpr UniverseHistMask REQUIRED_UNIVERSE_HISTS = ALL_UNIVERSE_HISTS
+  & ~universe_hist_bit( kReco2DUniverseHist )
+  & ~universe_hist_bit( kTrue2DUniverseHist );
+
+// Histogram name suffix used for each kind of universe histogram
+inline const std::string& universe_hist_suffix( UniverseHistKind kind ) {
+  static const std::string suffixes[ NUM_UNIVERSE_HIST_KINDS ] = { "true",
+    "reco", "2d", "categ", "reco2d", "true2d" };
+  return suffixes[ kind ];
+}
+
 // Provides a set of histograms used to store summed bin counts (with
 // associated MC statistical uncertainties) in a given systematic variation
 // universe
@@ -269,8 +389,12 @@ class Universe {
 
   public:
 
+    // The number of event categories defaults to the value set via
+    // set_num_categories(). Code that may run on a worker thread should pass
+    // it explicitly instead of modifying the shared static value.
     inline Universe( const std::string& universe_name,
-      size_t universe_index, int num_true_bins, int num_reco_bins )
+      size_t universe_index, int num_true_bins, int num_reco_bins,
+      size_t num_categories = num_categories_ )
       : universe_name_( universe_name ), index_( universe_index )
     {
       std::string hist_name_prefix = universe_name + '_'
@@ -300,8 +424,8 @@ class Universe {
 
       hist_categ_ = std::make_unique< TH2D >(
         (hist_name_prefix + "_categ").c_str(),
-        "; true event category; reco bin number; counts", num_categories_, 0.,
-        num_categories_, num_reco_bins, 0., num_reco_bins );
+        "; true event category; reco bin number; counts", num_categories, 0.,
+        num_categories, num_reco_bins, 0., num_reco_bins );
 
       // Store summed squares of event weights (for calculations of the MC
       // statistical uncertainty on bin contents)
@@ -314,7 +438,8 @@ class Universe {
     }
 
     // Note: the new Universe object takes ownership of the histogram
-    // pointers passed to this constructor
+    // pointers passed to this constructor. The reco vs. reco and true vs.
+    // true histograms may be null if they were not stored.
     inline Universe( const std::string& universe_name,
       size_t universe_index, TH1D* hist_true, TH1D* hist_reco, TH2D* hist_2d,
       TH2D* hist_categ, TH2D* hist_reco2d, TH2D* hist_true2d )
@@ -323,30 +448,77 @@ class Universe {
       hist_categ_( hist_categ ), hist_reco2d_( hist_reco2d ),
       hist_true2d_( hist_true2d )
     {
-      hist_true_->SetDirectory( nullptr );
-      hist_reco_->SetDirectory( nullptr );
-      hist_2d_->SetDirectory( nullptr );
-      hist_categ_->SetDirectory( nullptr );
-      hist_reco2d_->SetDirectory( nullptr );
-      hist_true2d_->SetDirectory( nullptr );
+      this->detach_hists();
     }
 
+    // Creates a Universe object without any histograms. These may be loaded
+    // later on demand (see SystematicsCalculator::acquire_universe()).
+    inline Universe( const std::string& universe_name, size_t universe_index )
+      : universe_name_( universe_name ), index_( universe_index ) {}
+
+    inline bool histograms_loaded() const { return hist_2d_ != nullptr; }
+
     inline std::unique_ptr< Universe > clone() const {
       int num_true_bins = hist_2d_->GetXaxis()->GetNbins();
       int num_reco_bins = hist_2d_->GetYaxis()->GetNbins();
       auto result = std::make_unique< Universe >( universe_name_,
         index_, num_true_bins, num_reco_bins );
 
-      result->hist_true_->Add( this->hist_true_.get() );
-      result->hist_reco_->Add( this->hist_reco_.get() );
-      result->hist_2d_->Add( this->hist_2d_.get() );
-      result->hist_categ_->Add( this->hist_categ_.get() );
-      result->hist_reco2d_->Add( this->hist_reco2d_.get() );
-      result->hist_true2d_->Add( this->hist_true2d_.get() );
+      result->drop_hists( this->hist_mask() );
+      for ( size_t k = 0u; k < NUM_UNIVERSE_HIST_KINDS; ++k ) {
+        auto kind = static_cast< UniverseHistKind >( k );
+        if ( this->hist(kind) ) result->hist( kind )->Add( this->hist(kind) );
+      }
 
       return result;
     }
 
+    // Returns the histogram of the given kind, or nullptr if it is missing
+    inline TH1* hist( UniverseHistKind kind ) const {
+      switch ( kind ) {
+        case kTrueUniverseHist: return hist_true_.get();
+        case kRecoUniverseHist: return hist_reco_.get();
+        case k2DUniverseHist: return hist_2d_.get();
+        case kCategUniverseHist: return hist_categ_.get();
+        case kReco2DUniverseHist: return hist_reco2d_.get();
+        case kTrue2DUniverseHist: return hist_true2d_.get();
+      }
+      throw std::runtime_error( "Unrecognized universe histogram kind" );
+    }
+
+    // Lists the kinds of histograms currently owned by this universe
+    inline UniverseHistMask hist_mask() const {
+      UniverseHistMask mask = 0u;
+      for ( size_t k = 0u; k < NUM_UNIVERSE_HIST_KINDS; ++k ) {
+        auto kind = static_cast< UniverseHistKind >( k );
+        if ( this->hist(kind) ) mask |= universe_hist_bit( kind );
+      }
+      return mask;
+    }
+
+    // Deletes any owned histograms whose kinds are not included in the mask
+    inline void drop_hists( UniverseHistMask keep ) {
+      auto drop = [ keep ]( auto& hist, UniverseHistKind kind ) {
+        if ( !(keep & universe_hist_bit(kind)) ) hist.reset();
+      };
+      drop( hist_true_, kTrueUniverseHist );
+      drop( hist_reco_, kRecoUniverseHist );
+      drop( hist_2d_, k2DUniverseHist );
+      drop( hist_categ_, kCategUniverseHist );
+      drop( hist_reco2d_, kReco2DUniverseHist );
+      drop( hist_true2d_, kTrue2DUniverseHist );
+    }
+
+    // Detaches the owned histograms from any TDirectory. This does nothing
+    // (and so is safe to call from a worker thread) if the histograms were
+    // created while TH1::AddDirectory was disabled.
+    inline void detach_hists() {
+      for ( size_t k = 0u; k < NUM_UNIVERSE_HIST_KINDS; ++k ) {
+        TH1* hist = this->hist( static_cast<UniverseHistKind>(k) );
+        if ( hist ) hist->SetDirectory( nullptr );
+      }
+    }
+
     inline static void set_num_categories( const int count )
       { num_categories_ = count; }
 
@@ -362,6 +534,482 @@ class Universe {
     static size_t num_categories_;
 };
 
+// Converts a zero-based bin index for a universe histogram (flattened as
+// x * num_y_bins + y, or just x if num_y_bins is zero) into a ROOT global bin
+// number
+inline int universe_hist_root_bin( const TH1& hist, size_t b,
+  size_t num_y_bins )
+{
+  if ( num_y_bins == 0u ) return b + 1;
+  return hist.GetBin( b / num_y_bins + 1, b % num_y_bins + 1 );
+}
+
+// Sets the contents of bin b of a universe histogram
+inline void set_universe_hist_bin( TH1& hist, size_t b, size_t num_y_bins,
+  double sum, double sumw2 )
+{
+  int root_bin = universe_hist_root_bin( hist, b, num_y_bins );
+  hist.SetBinContent( root_bin, sum );
+  ( *hist.GetSumw2() )[ root_bin ] = sumw2;
+}
+
+// Number of histogram statistics stored for each universe histogram. These
+// are laid out as in TH1::GetStats(), so the first four are used by 1D
+// histograms and all seven by 2D histograms.
+constexpr size_t NUM_UNIVERSE_HIST_STATS = 7u;
+
+// Copies a dense row of num_bins summed weights and squared weights into an
+// existing (empty) universe histogram. The histogram statistics are set using
+// the stats array if it is not null and are otherwise recomputed from the bin
+// contents. This gives results identical to those of
+// UniverseArray::copy_to_hist() when the stats are given.
+inline void fill_universe_hist( TH1& hist, const double* sum,
+  const double* sumw2, size_t num_bins, size_t num_y_bins, double entries,
+  const double* stats )
+{
+  for ( size_t b = 0u; b < num_bins; ++b ) {
+    set_universe_hist_bin( hist, b, num_y_bins, sum[b], sumw2[b] );
+  }
+
+  if ( stats ) {
+    // TH1::PutStats() takes a non-const pointer but does not modify the array
+    double temp_stats[ NUM_UNIVERSE_HIST_STATS ];
+    std::copy( stats, stats + NUM_UNIVERSE_HIST_STATS, temp_stats );
+    hist.PutStats( temp_stats );
+  }
+  else hist.ResetStats();
+
+  hist.SetEntries( entries );
+}
+
+// Summed event weights and squared weights for one kind of universe
+// histogram, stored for every universe in a UniverseStore. Since a given
+// event fills the same bins in every universe, each bin gets a contiguous
+// block of num_universes_ elements (i.e., the layout is [bin][universe]). In
+// the default dense mode, every bin has a block. In sparse mode, blocks are
+// only allocated for bins that have been filled at least once, in the order
+// in which they were first filled.
+//
+// The histogram statistics (see TH1::GetStats()) are accumulated alongside
+// the bin contents in the same way as by TH1::Fill(), so the saved
+// histograms have the same mean and RMS as ones filled event by event.
+struct UniverseArray {
+
+  inline void resize( size_t num_universes, size_t num_bins,
+    size_t num_y_bins = 0u, bool sparse = false )
+  {
+    num_universes_ = num_universes;
+    num_bins_ = num_bins;
+    num_y_bins_ = num_y_bins;
+    sparse_ = sparse;
+    sparse_slots_.clear();
+    sparse_bins_.clear();
+    if ( sparse_ ) {
+      sum_.clear();
+      sumw2_.clear();
+    }
+    else {
+      sum_.assign( num_universes * num_bins, 0. );
+      sumw2_.assign( num_universes * num_bins, 0. );
+    }
+    entries_.assign( num_universes, 0. );
+    stats_.assign( NUM_UNIVERSE_HIST_STATS * num_universes, 0. );
+  }
+
+  // Returns the index in sum_ and sumw2_ of the element for universe zero in
+  // the given bin. In sparse mode, storage for the bin is created if needed.
+  inline size_t bin_offset( size_t bin ) {
+    if ( !sparse_ ) return bin * num_universes_;
+
+    auto iter = sparse_slots_.find( bin );
+    if ( iter != sparse_slots_.end() ) return iter->second;
+
+    size_t offset = sum_.size();
+    sparse_slots_[ bin ] = offset;
+    sparse_bins_.push_back( bin );
+    sum_.resize( offset + num_universes_, 0. );
+    sumw2_.resize( offset + num_universes_, 0. );
+    return offset;
+  }
+
+  // Equivalent to TH1::Fill( bin, w ) (or to TH2::Fill( x, y, w ) with the
+  // bin flattened as x * num_y_bins_ + y) for the histogram in universe u
+  inline void fill( size_t u, size_t bin, double w ) {
+    size_t idx = this->bin_offset( bin ) + u;
+    sum_[ idx ] += w;
+    sumw2_[ idx ] += w * w;
+    entries_[ u ] += 1.;
+    this->fill_stats( bin, u, u + 1u, [ w ]( size_t ) { return w; } );
+  }
+
+  // Fills the given bin in each of the first n universes using the weight
+  // scale * wgts[ u ] for universe u. The elements for the bin are adjacent
+  // in memory, so this loop (and the one over the statistics) runs over
+  // contiguous arrays.
+  inline void fill( size_t bin, double scale, const double* wgts, size_t n ) {
+    size_t offset = this->bin_offset( bin );
+    double* sum = sum_.data() + offset;
+    double* sumw2 = sumw2_.data() + offset;
+    for ( size_t u = 0u; u < n; ++u ) {
+      double w = scale * wgts[ u ];
+      sum[ u ] += w;
+      sumw2[ u ] += w * w;
+    }
+    for ( size_t u = 0u; u < n; ++u ) entries_[ u ] += 1.;
+    this->fill_stats( bin, 0u, n,
+      [ scale, wgts ]( size_t u ) { return scale * wgts[ u ]; } );
+  }
+
+  // Updates the statistics for universes [first, last) in the same way as a
+  // call to TH1::Fill() (or TH2::Fill()) using the lower edge of the bin as
+  // the filled value. The weight for universe u is given by get_weight( u ).
+  // The expressions and their order match those used by ROOT, so the results
+  // are identical.
+  template < typename WeightFunc > inline void fill_stats( size_t bin,
+    size_t first, size_t last, WeightFunc&& get_weight )
+  {
+    size_t nu = num_universes_;
+    double* s = stats_.data();
+
+    if ( num_y_bins_ == 0u ) {
+      double x = static_cast< double >( bin );
+      for ( size_t u = first; u < last; ++u ) {
+        double z = get_weight( u );
+        s[ u ] += z;
+        s[ nu + u ] += z * z;
+        s[ 2u*nu + u ] += z * x;
+        s[ 3u*nu + u ] += z * x * x;
+      }
+      return;
+    }
+
+    double x = static_cast< double >( bin / num_y_bins_ );
+    double y = static_cast< double >( bin % num_y_bins_ );
+    for ( size_t u = first; u < last; ++u ) {
+      double z = get_weight( u );
+      s[ u ] += z;
+      s[ nu + u ] += z * z;
+      s[ 2u*nu + u ] += z * x;
+      s[ 3u*nu + u ] += z * x * x;
+      s[ 4u*nu + u ] += z * y;
+      s[ 5u*nu + u ] += z * y * y;
+      s[ 6u*nu + u ] += z * x * y;
+    }
+  }
+
+  // Copies the histogram statistics for universe u into an array with
+  // NUM_UNIVERSE_HIST_STATS elements
+  inline void copy_stats( size_t u, double* stats ) const {
+    for ( size_t s = 0u; s < NUM_UNIVERSE_HIST_STATS; ++s ) {
+      stats[ s ] = stats_[ s * num_universes_ + u ];
+    }
+  }
+
+  // Copies the contents for universe u into an existing (empty) histogram.
+  // The bins are assumed to be flattened as x * num_y_bins_ + y.
+  inline void copy_to_hist( size_t u, TH1& hist ) const {
+    auto copy_bin = [ & ]( size_t b, size_t idx ) {
+      set_universe_hist_bin( hist, b, num_y_bins_, sum_[idx], sumw2_[idx] );
+    };
+
+    if ( sparse_ ) {
+      for ( size_t s = 0u; s < sparse_bins_.size(); ++s ) {
+        copy_bin( sparse_bins_[s], s * num_universes_ + u );
+      }
+    }
+    else {
+      for ( size_t b = 0u; b < num_bins_; ++b ) {
+        copy_bin( b, b * num_universes_ + u );
+      }
+    }
+
+    double stats[ NUM_UNIVERSE_HIST_STATS ];
+    this->copy_stats( u, stats );
+    hist.PutStats( stats );
+    hist.SetEntries( entries_[u] );
+  }
+
+  // Copies the dense contents for universe u into the num_bins_ elements of
+  // each output array. Either pointer may be null if it is not needed.
+  inline void copy_row( size_t u, double* sum, double* sumw2 ) const {
+    if ( sparse_ ) {
+      if ( sum ) std::fill( sum, sum + num_bins_, 0. );
+      if ( sumw2 ) std::fill( sumw2, sumw2 + num_bins_, 0. );
+      for ( size_t s = 0u; s < sparse_bins_.size(); ++s ) {
+        size_t idx = s * num_universes_ + u;
+        if ( sum ) sum[ sparse_bins_[s] ] = sum_[ idx ];
+        if ( sumw2 ) sumw2[ sparse_bins_[s] ] = sumw2_[ idx ];
+      }
+    }
+    else {
+      for ( size_t b = 0u; b < num_bins_; ++b ) {
+        size_t idx = b * num_universes_ + u;
+        if ( sum ) sum[ b ] = sum_[ idx ];
+        if ( sumw2 ) sumw2[ b ] = sumw2_[ idx ];
+      }
+    }
+  }
+
+  size_t num_universes_ = 0u;
+  size_t num_bins_ = 0u;
+  // Number of bins along the y axis (zero for 1D histograms)
+  size_t num_y_bins_ = 0u;
+  bool sparse_ = false;
+  std::vector< double > sum_;
+  std::vector< double > sumw2_;
+  std::vector< double > entries_;
+
+  // Histogram statistics laid out as [statistic][universe]
+  std::vector< double > stats_;
+
+  // Used only in sparse mode. Keys are bin indices, values are offsets in
+  // sum_ and sumw2_. The filled bins are also listed in order of their
+  // offsets.
+  std::unordered_map< size_t, size_t > sparse_slots_;
+  std::vector< size_t > sparse_bins_;
+};
+
+// Contiguous storage for the contents of all of the universe histograms that
+// share a single weight branch. The event loop writes directly into these
+// arrays, and Universe objects are only created when the results are saved.
+// Only the kinds of histograms listed in the mask are stored. The arrays for
+// the others are left empty and must not be filled.
+class UniverseStore {
+
+  public:
+
+    inline UniverseStore( const std::string& universe_name,
+      size_t num_universes, size_t num_true_bins, size_t num_reco_bins,
+      size_t num_categories, bool sparse_matrices = false,
+      UniverseHistMask hist_mask = ALL_UNIVERSE_HISTS )
+      : universe_name_( universe_name ), num_universes_( num_universes ),
+      num_true_bins_( num_true_bins ), num_reco_bins_( num_reco_bins ),
+      num_categories_( num_categories ), hist_mask_( hist_mask )
+    {
+      auto resize = [ & ]( UniverseArray& arr, UniverseHistKind kind,
+        size_t num_x_bins, size_t num_y_bins, bool sparse )
+      {
+        size_t num_bins = num_x_bins * std::max( num_y_bins, size_t(1u) );
+        if ( this->has_hist(kind) ) arr.resize( num_universes, num_bins,
+          num_y_bins, sparse );
+        else arr.resize( 0u, 0u );
+      };
+
+      resize( true_, kTrueUniverseHist, num_true_bins, 0u, false );
+      resize( reco_, kRecoUniverseHist, num_reco_bins, 0u, false );
+      resize( categ_, kCategUniverseHist, num_categories, num_reco_bins,
+        false );
+
+      // The 2D histograms in bin space are the only ones whose size grows
+      // quadratically with the number of bins, so they are the only ones
+      // that may use sparse storage
+      resize( twod_, k2DUniverseHist, num_true_bins, num_reco_bins,
+        sparse_matrices );
+      resize( reco2d_, kReco2DUniverseHist, num_reco_bins, num_reco_bins,
+        sparse_matrices );
+      resize( true2d_, kTrue2DUniverseHist, num_true_bins, num_true_bins,
+        sparse_matrices );
+    }
+
+    inline const std::string& name() const { return universe_name_; }
+    inline size_t num_universes() const { return num_universes_; }
+    inline size_t num_true_bins() const { return num_true_bins_; }
+    inline size_t num_reco_bins() const { return num_reco_bins_; }
+    inline size_t num_categories() const { return num_categories_; }
+    inline UniverseHistMask hist_mask() const { return hist_mask_; }
+
+    // Returns true if histograms of the given kind are stored
+    inline bool has_hist( UniverseHistKind kind ) const
+      { return hist_mask_ & universe_hist_bit( kind ); }
+
+    // Read-only access to the summed weights for each kind of histogram
+    inline const UniverseArray& true_array() const { return true_; }
+    inline const UniverseArray& reco_array() const { return reco_; }
+    inline const UniverseArray& twod_array() const { return twod_; }
+    inline const UniverseArray& categ_array() const { return categ_; }
+    inline const UniverseArray& reco2d_array() const { return reco2d_; }
+    inline const UniverseArray& true2d_array() const { return true2d_; }
+
+    // Equivalents of the TH1::Fill() calls on each of the histograms owned by
+    // universe u
+    inline void fill_true( size_t u, size_t tb, double w )
+      { true_.fill( u, tb, w ); }
+
+    inline void fill_reco( size_t u, size_t rb, double w )
+      { reco_.fill( u, rb, w ); }
+
+    inline void fill_2d( size_t u, size_t tb, size_t rb, double w )
+      { twod_.fill( u, tb * num_reco_bins_ + rb, w ); }
+
+    inline void fill_categ( size_t u, size_t c, size_t rb, double w )
+      { categ_.fill( u, c * num_reco_bins_ + rb, w ); }
+
+    inline void fill_reco2d( size_t u, size_t rb1, size_t rb2, double w )
+      { reco2d_.fill( u, rb1 * num_reco_bins_ + rb2, w ); }
+
+    inline void fill_true2d( size_t u, size_t tb1, size_t tb2, double w )
+      { true2d_.fill( u, tb1 * num_true_bins_ + tb2, w ); }
+
+    // Versions of the functions above that fill the first n universes at
+    // once. The weight used for universe u is scale * wgts[ u ].
+    inline void fill_true( size_t tb, double scale, const double* wgts,
+      size_t n ) { true_.fill( tb, scale, wgts, n ); }
+
+    inline void fill_reco( size_t rb, double scale, const double* wgts,
+      size_t n ) { reco_.fill( rb, scale, wgts, n ); }
+
+    inline void fill_2d( size_t tb, size_t rb, double scale,
+      const double* wgts, size_t n )
+      { twod_.fill( tb * num_reco_bins_ + rb, scale, wgts, n ); }
+
+    inline void fill_categ( size_t c, size_t rb, double scale,
+      const double* wgts, size_t n )
+      { categ_.fill( c * num_reco_bins_ + rb, scale, wgts, n ); }
+
+    inline void fill_reco2d( size_t rb1, size_t rb2, double scale,
+      const double* wgts, size_t n )
+      { reco2d_.fill( rb1 * num_reco_bins_ + rb2, scale, wgts, n ); }
+
+    inline void fill_true2d( size_t tb1, size_t tb2, double scale,
+      const double* wgts, size_t n )
+      { true2d_.fill( tb1 * num_true_bins_ + tb2, scale, wgts, n ); }
+
+    // Creates a Universe object with histograms holding the current contents
+    // for universe u. The histograms are not attached to any TDirectory. No
+    // global state is modified, but callers on worker threads should disable
+    // TH1::AddDirectory beforehand so that the new histograms are never
+    // attached to the shared current directory.
+    inline std::unique_ptr< Universe > make_universe( size_t u ) const {
+      auto univ = std::make_unique< Universe >( universe_name_, u,
+        num_true_bins_, num_reco_bins_, num_categories_ );
+
+      univ->detach_hists();
+      univ->drop_hists( hist_mask_ );
+
+      const UniverseArray* arrays[ NUM_UNIVERSE_HIST_KINDS ] = { &true_,
+        &reco_, &twod_, &categ_, &reco2d_, &true2d_ };
+
+      for ( size_t k = 0u; k < NUM_UNIVERSE_HIST_KINDS; ++k ) {
+        TH1* hist = univ->hist( static_cast<UniverseHistKind>(k) );
+        if ( hist ) arrays[ k ]->copy_to_hist( u, *hist );
+      }
+
+      return univ;
+    }
+
+  protected:
+
+    std::string universe_name_;
+    size_t num_universes_;
+    size_t num_true_bins_;
+    size_t num_reco_bins_;
+    size_t num_categories_;
+    UniverseHistMask hist_mask_;
+
+    UniverseArray true_;
+    UniverseArray reco_;
+    UniverseArray twod_;
+    UniverseArray categ_;
+    UniverseArray reco2d_;
+    UniverseArray true2d_;
+};
+
+// State owned by a BinMatchWorker for a single bin configuration
+struct BinMatchWorkerConfig {
+
+  // Objects used to test whether the current TChain entry falls into each
+  // true bin, reco bin, and true EventCategory
+  std::unique_ptr< BinLookup > true_bin_lookup_;
+  std::unique_ptr< BinLookup > reco_bin_lookup_;
+  std::unique_ptr< CutProgram > category_program_;
+
+  // Cached bin assignments to use instead of evaluating the cuts (null if
+  // the cuts are evaluated, in which case the compiled cuts above are set)
+  const MappedBinAssignmentCache* cache_ = nullptr;
+
+  // Matches found for each entry in the worker's current range of entries
+  // (unused if cache_ is set). These are also written to a new cache file
+  // when one is requested.
+  BinAssignmentBuffer matches_;
+};
+
+// Finds the bins and categories matched by each entry in a contiguous range
+// of the input ntuples. The matches for one entry do not depend on any other,
+// so UniverseMaker::build_universes() splits each block of entries among
+// several of these workers.
+struct BinMatchWorker {
+
+  // Private copy of the input TChain. Only the branches needed by the
+  // compiled cuts are read.
+  TChain chain_;
+
+  // Compiled cuts and matches for each bin configuration, in the order
+  // given by UniverseMaker::configurations()
+  std::vector< BinMatchWorkerConfig > configs_;
+
+  // Range of entries most recently processed
+  long long first_entry_ = 0;
+  long long num_entries_ = 0;
+
+  // Branch storage for the "is_mc" flag
+  bool is_mc_ = false;
+
+  // Number of the TTree in chain_ that was most recently loaded
+  int tree_number_ = -1;
+};
+
+// Fills the universe stores for a fixed subset of the weight branches using
+// the matches found by the BinMatchWorker objects. Each store is filled by a
+// single UniverseWorker that visits every entry in order, so the sums do not
+// depend on how many workers are used.
+struct UniverseWorker {
+
+  // Private copy of the input TChain. Only the weight branches and the
+  // flags needed to process them are read.
+  TChain chain_;
+
+  // Storage for the event weights read from chain_. Besides the branches
+  // filled by this worker, this includes those needed for the CV
+  // corrections.
+  WeightHandler wh_;
+
+  // For each bin configuration, the store to fill for each branch in the
+  // weight map of wh_ (listed in the same order as the map itself). These
+  // are null for branches that are filled by another worker.
+  std::vector< std::vector< UniverseStore* > > weight_stores_;
+
+  // Store for the unweighted universe in each configuration (empty if these
+  // are filled by another worker)
+  std::vector< UniverseStore* > unweighted_stores_;
+
+  // CV correction type for each branch in the weight map of wh_
+  std::vector< CVCorrectionType > cv_types_;
+
+  // Reusable storage for the processed weights in each universe
+  std::vector< double > safe_weights_;
+
+  // Branch storage for the "is_mc" flag and the NuMI CV weights
+  bool is_mc_ = false;
+  float tune_weight_numi_ = 1.;
+  float ppfx_weight_numi_ = 1.;
+  float normalisation_weight_numi_ = 1.;
+};
+
+// Describes a single ntuple file to be processed by
+// UniverseMaker::build_and_save_universes()
+struct UniverseMakerInput {
+
+  inline UniverseMakerInput( const std::string& file_name = "",
+    bool use_event_weights = true ) : file_name_( file_name ),
+    use_event_weights_( use_event_weights ) {}
+
+  std::string file_name_;
+
+  // If this flag is false, then all event weights will be ignored while
+  // processing the file (e.g., for real data or detector variation samples)
+  bool use_event_weights_;
+};
+
 class UniverseMaker {
 
   public:
@@ -381,6 +1029,14 @@ class UniverseMaker {
     inline const auto& true_bins() const { return true_bins_; }
     inline const auto& reco_bins() const { return reco_bins_; }
 
+    // Access the optional bin edge tables
+    inline const auto& true_bin_edges() const { return true_bin_edges_; }
+    inline const auto& reco_bin_edges() const { return reco_bin_edges_; }
+
+    // Returns the cut expressions used to assign events to each of the true
+    // event categories
+    std::vector< std::string > category_cuts() const;
+
     // Access the owned TChain
     inline auto& input_chain() { return input_chain_; }
 
@@ -388,7 +1044,9 @@ class UniverseMaker {
     // various systematic universes. The optional argument points to a vector
     // of branch names that will be used to retrieve systematic universe
     // weights. If it is omitted, all available ones will be auto-detected and
-    // used.
+    // used. Each family of universes is filled by a single thread that
+    // visits the entries in order, so the results are bit-for-bit identical
+    // for any number of threads.
     void build_universes(
       const std::vector<std::string>* universe_branch_names = nullptr );
 
@@ -399,22 +1057,121 @@ class UniverseMaker {
     void build_universes(
       const std::vector<std::string>& universe_branch_names );
 
+    // Processes each of the input ntuple files independently and writes the
+    // universe histograms for all of them to a single output ROOT file. The
+    // results for each input file are saved in the same way as a call to
+    // save_histograms() using the file name as the subdirectory name. The bin
+    // configuration is read only once, and up to the number of threads
+    // chosen via set_num_threads() are used to process separate files
+    // concurrently. Any files added via add_input_file() are ignored.
+    void build_and_save_universes(
+      const std::vector<UniverseMakerInput>& inputs,
+      const std::string& output_file_name, bool update_file = true );
+
+    // Sets the number of worker threads used by build_universes(). The
+    // histograms that are produced are identical for any choice.
+    inline void set_num_threads( size_t num_threads )
+      { num_threads_ = std::max( num_threads, size_t(1u) ); }
+
+    // Enables or disables sparse storage for the true vs. reco, reco vs.
+    // reco, and true vs. true universe histograms. In sparse mode, memory is
+    // only used for bins that are actually filled, which allows for fine
+    // binnings whose dense histograms would not fit in memory. The histograms
+    // are converted to dense form when they are saved. This setting must be
+    // chosen before calling build_universes().
+    inline void set_sparse_matrices( bool sparse )
+      { sparse_matrices_ = sparse; }
+
+    // If enabled, then build_and_save_universes() also writes the results to
+    // a compact columnar file (see ColumnarUniverseFile.hh) whose name is
+    // formed by appending COLUMNAR_UNIVERSE_FILE_SUFFIX to the name of the
+    // output ROOT file. The columnar file is always recreated, so it holds
+    // only the inputs from the most recent call.
+    inline void set_write_columnar( bool write_columnar )
+      { write_columnar_ = write_columnar; }
+
+    // Sets the number of TChain entries whose bin assignments are found
+    // together by build_universes() before the universes are filled. This
+    // only affects memory usage and load balancing, not the results.
+    inline void set_entries_per_chunk( long long entries )
+      { entries_per_chunk_ = std::max( entries, 1LL ); }
+
     // Writes the universe histograms to an output ROOT file
     void save_histograms( const std::string& output_file_name,
       const std::string& subdirectory_name, bool update_file = true );
 
-    // Provides read-only access to the map of Universe objects
+    // Provides read-only access to the summed event weights for each
+    // universe branch
     const auto& universe_map() const { return universes_; }
 
+    // Creates a Universe object holding the histograms for the requested
+    // weight branch and universe index
+    inline std::unique_ptr< Universe > make_universe(
+      const std::string& weight_name, size_t universe_index ) const
+    {
+      const auto& store = universes_.at( weight_name );
+      if ( universe_index >= store.num_universes() ) {
+        throw std::runtime_error( "Universe index "
+          + std::to_string(universe_index) + " out of range for "
+          + weight_name );
+      }
+      return store.make_universe( universe_index );
+    }
+
     // Returns the name of the TDirectoryFile that will be used to hold the
     // universe histograms when they are written to the output ROOT file
     const std::string& dir_name() const { return output_directory_name_; }
 
+    // Adds another bin configuration (read from a UniverseMaker configuration
+    // file) to be filled during the same pass over the input ntuples. The
+    // event weights are read and processed only once per entry and shared by
+    // all configurations. The new configuration must use the same ntuple
+    // TTree name and a different root TDirectoryFile name. Its universes are
+    // written to that directory of the output file by save_histograms() and
+    // build_and_save_universes(). The returned object may be used to adjust
+    // per-configuration settings (e.g., sparse storage) and to access the
+    // results, but its own input files and thread settings are ignored.
+    UniverseMaker& add_configuration( const std::string& config_file_name );
+
+    // Returns this object followed by any extra configurations added via
+    // add_configuration()
+    std::vector< const UniverseMaker* > configurations() const;
+
+    // Enables the per-event bin assignment cache (see BinAssignmentCache.hh)
+    // using the given directory to hold the cache files. An empty name (the
+    // default) disables the cache. When an ntuple file is processed by
+    // itself (as in build_and_save_universes()), the matched bins and
+    // categories for each configuration are read from a cache file made by
+    // an earlier run with the same bin configuration if one is available.
+    // Otherwise the cuts are evaluated as usual and a new cache file is
+    // written. Since the cached matches are the same as the evaluated ones,
+    // the universes are identical either way.
+    inline void set_bin_cache_dir( const std::string& dir )
+      { bin_cache_dir_ = dir; }
+
+    // Returns the kinds of histograms stored for the universes that use the
+    // named weight branch (see UNIVERSE_HISTS_KEYWORD)
+    UniverseHistMask hist_mask( const std::string& weight_name ) const;
+
+    // Hash of everything in the bin configuration that affects which bins
+    // and categories are matched by each entry
+    uint64_t bin_config_hash() const;
+
+    // Name of the bin assignment cache file for a given input ntuple file
+    std::string bin_cache_file_name( const std::string& input_file_name )
+      const;
+
   protected:
 
     // Helper function used by the constructors
     void init( std::istream& in_file );
 
+    // Helper functions used by init() to read the optional sections of the
+    // configuration file that follow the keywords BIN_EDGE_TABLE_KEYWORD and
+    // UNIVERSE_HISTS_KEYWORD
+    void read_bin_edge_table( std::istream& in_file );
+    void read_hist_masks( std::istream& in_file );
+
     // Helper struct that keeps track of bin indices and TTreeFormula weights
     // when filling universe histograms
     struct FormulaMatch {
@@ -428,13 +1185,72 @@ class UniverseMaker {
       double weight_;
     };
 
-    // Prepares the TTreeFormula objects needed to test each entry for
-    // membership in each bin
-    void prepare_formulas();
-
-    // Prepares the Universe objects needed to store summed event weights for
+    // Throws an exception if the named file does not contain the expected
+    // ntuple TTree
+    void check_input_file( const std::string& input_file_name ) const;
+
+    // Compiles the bin and category definitions needed to test each entry of
+    // the TChain for membership in each bin. Names of the TTreeFormula
+    // objects that are created begin with the given prefix.
+    void prepare_formulas( TChain& chain, BinMatchWorkerConfig& config,
+      const std::string& formula_prefix ) const;
+
+    // Fills the universe stores for every configuration using all entries in
+    // the given TChain, which must contain the listed ntuple files. The
+    // elements of universes correspond to those of configurations(). Up to
+    // num_threads worker threads are used.
+    void fill_universes( TChain& chain,
+      const std::vector<std::string>& file_names,
+      const std::vector<std::string>* universe_branch_names,
+      size_t num_threads,
+      std::vector< std::map<std::string, UniverseStore>* >& universes ) const;
+
+    // Creates a new worker that finds the matched bins using its own TChain
+    // (built from the listed ntuple files). The bin assignment cache (or
+    // nullptr) to read for each configuration is also given.
+    std::unique_ptr< BinMatchWorker > make_match_worker(
+      const std::vector<std::string>& file_names,
+      const std::vector< const MappedBinAssignmentCache* >& caches ) const;
+
+    // Creates a new worker with its own TChain (built from the listed ntuple
+    // files) that fills the universe stores for the named weight branches.
+    // The unweighted universes are filled if UNWEIGHTED_NAME is included.
+    std::unique_ptr< UniverseWorker > make_fill_worker(
+      const std::vector<std::string>& file_names,
+      const std::vector<std::string>& weight_names,
+      std::vector< std::map<std::string, UniverseStore>* >& universes ) const;
+
+    // Finds the matched bins and categories for the TChain entries in the
+    // half-open interval [first, last) using the state owned by the given
+    // worker
+    void find_matches( BinMatchWorker& worker, long long first,
+      long long last ) const;
+
+    // Fills the universe stores owned by a worker using every entry handled
+    // by the match workers (in order)
+    void fill_entries( UniverseWorker& worker,
+      const std::vector< std::unique_ptr<BinMatchWorker> >& match_workers )
+      const;
+
+    // Prepares the universe stores needed to hold summed event weights for
     // each bin in each systematic variation universe
-    void prepare_universes( const WeightHandler& wh );
+    void prepare_universes( const WeightHandler& wh,
+      std::map< std::string, UniverseStore >& universes ) const;
+
+    // Finds (or creates) the subdirectory of the output file that should hold
+    // the universe histograms for the named input. The bin configuration is
+    // saved to (or checked against) the root TDirectoryFile along the way.
+    TDirectoryFile* prepare_output_directory( TFile& out_file,
+      const std::string& subdirectory_name ) const;
+
+    // Serializes the true and reco bin definitions in the format saved to the
+    // output ROOT file
+    void get_bin_specs( std::string& true_bin_spec,
+      std::string& reco_bin_spec ) const;
+
+    // Writes the histograms for every universe to the current directory
+    void write_universes(
+      const std::map< std::string, UniverseStore >& universes ) const;
 
     // Bin definitions in true space
     std::vector< TrueBin > true_bins_;
@@ -442,29 +1258,53 @@ class UniverseMaker {
     // Bin definitions in reco space
     std::vector< RecoBin > reco_bins_;
 
+    // Optional interval tables describing the true and reco bins. These are
+    // written by MakeConfig and allow bins to be found by binary search.
+    std::vector< BinEdgeRecord > true_bin_edges_;
+    std::vector< BinEdgeRecord > reco_bin_edges_;
+
     // A TChain containing MC event ntuples that will be used to compute the
     // universe histograms
     TChain input_chain_;
 
-    // TTreeFormula objects used to test whether the current TChain entry falls
-    // into each true bin
-    std::vector< std::unique_ptr<TTreeFormula> > true_bin_formulas_;
+    // Names of the files that were added to input_chain_. These are used to
+    // build the private TChain owned by each UniverseWorker.
+    std::vector< std::string > input_file_names_;
+
+    // Number of worker threads to use in build_universes() and
+    // build_and_save_universes()
+    size_t num_threads_ = 1u;
 
-    // TTreeFormula objects used to test whether the current TChain entry falls
-    // into each reco bin
-    std::vector< std::unique_ptr<TTreeFormula> > reco_bin_formulas_;
+    // Number of TChain entries whose bin assignments are found together
+    long long entries_per_chunk_ = DEFAULT_ENTRIES_PER_CHUNK;
 
-    // TTreeFormula objects used to test whether the current TChain entry falls
-    // into each true EventCategory
-    std::vector< std::unique_ptr<TTreeFormula> > category_formulas_;
+    // Whether the 2D universe histograms in bin space use sparse storage
+    bool sparse_matrices_ = false;
 
-    // Stores Universe objects used to accumulate event weights
-    std::map< std::string, std::vector<Universe> > universes_;
+    // Whether build_and_save_universes() also writes a columnar file
+    bool write_columnar_ = false;
+
+    // Directory used to hold bin assignment cache files (empty if the cache
+    // is disabled)
+    std::string bin_cache_dir_;
+
+    // Histograms to store for each family of universes. Keys are weight
+    // branch names (or ANY_WEIGHT_NAME). Families that are not listed store
+    // all of them.
+    std::map< std::string, UniverseHistMask > hist_masks_;
+
+    // Stores the summed event weights in every universe. Keys are weight
+    // branch names.
+    std::map< std::string, UniverseStore > universes_;
 
     // Root TDirectoryFile name to use when writing the universes to an output
     // ROOT file
     std::string output_directory_name_;
 
+    // Additional bin configurations filled in the same pass over the input
+    // ntuples (see add_configuration())
+    std::vector< std::unique_ptr< UniverseMaker > > extra_configs_;
+
     // Selection whose event category definitions will be used to
     // populate the category histograms in Universes
     // std::unique_ptr< SelectionBase > sel_for_categories_;
@@ -0,0 +1,93 @@
+#pragma once
+
+// Standard library includes
+#include <string>
+#include <vector>
+
+// XSecAnalyzer includes
+#include "XSecAnalyzer/UniverseMaker.hh"
+
+// **** Rebinning of existing universe files ****
+//
+// Merging bins is a linear map on the contents of every universe histogram,
+// so a universe file made with a fine binning can be converted to any coarser
+// binning built from unions of the original bins without reprocessing the
+// ntuples. A bin merge map file describes the conversion. It contains up to
+// two sections, each introduced by the keyword "true" or "reco" followed by
+// the number of bins in the original binning. The section then lists, for
+// each original bin in order, the index of the new bin that should absorb it.
+// An index of -1 drops the original bin entirely. For example,
+//
+//   # Merge the first four true bins in pairs and drop the fifth one
+//   true 5
+//   0 0 1 1 -1
+//
+// A missing section leaves the corresponding bins unchanged. Lines that begin
+// with '#' are ignored. The new bin indices used in a section must form the
+// contiguous range 0, 1, ..., N - 1.
+
+// Describes how the true and reco bins of a universe file are combined
+class BinMergeMap {
+
+  public:
+
+    // Reads the map from a configuration file in the format described above
+    BinMergeMap( const std::string& config_file_name );
+
+    // Fills in any missing section with the identity map and checks that
+    // the map matches the original numbers of true and reco bins
+    void resolve( size_t num_old_true_bins, size_t num_old_reco_bins );
+
+    // New bin index (or -1) for each original bin
+    inline const std::vector< int >& true_map() const { return true_map_; }
+    inline const std::vector< int >& reco_map() const { return reco_map_; }
+
+    // Number of bins in the new binning (valid after a call to resolve())
+    inline size_t num_new_true_bins() const { return num_new_true_bins_; }
+    inline size_t num_new_reco_bins() const { return num_new_reco_bins_; }
+
+  protected:
+
+    std::vector< int > true_map_;
+    std::vector< int > reco_map_;
+
+    bool has_true_map_ = false;
+    bool has_reco_map_ = false;
+
+    size_t num_new_true_bins_ = 0u;
+    size_t num_new_reco_bins_ = 0u;
+};
+
+// Builds the bin definitions for the merged binning. A new bin made from a
+// single original bin keeps its definition unchanged. Otherwise, its cuts are
+// the logical OR of the original ones, and all of the original bins must share
+// the same type and block index. Any event weight carried by the original
+// cuts would be lost when they are combined in this way, so
+// rebin_universe_file() refuses to merge bins whose cuts apply one.
+std::vector< TrueBin > merge_true_bins( const std::vector< TrueBin >& bins,
+  const BinMergeMap& merge_map );
+
+std::vector< RecoBin > merge_reco_bins( const std::vector< RecoBin >& bins,
+  const BinMergeMap& merge_map );
+
+// Writes a rebinned copy of the universes stored in the root TDirectoryFile
+// input_dir_name of an existing UniverseMaker output file. If input_dir_name
+// is empty, then the first key in the input file is used. The new universes
+// are saved to a root TDirectoryFile with the same name in the output file
+// together with the new bin specifications, so that SystematicsCalculator
+// can use them as if they came directly from UniverseMaker. Any POT-summed
+// subfolder made by SystematicsCalculator is skipped: it will be rebuilt from
+// the rebinned ntuple subfolders when the output file is first opened.
+//
+// The summed squared weights of merged bins are added together, which is
+// exact as long as a single event never fills more than one of them (i.e.,
+// the original bins do not overlap). Before anything is written, the
+// unweighted true2d and reco2d histograms of every ntuple subfolder are used
+// to check this, and the unweighted true and reco histograms are used to
+// check that the cuts of every merged bin only ever give unit weights. An
+// exception is thrown if either check fails or if the histograms needed for
+// it are missing. The name of the root TDirectoryFile that was written is
+// returned.
+std::string rebin_universe_file( const std::string& input_file_name,
+  const std::string& output_file_name, BinMergeMap& merge_map,
+  const std::string& input_dir_name = "" );
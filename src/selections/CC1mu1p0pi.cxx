@@ -16,6 +16,19 @@ void CC1mu1p0pi::define_constants() {
   this->define_reco_FV( 10., 246., -105., 105., 10., 1026. );
 }
 
+void CC1mu1p0pi::define_input_branches() {
+  this->add_input_branches( {
+    "nslice", "n_pfps", "reco_nu_vtx_sce_x", "reco_nu_vtx_sce_y",
+    "reco_nu_vtx_sce_z", "pfp_generation_v", "pfpdg", "trk_score_v",
+    "backtracked_px", "backtracked_py", "backtracked_pz", "trk_sce_start_x_v",
+    "trk_sce_start_y_v", "trk_sce_start_z_v", "trk_sce_end_x_v",
+    "trk_sce_end_y_v", "trk_sce_end_z_v", "trk_theta_v", "trk_phi_v",
+    "trk_energy_proton_v", "trk_range_muon_mom_v", "trk_mcs_muon_mom_v",
+    "trk_llr_pid_score_v", "nu_pdg", "ccnc", "interaction", "true_nu_vtx_x",
+    "true_nu_vtx_y", "true_nu_vtx_z", "mc_pdg", "mc_px", "mc_py", "mc_pz"
+  } );
+}
+
 void CC1mu1p0pi::compute_reco_observables( AnalysisEvent* Event ) {
 
   if ( CandidateMuonIndex != BOGUS_INDEX
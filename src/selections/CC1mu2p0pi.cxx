@@ -15,6 +15,20 @@ void CC1mu2p0pi::define_constants() {
   this->define_reco_FV( 10., 246.35, -106.5, 106.5, 10., 1026.8 );
 }
 
+void CC1mu2p0pi::define_input_branches() {
+  this->add_input_branches( {
+    "n_pfps", "reco_nu_vtx_sce_x", "reco_nu_vtx_sce_y", "reco_nu_vtx_sce_z",
+    "pfp_generation_v", "trk_score_v", "trk_sce_start_x_v",
+    "trk_sce_start_y_v", "trk_sce_start_z_v", "trk_sce_end_x_v",
+    "trk_sce_end_y_v", "trk_sce_end_z_v", "trk_dir_x_v", "trk_dir_y_v",
+    "trk_dir_z_v", "trk_distance_v", "trk_energy_proton_v",
+    "trk_range_muon_mom_v", "trk_llr_pid_score_v", "nu_pdg", "ccnc",
+    "interaction", "true_nu_vtx_x", "true_nu_vtx_y", "true_nu_vtx_z",
+    "true_nu_vtx_sce_x", "true_nu_vtx_sce_y", "true_nu_vtx_sce_z", "mc_pdg",
+    "mc_E", "mc_px"
+  } );
+}
+
 void CC1mu2p0pi::compute_reco_observables( AnalysisEvent* Event ) {
 
   if ( LeadingProtonIndex != BOGUS_INDEX && RecoilProtonIndex != BOGUS_INDEX
@@ -14,6 +14,20 @@ void CC1muNp0pi::define_constants() {
   this->define_reco_FV( 21.5, 234.85, -95.0, 95.0, 21.5, 966.8 );
 }
 
+void CC1muNp0pi::define_input_branches() {
+  this->add_input_branches( {
+    "n_pfps", "topological_score", "CosmicIP", "reco_nu_vtx_sce_x",
+    "reco_nu_vtx_sce_y", "reco_nu_vtx_sce_z", "pfp_generation_v",
+    "trk_score_v", "trk_len_v", "trk_sce_start_x_v", "trk_sce_start_y_v",
+    "trk_sce_start_z_v", "trk_sce_end_x_v", "trk_sce_end_y_v",
+    "trk_sce_end_z_v", "trk_dir_x_v", "trk_dir_y_v", "trk_dir_z_v",
+    "trk_distance_v", "trk_energy_proton_v", "trk_range_muon_mom_v",
+    "trk_mcs_muon_mom_v", "trk_llr_pid_score_v", "nu_pdg", "ccnc",
+    "interaction", "true_nu_vtx_x", "true_nu_vtx_y", "true_nu_vtx_z",
+    "mc_pdg", "mc_E", "mc_px", "mc_py", "mc_pz"
+  } );
+}
+
 void CC1muNp0pi::compute_true_observables( AnalysisEvent* Event ) {
   size_t num_mc_daughters = Event->mc_nu_daughter_pdg_->size();
 
@@ -9,6 +9,12 @@ void DummySelection::define_constants() {
   // within selection cuts
 }
 
+void DummySelection::define_input_branches() {
+  // Call add_input_branches() with the names of all input ntuple branches
+  // used by the selection. If it is never called, then every branch will be
+  // read from the input ntuple.
+}
+
 void DummySelection::compute_reco_observables( AnalysisEvent* event ) {
   // Calculate reconstructed kinematic variables to be saved in the output
 }
@@ -18,6 +18,17 @@ void NuMICC1e::define_constants() {
     this->define_reco_FV( 10., 246., -105., 105., 10., 1026. );
 }
 
+void NuMICC1e::define_input_branches() {
+    this->add_input_branches( {
+        "nslice", "n_tracks", "n_showers", "topological_score", "CosmicIP",
+        "contained_fraction", "reco_nu_vtx_sce_x", "reco_nu_vtx_sce_y",
+        "reco_nu_vtx_sce_z", "pfp_generation_v", "shr_id", "shr_score",
+        "shr_energy_cali", "hits_ratio", "shrmoliereavg", "shr_distance",
+        "shr_tkfit_gap10_dedx_Y", "nu_pdg", "ccnc", "true_nu_vtx_x",
+        "true_nu_vtx_y", "true_nu_vtx_z", "nelec", "npi0", "elec_e"
+    } );
+}
+
 void NuMICC1e::compute_reco_observables( AnalysisEvent* Event ) {
     // Evaluate the reconstructed kinematic variables of interest for the xsec
     // measurement
@@ -24,6 +24,7 @@ void SelectionBase::setup( TTree* out_tree, bool create_branches ) {
   this->setup_tree();
   this->define_category_map();
   this->define_constants();
+  this->define_input_branches();
 
 }
 
@@ -54,6 +55,18 @@ void SelectionBase::summary() {
     << " events which passed\n";
 }
 
+void SelectionBase::add_counts( const SelectionBase& other ) {
+  num_passed_events_ += other.num_passed_events_;
+  event_number_ += other.event_number_;
+}
+
+void SelectionBase::add_input_branches(
+  const std::vector< std::string >& branch_names )
+{
+  input_branches_.insert( branch_names.cbegin(), branch_names.cend() );
+  reads_all_input_branches_ = false;
+}
+
 void SelectionBase::setup_tree() {
 
   this->set_branch( &selected_, "Selected" );
@@ -0,0 +1,249 @@
+// Standard library includes
+#include <cstdio>
+#include <iostream>
+
+// POSIX includes
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// XSecAnalyzer includes
+#include "XSecAnalyzer/BinAssignmentCache.hh"
+
+namespace {
+
+  constexpr char CACHE_MAGIC[ 8 ] = { 'X', 'S', 'B', 'I', 'N', 'C', 'C',
+    'H' };
+  constexpr uint64_t CACHE_FORMAT_VERSION = 1u;
+
+  // Magic string plus the version, configuration hash, file size,
+  // modification time, number of entries, and entry table offset
+  constexpr uint64_t CACHE_HEADER_SIZE = sizeof( CACHE_MAGIC )
+    + 6u * sizeof( uint64_t );
+
+  // Size of the match counts at the start of each record
+  constexpr uint64_t RECORD_COUNTS_SIZE = NUM_BIN_ASSIGNMENT_KINDS
+    * sizeof( uint32_t );
+
+  // Size of a single stored match
+  constexpr uint64_t MATCH_SIZE = sizeof( uint32_t ) + sizeof( double );
+
+  void append_u64( std::string& buffer, uint64_t value ) {
+    buffer.append( reinterpret_cast< const char* >(&value), sizeof(value) );
+  }
+
+  uint64_t read_u64( const char* pos ) {
+    uint64_t value;
+    std::memcpy( &value, pos, sizeof(value) );
+    return value;
+  }
+
+}
+
+NtupleFileStamp NtupleFileStamp::from_file( const std::string& file_name ) {
+  struct stat file_stat;
+  if ( stat(file_name.c_str(), &file_stat) != 0 ) {
+    throw std::runtime_error( "Could not find the input file " + file_name );
+  }
+
+  NtupleFileStamp stamp;
+  stamp.size_ = file_stat.st_size;
+  stamp.mtime_ = file_stat.st_mtime;
+  return stamp;
+}
+
+BinAssignmentCacheWriter::BinAssignmentCacheWriter(
+  const std::string& file_name, uint64_t config_hash,
+  const NtupleFileStamp& stamp, uint64_t num_entries )
+  : file_name_( file_name ), temp_file_name_( file_name + ".tmp" ),
+  out_( temp_file_name_, std::ios::binary | std::ios::trunc ),
+  num_entries_( num_entries )
+{
+  if ( !out_ ) throw std::runtime_error( "Could not open bin assignment"
+    " cache file " + temp_file_name_ + " for writing" );
+
+  // Write a placeholder header. The entry table offset is filled in by
+  // close().
+  std::string header( CACHE_MAGIC, sizeof(CACHE_MAGIC) );
+  append_u64( header, CACHE_FORMAT_VERSION );
+  append_u64( header, config_hash );
+  append_u64( header, stamp.size_ );
+  append_u64( header, stamp.mtime_ );
+  append_u64( header, num_entries );
+  append_u64( header, 0u );
+  out_.write( header.data(), header.size() );
+
+  current_offset_ = CACHE_HEADER_SIZE;
+  offsets_.reserve( num_entries );
+}
+
+BinAssignmentCacheWriter::~BinAssignmentCacheWriter() {
+  // An unfinished cache is never moved into place
+  if ( !closed_ ) {
+    out_.close();
+    std::remove( temp_file_name_.c_str() );
+  }
+}
+
+void BinAssignmentCacheWriter::append( const BinAssignmentBuffer& buffer ) {
+  for ( uint64_t offset : buffer.offsets() ) {
+    offsets_.push_back( current_offset_ + offset );
+  }
+
+  const auto& data = buffer.data();
+  out_.write( data.data(), data.size() );
+  current_offset_ += data.size();
+}
+
+void BinAssignmentCacheWriter::close() {
+  if ( closed_ ) return;
+  closed_ = true;
+
+  if ( offsets_.size() != num_entries_ ) {
+    out_.close();
+    std::remove( temp_file_name_.c_str() );
+    throw std::runtime_error( "Entry count mismatch while writing the bin"
+      " assignment cache file " + file_name_ );
+  }
+
+  out_.write( reinterpret_cast< const char* >(offsets_.data()),
+    offsets_.size() * sizeof(uint64_t) );
+
+  // Now that the entry table has been written, record its location in the
+  // header
+  std::string table_location;
+  append_u64( table_location, current_offset_ );
+  out_.seekp( CACHE_HEADER_SIZE - sizeof(uint64_t) );
+  out_.write( table_location.data(), table_location.size() );
+  out_.close();
+
+  if ( !out_ || std::rename(temp_file_name_.c_str(), file_name_.c_str()) ) {
+    std::remove( temp_file_name_.c_str() );
+    throw std::runtime_error( "Failed to write the bin assignment cache file "
+      + file_name_ );
+  }
+}
+
+MappedBinAssignmentCache::MappedBinAssignmentCache(
+  const std::string& file_name ) : file_name_( file_name )
+{
+  int fd = open( file_name.c_str(), O_RDONLY );
+  if ( fd < 0 ) throw std::runtime_error( "Could not open bin assignment"
+    " cache file " + file_name );
+
+  struct stat file_stat;
+  if ( fstat(fd, &file_stat) != 0 ) {
+    ::close( fd );
+    throw std::runtime_error( "Could not determine the size of bin"
+      " assignment cache file " + file_name );
+  }
+  mapped_size_ = file_stat.st_size;
+
+  if ( mapped_size_ < CACHE_HEADER_SIZE ) {
+    ::close( fd );
+    throw std::runtime_error( "Invalid bin assignment cache file "
+      + file_name );
+  }
+
+  // The mapping remains valid after the file descriptor is closed
+  mapped_data_ = mmap( nullptr, mapped_size_, PROT_READ, MAP_SHARED, fd, 0 );
+  ::close( fd );
+
+  if ( mapped_data_ == MAP_FAILED ) {
+    mapped_data_ = nullptr;
+    throw std::runtime_error( "Could not map bin assignment cache file "
+      + file_name );
+  }
+
+  const char* begin = static_cast< const char* >( mapped_data_ );
+
+  try {
+    if ( std::memcmp(begin, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ) {
+      throw std::runtime_error( file_name + " is not a bin assignment cache"
+        " file" );
+    }
+
+    const char* pos = begin + sizeof( CACHE_MAGIC );
+    uint64_t version = read_u64( pos );
+    config_hash_ = read_u64( pos + sizeof(uint64_t) );
+    stamp_.size_ = read_u64( pos + 2u*sizeof(uint64_t) );
+    stamp_.mtime_ = read_u64( pos + 3u*sizeof(uint64_t) );
+    num_entries_ = read_u64( pos + 4u*sizeof(uint64_t) );
+    uint64_t table_offset = read_u64( pos + 5u*sizeof(uint64_t) );
+
+    if ( version != CACHE_FORMAT_VERSION ) {
+      throw std::runtime_error( "Unsupported bin assignment cache version "
+        + std::to_string(version) );
+    }
+
+    if ( table_offset < CACHE_HEADER_SIZE || table_offset > mapped_size_
+      || num_entries_ > ( mapped_size_ - table_offset ) / sizeof(uint64_t) )
+    {
+      throw std::runtime_error( "Invalid or incomplete bin assignment cache"
+        " file " + file_name );
+    }
+
+    table_ = begin + table_offset;
+
+    // Check once here that every record lies before the entry table so that
+    // read_entry() can skip the bounds checks
+    for ( uint64_t e = 0u; e < num_entries_; ++e ) {
+      uint64_t offset = read_u64( table_ + e * sizeof(uint64_t) );
+      if ( offset < CACHE_HEADER_SIZE
+        || offset + RECORD_COUNTS_SIZE > table_offset )
+      {
+        throw std::runtime_error( "Corrupted bin assignment cache file "
+          + file_name );
+      }
+
+      uint32_t counts[ NUM_BIN_ASSIGNMENT_KINDS ];
+      std::memcpy( counts, begin + offset, sizeof(counts) );
+      uint64_t num_matches = 0u;
+      for ( uint32_t count : counts ) num_matches += count;
+
+      if ( num_matches * MATCH_SIZE
+        > table_offset - offset - RECORD_COUNTS_SIZE )
+      {
+        throw std::runtime_error( "Corrupted bin assignment cache file "
+          + file_name );
+      }
+    }
+  }
+  catch ( ... ) {
+    munmap( mapped_data_, mapped_size_ );
+    mapped_data_ = nullptr;
+    throw;
+  }
+}
+
+MappedBinAssignmentCache::~MappedBinAssignmentCache() {
+  if ( mapped_data_ ) munmap( mapped_data_, mapped_size_ );
+}
+
+std::unique_ptr< MappedBinAssignmentCache > open_bin_assignment_cache(
+  const std::string& file_name, uint64_t config_hash,
+  const NtupleFileStamp& stamp, uint64_t num_entries )
+{
+  if ( !std::ifstream(file_name).good() ) return nullptr;
+
+  std::unique_ptr< MappedBinAssignmentCache > cache;
+  try {
+    cache = std::make_unique< MappedBinAssignmentCache >( file_name );
+  }
+  catch ( const std::runtime_error& err ) {
+    std::cout << "Ignoring unreadable bin assignment cache " << file_name
+      << ": " << err.what() << '\n';
+    return nullptr;
+  }
+
+  if ( cache->config_hash() != config_hash || !(cache->stamp() == stamp)
+    || cache->num_entries() != num_entries )
+  {
+    std::cout << "Ignoring out-of-date bin assignment cache " << file_name
+      << '\n';
+    return nullptr;
+  }
+
+  return cache;
+}
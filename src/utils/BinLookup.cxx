@@ -0,0 +1,253 @@
+// Standard library includes
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+// XSecAnalyzer includes
+#include "XSecAnalyzer/BinLookup.hh"
+
+namespace {
+
+  // Writes an edge table entry as a cut string with the same structure as
+  // the ones produced by MakeConfig. The parentheses keep the meaning of the
+  // selection and variables intact. The edges are printed with enough digits
+  // to be read back exactly.
+  std::string edge_record_cut( const BinEdgeRecord& rec ) {
+    std::ostringstream oss;
+    oss << std::setprecision( std::numeric_limits<double>::max_digits10 );
+
+    if ( !rec.selection_.empty() ) oss << '(' << rec.selection_ << ") && ";
+
+    for ( size_t i = 0u; i < rec.intervals_.size(); ++i ) {
+      const auto& bi = rec.intervals_.at( i );
+      if ( i > 0u ) oss << " && ";
+      oss << '(' << bi.variable_ << ") >= " << bi.low_ << " && ("
+        << bi.variable_ << ") < " << bi.high_;
+    }
+
+    return oss.str();
+  }
+
+}
+
+BinLookup::BinLookup( const std::vector<std::string>& cuts,
+  const std::vector<BinEdgeRecord>& edges, TTree& tree,
+  const std::string& formula_name_prefix )
+{
+  // Check the edge records for consistency with the bin definitions
+  std::set< size_t > seen_bins;
+  for ( const auto& rec : edges ) {
+    if ( rec.bin_index_ >= cuts.size() ) throw std::runtime_error(
+      "Bin edge table entry refers to missing bin "
+      + std::to_string(rec.bin_index_) );
+
+    if ( !seen_bins.insert(rec.bin_index_).second ) throw std::runtime_error(
+      "Duplicate bin edge table entry for bin "
+      + std::to_string(rec.bin_index_) );
+
+    if ( rec.intervals_.empty() ) throw std::runtime_error( "Bin edge table"
+      " entry for bin " + std::to_string(rec.bin_index_) + " has no"
+      " intervals" );
+  }
+
+  // Make sure that each edge table entry describes exactly the same events
+  // as the cut string for its bin. Both are compiled into one expression
+  // graph, in which identical expressions always share a node, so the entry
+  // is only used if the two root nodes are the same. Bins whose entries fail
+  // this test are tested using their cut strings instead.
+  std::vector< std::string > check_exprs;
+  for ( const auto& rec : edges ) {
+    check_exprs.push_back( cuts.at(rec.bin_index_) );
+    check_exprs.push_back( edge_record_cut(rec) );
+  }
+
+  CutProgram check_program( check_exprs, tree, formula_name_prefix
+    + "check_", false );
+
+  // Group the valid records by their selection and list of binned variables
+  std::map< std::vector<std::string>, std::vector<const BinEdgeRecord*> >
+    record_groups;
+
+  for ( size_t r = 0u; r < edges.size(); ++r ) {
+    if ( !check_program.same_expression(2u*r, 2u*r + 1u) ) continue;
+
+    const auto& rec = edges.at( r );
+    std::vector< std::string > key;
+    key.push_back( rec.selection_ );
+    for ( const auto& bi : rec.intervals_ ) key.push_back( bi.variable_ );
+
+    record_groups[ key ].push_back( &rec );
+  }
+
+  // Collect the distinct selections and variables used by the edge table so
+  // that each one is evaluated at most once per entry
+  std::vector< std::string > value_exprs;
+  std::map< std::string, size_t > value_slots;
+  auto get_slot = [ & ]( const std::string& expr ) {
+    auto iter = value_slots.find( expr );
+    if ( iter != value_slots.end() ) return iter->second;
+    size_t slot = value_exprs.size();
+    value_exprs.push_back( expr );
+    value_slots[ expr ] = slot;
+    return slot;
+  };
+
+  // Build the search tree for each group. Bins in groups whose intervals
+  // overlap are left for the CutProgram, and the expressions that only they
+  // would use are dropped.
+  std::vector< bool > is_indexed( cuts.size(), false );
+
+  for ( const auto& pair : record_groups ) {
+    const auto& key = pair.first;
+    const auto& records = pair.second;
+
+    size_t num_slots = value_exprs.size();
+    size_t num_nodes = nodes_.size();
+
+    int selection = -1;
+    if ( !key.front().empty() ) {
+      selection = static_cast< int >( get_slot(key.front()) );
+    }
+
+    std::vector< size_t > variable_slots;
+    for ( size_t v = 1u; v < key.size(); ++v ) {
+      variable_slots.push_back( get_slot(key.at(v)) );
+    }
+
+    int root = this->build_node( records, 0u, variable_slots );
+    if ( root < 0 ) {
+      nodes_.resize( num_nodes );
+      for ( size_t e = num_slots; e < value_exprs.size(); ++e ) {
+        value_slots.erase( value_exprs.at(e) );
+      }
+      value_exprs.resize( num_slots );
+      continue;
+    }
+
+    groups_.push_back( BinGroup{ selection, root } );
+    for ( const auto* rec : records ) {
+      is_indexed.at( rec->bin_index_ ) = true;
+      ++num_indexed_bins_;
+    }
+  }
+
+  // Every expression used here is part of a cut that was compiled above, so
+  // no fallback TTreeFormula objects are needed
+  value_program_ = std::make_unique< CutProgram >( value_exprs, tree,
+    formula_name_prefix + "edge_", false );
+
+  if ( value_program_->num_fallback() > 0u ) throw std::runtime_error(
+    "Failed to compile the bin edge table expressions" );
+
+  // Test all remaining bins using their full cut strings
+  std::vector< std::string > remaining_cuts;
+  for ( size_t b = 0u; b < cuts.size(); ++b ) {
+    if ( is_indexed.at(b) ) continue;
+    remaining_cuts.push_back( cuts.at(b) );
+    cut_program_bins_.push_back( b );
+  }
+
+  cut_program_ = std::make_unique< CutProgram >( remaining_cuts, tree,
+    formula_name_prefix );
+}
+
+int BinLookup::build_node( std::vector<const BinEdgeRecord*> records,
+  size_t level, const std::vector<size_t>& variable_slots )
+{
+  // Sort the records by the interval on the variable for the current level
+  std::stable_sort( records.begin(), records.end(),
+    [ level ]( const BinEdgeRecord* a, const BinEdgeRecord* b ) {
+      const auto& ia = a->intervals_.at( level );
+      const auto& ib = b->intervals_.at( level );
+      if ( ia.low_ != ib.low_ ) return ia.low_ < ib.low_;
+      return ia.high_ < ib.high_;
+    }
+  );
+
+  IntervalNode node;
+  node.variable_ = variable_slots.at( level );
+  bool last_level = ( level + 1u == variable_slots.size() );
+
+  size_t r = 0u;
+  while ( r < records.size() ) {
+    const auto& interval = records.at( r )->intervals_.at( level );
+
+    // Gather all records that share the current interval
+    std::vector< const BinEdgeRecord* > same;
+    while ( r < records.size() ) {
+      const auto& other = records.at( r )->intervals_.at( level );
+      if ( other.low_ != interval.low_ || other.high_ != interval.high_ ) break;
+      same.push_back( records.at(r) );
+      ++r;
+    }
+
+    // Intervals must be disjoint for the binary search to find all matches
+    if ( !node.highs_.empty() && interval.low_ < node.highs_.back() ) {
+      return -1;
+    }
+
+    int child;
+    if ( last_level ) {
+      // Two bins with identical intervals can't be told apart here
+      if ( same.size() != 1u ) return -1;
+      child = -static_cast< int >( same.front()->bin_index_ ) - 1;
+    }
+    else {
+      child = this->build_node( same, level + 1u, variable_slots );
+      if ( child < 0 ) return -1;
+    }
+
+    node.lows_.push_back( interval.low_ );
+    node.highs_.push_back( interval.high_ );
+    node.children_.push_back( child );
+  }
+
+  int index = static_cast< int >( nodes_.size() );
+  nodes_.push_back( node );
+  return index;
+}
+
+void BinLookup::notify() {
+  value_program_->notify();
+  cut_program_->notify();
+}
+
+void BinLookup::add_used_branches( std::set<std::string>& branch_names )
+  const
+{
+  value_program_->add_used_branches( branch_names );
+  cut_program_->add_used_branches( branch_names );
+}
+
+void BinLookup::find_indexed_bins() {
+  value_program_->begin_entry();
+
+  for ( const auto& group : groups_ ) {
+    if ( group.selection_ >= 0
+      && !value_program_->value(group.selection_) ) continue;
+
+    int n = group.root_;
+    while ( n >= 0 ) {
+      const auto& node = nodes_[ n ];
+      double x = value_program_->value( node.variable_ );
+
+      // Find the last interval whose lower edge is not above x. A NaN value
+      // never passes the explicit range check below.
+      auto iter = std::upper_bound( node.lows_.begin(), node.lows_.end(), x );
+      if ( iter == node.lows_.begin() ) break;
+      size_t i = static_cast< size_t >( iter - node.lows_.begin() ) - 1u;
+      if ( !(x >= node.lows_[i] && x < node.highs_[i]) ) break;
+
+      int child = node.children_[ i ];
+      if ( child < 0 ) {
+        // Bin definitions that use && evaluate to unity when they pass
+        matches_.emplace_back( static_cast<size_t>(-(child + 1)), 1. );
+        break;
+      }
+      n = child;
+    }
+  }
+}
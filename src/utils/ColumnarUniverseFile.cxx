@@ -0,0 +1,543 @@
+// Standard library includes
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+// POSIX includes
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// XSecAnalyzer includes
+#include "XSecAnalyzer/ColumnarUniverseFile.hh"
+
+namespace {
+
+  constexpr char COLUMNAR_MAGIC[ 8 ] = { 'X', 'S', 'U', 'N', 'I', 'V', 'C',
+    'L' };
+  constexpr uint64_t COLUMNAR_FORMAT_VERSION = 3u;
+
+  // Oldest format version that can still be read. Version 1 files lack the
+  // histogram mask for each family, and versions 1 and 2 lack the histogram
+  // statistics.
+  constexpr uint64_t MIN_COLUMNAR_FORMAT_VERSION = 1u;
+
+  // Magic string plus the version, index offset, and index size
+  constexpr uint64_t COLUMNAR_HEADER_SIZE = sizeof( COLUMNAR_MAGIC )
+    + 3u * sizeof( uint64_t );
+
+  void append_u64( std::string& buffer, uint64_t value ) {
+    buffer.append( reinterpret_cast< const char* >(&value), sizeof(value) );
+  }
+
+  void append_string( std::string& buffer, const std::string& str ) {
+    append_u64( buffer, str.size() );
+    buffer.append( str );
+  }
+
+  // Reads values from the index of a mapped columnar file while checking
+  // that they lie within its bounds
+  class IndexCursor {
+
+    public:
+
+      IndexCursor( const char* begin, const char* end )
+        : pos_( begin ), end_( end ) {}
+
+      uint64_t read_u64() {
+        uint64_t value;
+        this->check( sizeof(value) );
+        std::memcpy( &value, pos_, sizeof(value) );
+        pos_ += sizeof( value );
+        return value;
+      }
+
+      std::string read_string() {
+        uint64_t length = this->read_u64();
+        this->check( length );
+        std::string result( pos_, length );
+        pos_ += length;
+        return result;
+      }
+
+    protected:
+
+      void check( uint64_t num_bytes ) const {
+        if ( num_bytes > static_cast< uint64_t >(end_ - pos_) ) {
+          throw std::runtime_error( "Truncated columnar universe file index" );
+        }
+      }
+
+      const char* pos_;
+      const char* end_;
+  };
+
+}
+
+size_t ColumnarUniverseFamily::num_bins( UniverseHistKind kind ) const {
+  switch ( kind ) {
+    case kTrueUniverseHist: return num_true_bins_;
+    case kRecoUniverseHist: return num_reco_bins_;
+    case k2DUniverseHist: return num_true_bins_ * num_reco_bins_;
+    case kCategUniverseHist: return num_categories_ * num_reco_bins_;
+    case kReco2DUniverseHist: return num_reco_bins_ * num_reco_bins_;
+    case kTrue2DUniverseHist: return num_true_bins_ * num_true_bins_;
+  }
+  throw std::runtime_error( "Unrecognized universe histogram kind" );
+}
+
+size_t ColumnarUniverseFamily::num_y_bins( UniverseHistKind kind ) const {
+  switch ( kind ) {
+    case kTrueUniverseHist: return 0u;
+    case kRecoUniverseHist: return 0u;
+    case k2DUniverseHist: return num_reco_bins_;
+    case kCategUniverseHist: return num_reco_bins_;
+    case kReco2DUniverseHist: return num_reco_bins_;
+    case kTrue2DUniverseHist: return num_true_bins_;
+  }
+  throw std::runtime_error( "Unrecognized universe histogram kind" );
+}
+
+const double* ColumnarUniverseFamily::sum( UniverseHistKind kind,
+  size_t u ) const
+{
+  return kind_data_[ kind ] + u * this->num_bins( kind );
+}
+
+const double* ColumnarUniverseFamily::sumw2( UniverseHistKind kind,
+  size_t u ) const
+{
+  size_t nb = this->num_bins( kind );
+  return kind_data_[ kind ] + ( num_universes_ + u ) * nb;
+}
+
+double ColumnarUniverseFamily::entries( UniverseHistKind kind,
+  size_t u ) const
+{
+  size_t nb = this->num_bins( kind );
+  return kind_data_[ kind ][ 2u * num_universes_ * nb + u ];
+}
+
+const double* ColumnarUniverseFamily::stats( UniverseHistKind kind,
+  size_t u ) const
+{
+  if ( !has_stats_ ) return nullptr;
+  size_t nb = this->num_bins( kind );
+  return kind_data_[ kind ] + ( 2u * nb + 1u ) * num_universes_
+    + u * NUM_UNIVERSE_HIST_STATS;
+}
+
+ColumnarUniverseWriter::ColumnarUniverseWriter( const std::string& file_name,
+  const ColumnarUniverseMetadata& metadata ) : file_name_( file_name ),
+  out_( file_name, std::ios::binary | std::ios::trunc ), metadata_( metadata )
+{
+  if ( !out_ ) throw std::runtime_error( "Could not open columnar universe"
+    " file " + file_name + " for writing" );
+
+  // Write a placeholder header. The index location is filled in by close().
+  std::string header( COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC) );
+  append_u64( header, COLUMNAR_FORMAT_VERSION );
+  append_u64( header, 0u );
+  append_u64( header, 0u );
+  out_.write( header.data(), header.size() );
+
+  current_offset_ = COLUMNAR_HEADER_SIZE;
+}
+
+ColumnarUniverseWriter::~ColumnarUniverseWriter() {
+  // Avoid throwing exceptions from the destructor
+  if ( !closed_ ) {
+    try {
+      this->close();
+    }
+    catch ( const std::exception& e ) {
+      std::cerr << "Failed to finish columnar universe file " << file_name_
+        << ": " << e.what() << '\n';
+    }
+  }
+}
+
+void ColumnarUniverseWriter::write_store(
+  const std::string& subdirectory_name, const UniverseStore& store )
+{
+  const UniverseArray* arrays[] = { &store.true_array(), &store.reco_array(),
+    &store.twod_array(), &store.categ_array(), &store.reco2d_array(),
+    &store.true2d_array() };
+
+  this->write_family( subdirectory_name, store.name(), store.num_universes(),
+    store.num_true_bins(), store.num_reco_bins(), store.num_categories(),
+    store.hist_mask(), [ &arrays ]( UniverseHistKind kind, size_t u,
+    double* sum, double* sumw2, double* stats )
+    {
+      const UniverseArray& arr = *arrays[ kind ];
+      arr.copy_row( u, sum, sumw2 );
+      if ( stats ) arr.copy_stats( u, stats );
+      return arr.entries_.at( u );
+    } );
+}
+
+void ColumnarUniverseWriter::write_universes(
+  const std::string& subdirectory_name,
+  const std::vector< const Universe* >& universes )
+{
+  if ( universes.empty() ) return;
+
+  const Universe& first = *universes.front();
+  UniverseHistMask hist_mask = first.hist_mask();
+
+  for ( size_t u = 0u; u < universes.size(); ++u ) {
+    const Universe& univ = *universes.at( u );
+    if ( univ.index_ != u ) throw std::runtime_error( "Universe index"
+      " mismatch while writing columnar universe file" );
+
+    if ( ( univ.hist_mask() & REQUIRED_UNIVERSE_HISTS )
+      != REQUIRED_UNIVERSE_HISTS || univ.hist_mask() != hist_mask )
+    {
+      throw std::runtime_error( "Missing histogram for the "
+        + univ.universe_name_ + " universe" );
+    }
+  }
+
+  size_t num_true_bins = first.hist_true_->GetNbinsX();
+  size_t num_reco_bins = first.hist_reco_->GetNbinsX();
+  size_t num_categories = first.hist_categ_->GetNbinsX();
+
+  ColumnarUniverseFamily dims;
+  dims.num_true_bins_ = num_true_bins;
+  dims.num_reco_bins_ = num_reco_bins;
+  dims.num_categories_ = num_categories;
+
+  this->write_family( subdirectory_name, first.universe_name_,
+    universes.size(), num_true_bins, num_reco_bins, num_categories,
+    hist_mask, [ & ]( UniverseHistKind kind, size_t u, double* sum,
+    double* sumw2, double* stats )
+    {
+      const TH1& hist = *universes.at( u )->hist( kind );
+
+      size_t nb = dims.num_bins( kind );
+      size_t num_y_bins = dims.num_y_bins( kind );
+
+      int num_hist_bins = hist.GetNbinsX() * hist.GetNbinsY();
+      if ( static_cast< size_t >(num_hist_bins) != nb ) {
+        throw std::runtime_error( "Inconsistent histogram binning in the "
+          + universes.at(u)->universe_name_ + " universe" );
+      }
+
+      // Histograms without stored squared weights use the ROOT default
+      // (errors given by the square root of the bin contents)
+      bool has_sumw2 = hist.GetSumw2N() > 0;
+      for ( size_t b = 0u; b < nb; ++b ) {
+        int root_bin = universe_hist_root_bin( hist, b, num_y_bins );
+        double content = hist.GetBinContent( root_bin );
+        if ( sum ) sum[ b ] = content;
+        if ( sumw2 ) {
+          sumw2[ b ] = has_sumw2 ? hist.GetSumw2()->At( root_bin ) : content;
+        }
+      }
+
+      // For 1D histograms, TH1::GetStats() only sets the first four values
+      if ( stats ) {
+        std::fill( stats, stats + NUM_UNIVERSE_HIST_STATS, 0. );
+        hist.GetStats( stats );
+      }
+      return hist.GetEntries();
+    } );
+}
+
+void ColumnarUniverseWriter::write_family(
+  const std::string& subdirectory_name, const std::string& universe_name,
+  size_t num_universes, size_t num_true_bins, size_t num_reco_bins,
+  size_t num_categories, UniverseHistMask hist_mask,
+  const RowFunction& get_row )
+{
+  if ( closed_ ) throw std::runtime_error( "Cannot add universes to the"
+    " closed columnar universe file " + file_name_ );
+
+  ColumnarUniverseFamily family;
+  family.subdirectory_name_ = subdirectory_name;
+  family.universe_name_ = universe_name;
+  family.num_universes_ = num_universes;
+  family.num_true_bins_ = num_true_bins;
+  family.num_reco_bins_ = num_reco_bins;
+  family.num_categories_ = num_categories;
+  family.hist_mask_ = hist_mask;
+
+  family_offsets_.push_back( current_offset_ );
+
+  for ( size_t k = 0u; k < NUM_UNIVERSE_HIST_KINDS; ++k ) {
+    auto kind = static_cast< UniverseHistKind >( k );
+    if ( !family.has_hist(kind) ) continue;
+
+    size_t nb = family.num_bins( kind );
+
+    std::vector< double > row( nb, 0. );
+    std::vector< double > entries( num_universes, 0. );
+    std::vector< double > stats( NUM_UNIVERSE_HIST_STATS * num_universes,
+      0. );
+
+    // Write the summed weights for every universe, followed by the summed
+    // squared weights, the entry counts, and the histogram statistics
+    for ( size_t u = 0u; u < num_universes; ++u ) {
+      entries[ u ] = get_row( kind, u, row.data(), nullptr,
+        stats.data() + u * NUM_UNIVERSE_HIST_STATS );
+      out_.write( reinterpret_cast< const char* >(row.data()),
+        nb * sizeof(double) );
+    }
+
+    for ( size_t u = 0u; u < num_universes; ++u ) {
+      get_row( kind, u, nullptr, row.data(), nullptr );
+      out_.write( reinterpret_cast< const char* >(row.data()),
+        nb * sizeof(double) );
+    }
+
+    out_.write( reinterpret_cast< const char* >(entries.data()),
+      num_universes * sizeof(double) );
+
+    out_.write( reinterpret_cast< const char* >(stats.data()),
+      stats.size() * sizeof(double) );
+
+    current_offset_ += ( 2u * nb + 1u + NUM_UNIVERSE_HIST_STATS )
+      * num_universes * sizeof( double );
+  }
+
+  if ( !out_ ) throw std::runtime_error( "Failed to write universes to the"
+    " columnar universe file " + file_name_ );
+
+  families_.push_back( family );
+}
+
+void ColumnarUniverseWriter::close() {
+  if ( closed_ ) return;
+  closed_ = true;
+
+  std::string index;
+  append_string( index, metadata_.ntuple_name_ );
+  append_string( index, metadata_.directory_name_ );
+  append_string( index, metadata_.true_bin_spec_ );
+  append_string( index, metadata_.reco_bin_spec_ );
+  append_string( index, metadata_.sel_for_categ_ );
+
+  append_u64( index, families_.size() );
+  for ( size_t f = 0u; f < families_.size(); ++f ) {
+    const auto& family = families_.at( f );
+    append_string( index, family.subdirectory_name_ );
+    append_string( index, family.universe_name_ );
+    append_u64( index, family.num_universes_ );
+    append_u64( index, family.num_true_bins_ );
+    append_u64( index, family.num_reco_bins_ );
+    append_u64( index, family.num_categories_ );
+    append_u64( index, family.hist_mask_ );
+    append_u64( index, family_offsets_.at(f) );
+  }
+
+  out_.write( index.data(), index.size() );
+
+  // Now that the index has been written, record its location in the header
+  std::string index_location;
+  append_u64( index_location, current_offset_ );
+  append_u64( index_location, index.size() );
+
+  out_.seekp( sizeof(COLUMNAR_MAGIC) + sizeof(uint64_t) );
+  out_.write( index_location.data(), index_location.size() );
+  out_.close();
+
+  if ( !out_ ) throw std::runtime_error( "Failed to write the index of the"
+    " columnar universe file " + file_name_ );
+}
+
+MappedUniverseFile::MappedUniverseFile( const std::string& file_name )
+  : file_name_( file_name )
+{
+  int fd = open( file_name.c_str(), O_RDONLY );
+  if ( fd < 0 ) throw std::runtime_error( "Could not open columnar universe"
+    " file " + file_name );
+
+  struct stat file_stat;
+  if ( fstat(fd, &file_stat) != 0 ) {
+    ::close( fd );
+    throw std::runtime_error( "Could not determine the size of columnar"
+      " universe file " + file_name );
+  }
+  mapped_size_ = file_stat.st_size;
+
+  if ( mapped_size_ < COLUMNAR_HEADER_SIZE ) {
+    ::close( fd );
+    throw std::runtime_error( "Invalid columnar universe file " + file_name );
+  }
+
+  // The mapping remains valid after the file descriptor is closed
+  mapped_data_ = mmap( nullptr, mapped_size_, PROT_READ, MAP_SHARED, fd, 0 );
+  ::close( fd );
+
+  if ( mapped_data_ == MAP_FAILED ) {
+    mapped_data_ = nullptr;
+    throw std::runtime_error( "Could not map columnar universe file "
+      + file_name );
+  }
+
+  const char* begin = static_cast< const char* >( mapped_data_ );
+  const char* end = begin + mapped_size_;
+
+  try {
+    if ( std::memcmp(begin, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC)) != 0 ) {
+      throw std::runtime_error( file_name + " is not a columnar universe"
+        " file" );
+    }
+
+    IndexCursor header( begin + sizeof(COLUMNAR_MAGIC), end );
+    uint64_t version = header.read_u64();
+    uint64_t index_offset = header.read_u64();
+    uint64_t index_size = header.read_u64();
+
+    if ( version < MIN_COLUMNAR_FORMAT_VERSION
+      || version > COLUMNAR_FORMAT_VERSION )
+    {
+      throw std::runtime_error( "Unsupported columnar universe file version "
+        + std::to_string(version) );
+    }
+
+    if ( index_offset < COLUMNAR_HEADER_SIZE || index_offset > mapped_size_
+      || index_size > mapped_size_ - index_offset )
+    {
+      throw std::runtime_error( "Invalid or incomplete columnar universe file "
+        + file_name );
+    }
+
+    IndexCursor index( begin + index_offset,
+      begin + index_offset + index_size );
+
+    metadata_.ntuple_name_ = index.read_string();
+    metadata_.directory_name_ = index.read_string();
+    metadata_.true_bin_spec_ = index.read_string();
+    metadata_.reco_bin_spec_ = index.read_string();
+    metadata_.sel_for_categ_ = index.read_string();
+
+    uint64_t num_families = index.read_u64();
+    for ( uint64_t f = 0u; f < num_families; ++f ) {
+      ColumnarUniverseFamily family;
+      family.subdirectory_name_ = index.read_string();
+      family.universe_name_ = index.read_string();
+      family.num_universes_ = index.read_u64();
+      family.num_true_bins_ = index.read_u64();
+      family.num_reco_bins_ = index.read_u64();
+      family.num_categories_ = index.read_u64();
+      if ( version >= 2u ) family.hist_mask_ = index.read_u64();
+      family.has_stats_ = ( version >= 3u );
+      uint64_t offset = index.read_u64();
+
+      // Set the pointers to each kind of stored array, checking along the
+      // way that they all lie before the index
+      for ( size_t k = 0u; k < NUM_UNIVERSE_HIST_KINDS; ++k ) {
+        auto kind = static_cast< UniverseHistKind >( k );
+        if ( !family.has_hist(kind) ) continue;
+
+        uint64_t num_values = 2u * family.num_bins( kind ) + 1u;
+        if ( family.has_stats_ ) num_values += NUM_UNIVERSE_HIST_STATS;
+
+        uint64_t num_bytes = num_values * family.num_universes_
+          * sizeof( double );
+
+        if ( offset > index_offset || num_bytes > index_offset - offset ) {
+          throw std::runtime_error( "Universe data for "
+            + family.universe_name_ + " extend beyond the end of the"
+            " columnar universe file " + file_name );
+        }
+
+        family.kind_data_[ k ] = reinterpret_cast< const double* >(
+          begin + offset );
+        offset += num_bytes;
+      }
+
+      auto key = std::make_pair( family.subdirectory_name_,
+        family.universe_name_ );
+      if ( family_map_.count(key) ) throw std::runtime_error( "Duplicate "
+        + family.universe_name_ + " universes for " + family.subdirectory_name_
+        + " in the columnar universe file " + file_name );
+
+      family_map_[ key ] = families_.size();
+      families_.push_back( family );
+    }
+  }
+  catch ( ... ) {
+    munmap( mapped_data_, mapped_size_ );
+    mapped_data_ = nullptr;
+    throw;
+  }
+}
+
+MappedUniverseFile::~MappedUniverseFile() {
+  if ( mapped_data_ ) munmap( mapped_data_, mapped_size_ );
+}
+
+const ColumnarUniverseFamily* MappedUniverseFile::find_family(
+  const std::string& subdirectory_name,
+  const std::string& universe_name ) const
+{
+  auto iter = family_map_.find( std::make_pair(subdirectory_name,
+    universe_name) );
+  if ( iter == family_map_.end() ) return nullptr;
+  return &families_.at( iter->second );
+}
+
+std::vector< std::string > MappedUniverseFile::family_names(
+  const std::string& subdirectory_name ) const
+{
+  std::vector< std::string > names;
+  for ( const auto& family : families_ ) {
+    if ( family.subdirectory_name_ == subdirectory_name ) {
+      names.push_back( family.universe_name_ );
+    }
+  }
+  return names;
+}
+
+std::unique_ptr< Universe > MappedUniverseFile::make_universe(
+  const ColumnarUniverseFamily& family, size_t u ) const
+{
+  // The category count is passed explicitly rather than through the static
+  // Universe::num_categories_, since this function is called concurrently by
+  // SystematicsCalculator::build_universes()
+  auto univ = std::make_unique< Universe >( family.universe_name_, u,
+    family.num_true_bins_, family.num_reco_bins_, family.num_categories_ );
+
+  univ->detach_hists();
+  univ->drop_hists( family.hist_mask_ );
+  this->copy_to_universe( family, u, *univ );
+
+  return univ;
+}
+
+void MappedUniverseFile::copy_to_universe(
+  const ColumnarUniverseFamily& family, size_t u, Universe& univ ) const
+{
+  if ( u >= family.num_universes_ ) throw std::runtime_error( "Universe index "
+    + std::to_string(u) + " out of range for " + family.universe_name_ );
+
+  if ( univ.hist_mask() != family.hist_mask_ ) {
+    throw std::runtime_error( "Histogram mismatch while copying the "
+      + family.universe_name_ + " universe from " + file_name_ );
+  }
+
+  for ( size_t k = 0u; k < NUM_UNIVERSE_HIST_KINDS; ++k ) {
+    auto kind = static_cast< UniverseHistKind >( k );
+    TH1* hist = univ.hist( kind );
+    if ( !hist ) continue;
+
+    size_t nb = family.num_bins( kind );
+    if ( static_cast< size_t >(hist->GetNbinsX() * hist->GetNbinsY()) != nb )
+    {
+      throw std::runtime_error( "Binning mismatch while copying the "
+        + family.universe_name_ + " universe from " + file_name_ );
+    }
+
+    hist->Reset();
+    fill_universe_hist( *hist, family.sum(kind, u), family.sumw2(kind, u),
+      nb, family.num_y_bins(kind), family.entries(kind, u),
+      family.stats(kind, u) );
+  }
+
+  univ.universe_name_ = family.universe_name_;
+  univ.index_ = u;
+}
@@ -0,0 +1,537 @@
+// Standard library includes
+#include <cctype>
+#include <cstdlib>
+#include <set>
+#include <stdexcept>
+
+// XSecAnalyzer includes
+#include "XSecAnalyzer/CutProgram.hh"
+
+namespace {
+
+  // TLeaf type names that may be read directly as a single number
+  const std::set< std::string > NUMERIC_LEAF_TYPES = { "Bool_t", "Char_t",
+    "UChar_t", "Short_t", "UShort_t", "Int_t", "UInt_t", "Long_t", "ULong_t",
+    "Long64_t", "ULong64_t", "Float_t", "Double_t" };
+
+  bool is_identifier_start( char c ) {
+    return std::isalpha( static_cast<unsigned char>(c) ) || c == '_';
+  }
+
+  bool is_identifier_char( char c ) {
+    return std::isalnum( static_cast<unsigned char>(c) ) || c == '_'
+      || c == '$';
+  }
+
+  // Adds the name of the top-level branch that owns a leaf (and the one that
+  // owns its leaf count, if any) to a set
+  void add_leaf_branch( TLeaf* leaf, std::set<std::string>& branch_names ) {
+    if ( !leaf ) return;
+
+    TBranch* branch = leaf->GetBranch();
+    if ( branch ) {
+      TBranch* mother = branch->GetMother();
+      if ( !mother ) mother = branch;
+      branch_names.insert( mother->GetName() );
+    }
+
+    add_leaf_branch( leaf->GetLeafCount(), branch_names );
+  }
+
+  void add_formula_branches( TTreeFormula& formula,
+    std::set<std::string>& branch_names )
+  {
+    int num_codes = formula.GetNcodes();
+    for ( int c = 0; c < num_codes; ++c ) {
+      add_leaf_branch( formula.GetLeaf(c), branch_names );
+    }
+  }
+
+}
+
+// Recursive-descent parser for the subset of TTreeFormula syntax used in bin
+// definitions. The usual C++ operator precedence is respected. Any syntax
+// that is not understood causes a std::runtime_error to be thrown, which
+// makes the CutProgram fall back to a TTreeFormula for the full expression.
+class CutProgram::Parser {
+
+  public:
+
+    Parser( CutProgram& prog, const std::string& expr )
+      : prog_( prog ), expr_( expr ) {}
+
+    // Returns the index of the root node for the full expression
+    int parse() {
+      int result = this->parse_or();
+      this->skip_whitespace();
+      if ( pos_ != expr_.size() ) this->fail();
+      return result;
+    }
+
+  protected:
+
+    [[noreturn]] void fail() const {
+      throw std::runtime_error( "Unable to compile cut expression \""
+        + expr_ + "\" at position " + std::to_string(pos_) );
+    }
+
+    void skip_whitespace() {
+      while ( pos_ < expr_.size()
+        && std::isspace(static_cast<unsigned char>(expr_[pos_])) ) ++pos_;
+    }
+
+    char peek( size_t offset = 0u ) const {
+      if ( pos_ + offset < expr_.size() ) return expr_[ pos_ + offset ];
+      return '\0';
+    }
+
+    // Consumes the given operator if it appears next in the expression.
+    // Single-character operators are not matched when they are the first
+    // character of a longer one (e.g., '<' in "<=" or '&' in "&&").
+    bool accept( const std::string& op ) {
+      this->skip_whitespace();
+      if ( expr_.compare(pos_, op.size(), op) != 0 ) return false;
+      if ( op.size() == 1u ) {
+        char next = this->peek( 1u );
+        if ( next == '=' && op != "=" ) return false;
+        if ( (op == "&" || op == "|") && next == op.front() ) return false;
+      }
+      pos_ += op.size();
+      return true;
+    }
+
+    void expect( char c ) {
+      this->skip_whitespace();
+      if ( this->peek() != c ) this->fail();
+      ++pos_;
+    }
+
+    int parse_or() {
+      int left = this->parse_and();
+      while ( this->accept("||") ) {
+        int right = this->parse_and();
+        left = prog_.add_node( Op::kOr, left, right );
+      }
+      return left;
+    }
+
+    int parse_and() {
+      int left = this->parse_equality();
+      while ( this->accept("&&") ) {
+        int right = this->parse_equality();
+        left = prog_.add_node( Op::kAnd, left, right );
+      }
+      return left;
+    }
+
+    int parse_equality() {
+      int left = this->parse_relational();
+      while ( true ) {
+        Op op;
+        if ( this->accept("==") ) op = Op::kEqual;
+        else if ( this->accept("!=") ) op = Op::kNotEqual;
+        else break;
+        int right = this->parse_relational();
+        left = prog_.add_node( op, left, right );
+      }
+      return left;
+    }
+
+    int parse_relational() {
+      int left = this->parse_additive();
+      while ( true ) {
+        Op op;
+        if ( this->accept("<=") ) op = Op::kLessEqual;
+        else if ( this->accept(">=") ) op = Op::kGreaterEqual;
+        else if ( this->accept("<") ) op = Op::kLess;
+        else if ( this->accept(">") ) op = Op::kGreater;
+        else break;
+        int right = this->parse_additive();
+        left = prog_.add_node( op, left, right );
+      }
+      return left;
+    }
+
+    int parse_additive() {
+      int left = this->parse_multiplicative();
+      while ( true ) {
+        Op op;
+        if ( this->accept("+") ) op = Op::kAdd;
+        else if ( this->accept("-") ) op = Op::kSubtract;
+        else break;
+        int right = this->parse_multiplicative();
+        left = prog_.add_node( op, left, right );
+      }
+      return left;
+    }
+
+    int parse_multiplicative() {
+      int left = this->parse_unary();
+      while ( true ) {
+        Op op;
+        if ( this->accept("*") ) op = Op::kMultiply;
+        else if ( this->accept("/") ) op = Op::kDivide;
+        else if ( this->accept("%") ) op = Op::kModulo;
+        else break;
+        int right = this->parse_unary();
+        left = prog_.add_node( op, left, right );
+      }
+      return left;
+    }
+
+    int parse_unary() {
+      if ( this->accept("!") ) {
+        int operand = this->parse_unary();
+        return prog_.add_node( Op::kNot, operand, -1 );
+      }
+      else if ( this->accept("-") ) {
+        int operand = this->parse_unary();
+        // Fold negative numerical constants like "-0.5" right away
+        const auto& node = prog_.nodes_.at( operand );
+        if ( node.op_ == Op::kConstant ) {
+          return prog_.add_node( Op::kConstant, -1, -1, -node.value_ );
+        }
+        return prog_.add_node( Op::kNegate, operand, -1 );
+      }
+      else if ( this->accept("+") ) {
+        return this->parse_unary();
+      }
+      return this->parse_primary();
+    }
+
+    int parse_primary() {
+      this->skip_whitespace();
+      char c = this->peek();
+
+      if ( c == '(' ) {
+        ++pos_;
+        int result = this->parse_or();
+        this->expect( ')' );
+        return result;
+      }
+
+      if ( std::isdigit(static_cast<unsigned char>(c))
+        || ( c == '.' && std::isdigit(static_cast<unsigned char>(
+        this->peek(1u))) ) )
+      {
+        const char* begin = expr_.c_str() + pos_;
+        char* end = nullptr;
+        double value = std::strtod( begin, &end );
+        if ( end == begin ) this->fail();
+
+        // Hexadecimal constants are left to TTreeFormula
+        std::string number( begin, static_cast<const char*>(end) );
+        if ( number.find_first_of("xX") != std::string::npos ) this->fail();
+        pos_ += static_cast< size_t >( end - begin );
+        return prog_.add_node( Op::kConstant, -1, -1, value );
+      }
+
+      if ( is_identifier_start(c) ) return this->parse_name();
+
+      this->fail();
+    }
+
+    // Handles a branch name, possibly followed by member accesses, function
+    // call arguments, or array subscripts
+    int parse_name() {
+      size_t start = pos_;
+      this->scan_identifier();
+
+      // Allow for namespace qualifiers (e.g., TMath::Abs)
+      while ( this->peek() == ':' && this->peek(1u) == ':' ) {
+        pos_ += 2u;
+        this->scan_identifier();
+      }
+
+      std::string name = expr_.substr( start, pos_ - start );
+
+      // Look past any whitespace for a postfix expression
+      size_t name_end = pos_;
+      this->skip_whitespace();
+      char next = this->peek();
+      bool is_postfix = ( next == '(' || next == '[' || ( next == '.'
+        && is_identifier_start(this->peek(1u)) ) );
+
+      if ( !is_postfix ) {
+        pos_ = name_end;
+        int leaf = prog_.leaf_node( name );
+        if ( leaf >= 0 ) return leaf;
+        return prog_.formula_node( name );
+      }
+
+      // Consume the whole postfix chain and hand its text to a TTreeFormula
+      while ( true ) {
+        this->skip_whitespace();
+        next = this->peek();
+        if ( next == '(' ) this->skip_balanced( '(', ')' );
+        else if ( next == '[' ) this->skip_balanced( '[', ']' );
+        else if ( next == '.' && is_identifier_start(this->peek(1u)) ) {
+          ++pos_;
+          this->scan_identifier();
+        }
+        else break;
+      }
+
+      return prog_.formula_node( expr_.substr(start, pos_ - start) );
+    }
+
+    void scan_identifier() {
+      if ( !is_identifier_start(this->peek()) ) this->fail();
+      while ( is_identifier_char(this->peek()) ) ++pos_;
+    }
+
+    void skip_balanced( char open, char close ) {
+      int depth = 0;
+      do {
+        char c = this->peek();
+        if ( c == '\0' ) this->fail();
+        if ( c == open ) ++depth;
+        else if ( c == close ) --depth;
+        ++pos_;
+      } while ( depth > 0 );
+    }
+
+    CutProgram& prog_;
+    const std::string& expr_;
+    size_t pos_ = 0u;
+};
+
+CutProgram::CutProgram( const std::vector<std::string>& cuts, TTree& tree,
+  const std::string& formula_name_prefix, bool use_fallbacks )
+  : tree_( &tree ), prefix_( formula_name_prefix ), num_cuts_( cuts.size() )
+{
+  for ( size_t c = 0u; c < num_cuts_; ++c ) {
+    const std::string& cut = cuts.at( c );
+
+    size_t num_nodes = nodes_.size();
+    size_t num_leaves = leaves_.size();
+    size_t num_formulas = formulas_.size();
+
+    int root = -1;
+    try {
+      Parser parser( *this, cut );
+      root = parser.parse();
+    }
+    catch ( const std::runtime_error& ) {
+      // Remove any nodes created before the failure so that they are never
+      // notified or asked for their branches
+      this->truncate( num_nodes, num_leaves, num_formulas );
+      root = -1;
+    }
+
+    roots_.push_back( root );
+
+    if ( root >= 0 ) {
+      ++num_compiled_;
+      fallbacks_.emplace_back( nullptr );
+      continue;
+    }
+
+    if ( !use_fallbacks ) {
+      fallbacks_.emplace_back( nullptr );
+      continue;
+    }
+
+    std::string formula_name = prefix_ + std::to_string( c );
+    auto formula = std::make_unique< TTreeFormula >( formula_name.c_str(),
+      cut.c_str(), tree_ );
+    formula->SetQuickLoad( true );
+    fallbacks_.emplace_back( std::move(formula) );
+  }
+
+  values_.assign( nodes_.size(), 0. );
+  stamps_.assign( nodes_.size(), 0u );
+}
+
+int CutProgram::add_node( Op op, int left, int right, double value,
+  size_t slot )
+{
+  auto key = std::make_tuple( static_cast<int>(op), left, right, value, slot );
+  auto iter = node_index_.find( key );
+  if ( iter != node_index_.end() ) return iter->second;
+
+  int index = static_cast< int >( nodes_.size() );
+  nodes_.push_back( Node{ op, left, right, value, slot } );
+  node_index_[ key ] = index;
+  return index;
+}
+
+int CutProgram::leaf_node( const std::string& name ) {
+  auto iter = leaf_node_index_.find( name );
+  if ( iter != leaf_node_index_.end() ) return iter->second;
+
+  // Only simple numerical branches holding a single value are read directly.
+  // Everything else is left to TTreeFormula.
+  TLeaf* leaf = tree_->GetLeaf( name.c_str() );
+  if ( !leaf || leaf->GetLeafCount() || leaf->GetLen() != 1 ) return -1;
+  if ( !NUMERIC_LEAF_TYPES.count(leaf->GetTypeName()) ) return -1;
+
+  size_t slot = leaves_.size();
+  leaf_names_.push_back( name );
+  leaves_.push_back( leaf );
+
+  int index = this->add_node( Op::kLeaf, -1, -1, 0., slot );
+  leaf_node_index_[ name ] = index;
+  return index;
+}
+
+int CutProgram::formula_node( const std::string& expr ) {
+  auto iter = formula_node_index_.find( expr );
+  if ( iter != formula_node_index_.end() ) return iter->second;
+
+  std::string formula_name = prefix_ + "sub_"
+    + std::to_string( formulas_.size() );
+  auto formula = std::make_unique< TTreeFormula >( formula_name.c_str(),
+    expr.c_str(), tree_ );
+
+  // Expressions that fail to compile or that may have more than one value
+  // per entry (i.e., that involve arrays) would change the meaning of the
+  // enclosing cut. Reject them so that a full TTreeFormula is used instead.
+  if ( formula->GetNdim() == 0 || formula->GetMultiplicity() != 0 ) {
+    throw std::runtime_error( "Cannot share TTreeFormula for expression "
+      + expr );
+  }
+
+  formula->SetQuickLoad( true );
+
+  size_t slot = formulas_.size();
+  formulas_.emplace_back( std::move(formula) );
+
+  int index = this->add_node( Op::kFormula, -1, -1, 0., slot );
+  formula_node_index_[ expr ] = index;
+  return index;
+}
+
+void CutProgram::truncate( size_t num_nodes, size_t num_leaves,
+  size_t num_formulas )
+{
+  nodes_.resize( num_nodes );
+  leaf_names_.resize( num_leaves );
+  leaves_.resize( num_leaves );
+  formulas_.resize( num_formulas );
+
+  // Every map entry refers to a node, so the removed ones are exactly those
+  // with a node index past the new end of the graph
+  auto erase_removed = [ num_nodes ]( auto& index_map ) {
+    for ( auto iter = index_map.begin(); iter != index_map.end(); ) {
+      if ( iter->second >= static_cast<int>(num_nodes) ) {
+        iter = index_map.erase( iter );
+      }
+      else ++iter;
+    }
+  };
+
+  erase_removed( node_index_ );
+  erase_removed( leaf_node_index_ );
+  erase_removed( formula_node_index_ );
+}
+
+void CutProgram::notify() {
+  for ( size_t l = 0u; l < leaves_.size(); ++l ) {
+    const auto& name = leaf_names_.at( l );
+    TLeaf* leaf = tree_->GetLeaf( name.c_str() );
+    if ( !leaf ) throw std::runtime_error( "Missing TTree leaf " + name );
+    leaves_.at( l ) = leaf;
+  }
+
+  for ( auto& formula : formulas_ ) formula->Notify();
+  for ( auto& formula : fallbacks_ ) {
+    if ( formula ) formula->Notify();
+  }
+}
+
+void CutProgram::add_used_branches( std::set<std::string>& branch_names )
+  const
+{
+  for ( auto* leaf : leaves_ ) add_leaf_branch( leaf, branch_names );
+
+  for ( const auto& formula : formulas_ ) {
+    add_formula_branches( *formula, branch_names );
+  }
+
+  for ( const auto& formula : fallbacks_ ) {
+    if ( formula ) add_formula_branches( *formula, branch_names );
+  }
+}
+
+double CutProgram::eval( int n ) {
+  if ( stamps_[n] == epoch_ ) return values_[n];
+
+  const Node& node = nodes_[ n ];
+  double result = 0.;
+
+  // The logical operators short-circuit. This is safe since evaluating a
+  // node has no side effects.
+  switch ( node.op_ ) {
+    case Op::kConstant:
+      result = node.value_;
+      break;
+    case Op::kLeaf:
+      result = leaves_[ node.slot_ ]->GetValue( 0 );
+      break;
+    case Op::kFormula: {
+      auto& formula = formulas_[ node.slot_ ];
+      formula->GetNdata();
+      result = formula->EvalInstance( 0 );
+      break;
+    }
+    case Op::kNot:
+      result = !this->eval( node.left_ );
+      break;
+    case Op::kNegate:
+      result = -this->eval( node.left_ );
+      break;
+    case Op::kAnd:
+      result = this->eval( node.left_ ) && this->eval( node.right_ );
+      break;
+    case Op::kOr:
+      result = this->eval( node.left_ ) || this->eval( node.right_ );
+      break;
+    case Op::kEqual:
+      result = this->eval( node.left_ ) == this->eval( node.right_ );
+      break;
+    case Op::kNotEqual:
+      result = this->eval( node.left_ ) != this->eval( node.right_ );
+      break;
+    case Op::kLess:
+      result = this->eval( node.left_ ) < this->eval( node.right_ );
+      break;
+    case Op::kLessEqual:
+      result = this->eval( node.left_ ) <= this->eval( node.right_ );
+      break;
+    case Op::kGreater:
+      result = this->eval( node.left_ ) > this->eval( node.right_ );
+      break;
+    case Op::kGreaterEqual:
+      result = this->eval( node.left_ ) >= this->eval( node.right_ );
+      break;
+    case Op::kAdd:
+      result = this->eval( node.left_ ) + this->eval( node.right_ );
+      break;
+    case Op::kSubtract:
+      result = this->eval( node.left_ ) - this->eval( node.right_ );
+      break;
+    case Op::kMultiply:
+      result = this->eval( node.left_ ) * this->eval( node.right_ );
+      break;
+    case Op::kDivide: {
+      // Follow the TTreeFormula convention for division by zero
+      double denom = this->eval( node.right_ );
+      if ( denom == 0. ) result = 0.;
+      else result = this->eval( node.left_ ) / denom;
+      break;
+    }
+    case Op::kModulo: {
+      // TTreeFormula converts the operands to integers for the modulus
+      long long num = static_cast< long long >( this->eval(node.left_) );
+      long long denom = static_cast< long long >( this->eval(node.right_) );
+      if ( denom == 0 ) result = 0.;
+      else result = static_cast< double >( num % denom );
+      break;
+    }
+  }
+
+  values_[ n ] = result;
+  stamps_[ n ] = epoch_;
+  return result;
+}
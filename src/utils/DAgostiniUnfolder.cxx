@@ -1,12 +1,21 @@
 // Standard library includes
+#include <algorithm>
 #include <cfloat>
 #include <iostream>
+#include <vector>
 
 // ROOT includes
 #include "TVectorD.h"
 
 // XSecAnalyzer includes
 #include "XSecAnalyzer/DAgostiniUnfolder.hh"
+#include "XSecAnalyzer/ThreadUtils.hh"
+
+namespace {
+  // Number of column chunks per worker thread used when updating the 3D
+  // tensor for propagating the MC statistical uncertainties
+  constexpr size_t MC_TASKS_PER_THREAD = 4u;
+}
 
 UnfoldedMeasurement DAgostiniUnfolder::unfold( const TMatrixD& data_signal,
   const TMatrixD& data_covmat, const TMatrixD& smearcept,
@@ -53,25 +62,28 @@ UnfoldedMeasurement DAgostiniUnfolder::unfold( const TMatrixD& data_signal,
   err_prop_mat->Zero(); // Zero out the elements (just in case)
 
   // We need a 3D tensor to do the propagation of MC uncertainties. It is
-  // convenient in this case to represent it as a vector of TMatrixD objects.
-  auto err_prop_mc_vec = std::vector< TMatrixD >();
+  // convenient in this case to represent it as a single TMatrixD. Its rows
+  // correspond to the true signal bins used to report the unfolded
+  // measurement. Its columns correspond to the elements of the smearceptance
+  // matrix, with the element for reco bin r and true bin t2 stored in column
+  // r * num_true_signal_bins + t2.
+  int num_mc_cols = num_ordinary_reco_bins * num_true_signal_bins;
+  TMatrixD err_prop_mc;
 
   // Only populate the 3D tensor if it is needed (i.e., because we're including
   // the MC uncertainties on the final result)
   if ( include_respmat_covariance_ ) {
-    for ( int s = 0; s < num_true_signal_bins; ++s ) {
-      // Using emplace_back() here returns a reference to the new vector
-      // element. We will use it below to explicitly zero out the matrix
-      // contents (just in case). Use the same matrix element indexing scheme
-      // as the smearceptance matrix (i.e., rows are ordinary reco bins,
-      // columns are true signal bins).
-      auto& mat_ref = err_prop_mc_vec.emplace_back( num_ordinary_reco_bins,
-        num_true_signal_bins );
-
-      mat_ref.Zero();
-    }
+    err_prop_mc.ResizeTo( num_true_signal_bins, num_mc_cols );
+    err_prop_mc.Zero();
   }
 
+  // Splits the columns of the 3D tensor into chunks that may be processed
+  // independently by the worker threads
+  size_t num_threads = this->worker_threads();
+  size_t num_mc_tasks = std::min( static_cast< size_t >(num_mc_cols),
+    num_threads * MC_TASKS_PER_THREAD );
+  if ( num_mc_tasks == 0u ) num_mc_tasks = 1u;
+
   // Start the iterations for the D'Agostini method
   int it = 0;
   double fm = DBL_MAX;
@@ -179,59 +191,83 @@ UnfoldedMeasurement DAgostiniUnfolder::unfold( const TMatrixD& data_signal,
     // Also update the 3D tensor needed to propagate the MC statistical
     // uncertainties on the smearceptance matrix through the unfolding
     // procedure. As was done for the other error propagation matrix above,
-    // first make a full copy of the tensor, then update the original.
-    auto old_err_prop_mc_vec = std::vector< TMatrixD >();
-
-    // Only update the 3D tensor if it is needed (i.e., because we're including
-    // the MC uncertainties on the final result)
+    // first make a full copy of the tensor, then update the original. Only
+    // do this if it is needed (i.e., because we're including the MC
+    // uncertainties on the final result).
     if ( include_respmat_covariance_ ) {
 
-      for ( int s = 0; s < num_true_signal_bins; ++s ) {
-        old_err_prop_mc_vec.emplace_back( err_prop_mc_vec.at(s) );
-      }
+      TMatrixD old_err_prop_mc( err_prop_mc );
 
-      // The outer loop over true signal bins runs over the bins used to report
-      // the unfolded measurement. The inner loops run over the elements of the
-      // smearceptance matrix.
+      // The last term of the update involves a sum over t3 and r2. The sum
+      // over r2 doesn't depend on the element (r, t2) being updated, so do it
+      // once here. The remaining sum over t3 is then a matrix product of these
+      // coefficients with the old tensor.
+      TMatrixD last_term_coeffs( num_true_signal_bins, num_true_signal_bins );
       for ( int t = 0; t < num_true_signal_bins; ++t ) {
-        for ( int r = 0; r < num_ordinary_reco_bins; ++r ) {
-          for ( int t2 = 0; t2 < num_true_signal_bins; ++t2 ) {
+        for ( int t3 = 0; t3 < num_true_signal_bins; ++t3 ) {
+          double coeff = 0.;
+          for ( int r2 = 0; r2 < num_ordinary_reco_bins; ++r2 ) {
+            coeff += data_signal( r2, 0 ) * unfold_mat->operator()( t3, r2 )
+              * unfold_mat->operator()( t, r2 );
+          }
+          last_term_coeffs( t, t3 ) = coeff * eff_vec( t3, 0 )
+            / old_true_signal( t3, 0 );
+        }
+      }
+
+      const double* old_mc = old_err_prop_mc.GetMatrixArray();
+      double* new_mc = err_prop_mc.GetMatrixArray();
+
+      // Each task updates a separate range of columns in every row of the
+      // tensor. The outer loop over true signal bins runs over the bins used
+      // to report the unfolded measurement.
+      parallel_for( num_mc_tasks, num_threads, [ & ]( size_t task ) {
+        int first_col = task * num_mc_cols / num_mc_tasks;
+        int last_col = ( task + 1u ) * num_mc_cols / num_mc_tasks;
+
+        for ( int t = 0; t < num_true_signal_bins; ++t ) {
+          double* new_row = new_mc + t * num_mc_cols;
+          const double* old_row_t = old_mc + t * num_mc_cols;
+
+          double ts = true_signal->operator()( t, 0 );
+          double ots = old_true_signal( t, 0 );
+
+          double scale = ts / ots;
+          for ( int c = first_col; c < last_col; ++c ) {
+            new_row[ c ] = scale * old_row_t[ c ];
+          }
+
+          // We account for the overall minus sign on the last term by
+          // subtracting here
+          for ( int t3 = 0; t3 < num_true_signal_bins; ++t3 ) {
+            double coeff = last_term_coeffs( t, t3 );
+            const double* old_row = old_mc + t3 * num_mc_cols;
+            for ( int c = first_col; c < last_col; ++c ) {
+              new_row[ c ] -= coeff * old_row[ c ];
+            }
+          }
+
+          // Add the terms that do not involve the old tensor
+          for ( int c = first_col; c < last_col; ++c ) {
+            int r = c / num_true_signal_bins;
+            int t2 = c % num_true_signal_bins;
+
             // Handle the Kronecker delta in the first term using an if
             // statement
             double temp_el = 0.;
             if ( t == t2 ) {
-              double aux1 = ( data_signal(r, 0) * old_true_signal(t, 0)
-                / reco_expected(r, 0) ) - true_signal->operator()( t, 0 );
+              double aux1 = ( data_signal(r, 0) * ots / reco_expected(r, 0) )
+                - ts;
               temp_el += aux1 / eff_vec( t, 0 );
             }
 
             temp_el -= data_signal( r, 0 ) * old_true_signal( t2, 0 )
               * unfold_mat->operator()( t, r ) / reco_expected( r, 0 );
 
-            temp_el += true_signal->operator()( t, 0 )
-              * old_err_prop_mc_vec.at( t )( r, t2 ) / old_true_signal( t, 0 );
-
-            // These for loops take care of the sum in the last term
-            double last_term = 0.;
-            for ( int t3 = 0; t3 < num_true_signal_bins; ++t3 ) {
-              for ( int r2 = 0; r2 < num_ordinary_reco_bins; ++r2 ) {
-                last_term += data_signal( r2, 0 ) * eff_vec( t3, 0 )
-                  * unfold_mat->operator()( t3, r2 )
-                  * unfold_mat->operator()( t, r2 )
-                  * old_err_prop_mc_vec.at( t3 )( r, t2 )
-                  / old_true_signal( t3, 0 );
-              }
-            }
-
-            // We account for the overall minus sign on the last term by
-            // subtracting on the line below
-            temp_el -= last_term;
-
-            // We're ready. Update the MC error propagation matrix.
-            err_prop_mc_vec.at( t )( r, t2 ) = temp_el;
+            new_row[ c ] += temp_el;
           }
         }
-      }
+      } );
 
     }
 
@@ -270,57 +306,71 @@ UnfoldedMeasurement DAgostiniUnfolder::unfold( const TMatrixD& data_signal,
 
     // Here we also calculate a contribution to the covariance matrix on the
     // unfolded result that comes from the MC statistical uncertainty on the
-    // smearceptance matrix elements
+    // smearceptance matrix elements. We assume independent multinomial
+    // distributions for each true bin t3 (as D'Agostini does), so the
+    // covariance of smearceptance matrix elements (r, t3) and (r2, t3) is
+    //
+    //   ( delta(r, r2) * S(r, t3) - S(r, t3) * S(r2, t3) ) / prior(t3)
+    //
+    // Contracting this with the 3D tensor on both sides therefore splits into
+    // a weighted product of the tensor with itself minus a product of its
+    // projections onto the smearceptance matrix columns.
+    // TODO: Account for effective statistics when using weighted events
+    // TODO: Account for situations in which the prior differs from the true
+    // event counts used to compute the smearceptance matrix elements
     TMatrixD mc_covmat( num_true_signal_bins, num_true_signal_bins );
 
-    for ( int t = 0; t < num_true_signal_bins; ++t ) {
+    // Weights for the first term, indexed in the same way as the tensor
+    // columns. True bins with a non-positive prior are skipped.
+    std::vector< double > col_weights( num_mc_cols, 0. );
 
-      const TMatrixD& prop_mat1 = err_prop_mc_vec.at( t );
+    // Projections of the tensor onto the smearceptance matrix columns
+    TMatrixD proj( num_true_signal_bins, num_true_signal_bins );
 
-      for ( int t2 = 0; t2 < num_true_signal_bins; ++t2 ) {
+    const double* prop = err_prop_mc.GetMatrixArray();
+    for ( int t3 = 0; t3 < num_true_signal_bins; ++t3 ) {
+      double prior_sig = prior_true_signal( t3, 0 );
+      if ( prior_sig > 0. ) {
+        for ( int r = 0; r < num_ordinary_reco_bins; ++r ) {
+          col_weights[ r * num_true_signal_bins + t3 ]
+            = smearcept( r, t3 ) / prior_sig;
+        }
+      }
+
+      for ( int t = 0; t < num_true_signal_bins; ++t ) {
+        double proj_elem = 0.;
+        for ( int r = 0; r < num_ordinary_reco_bins; ++r ) {
+          proj_elem += prop[ t * num_mc_cols + r * num_true_signal_bins + t3 ]
+            * smearcept( r, t3 );
+        }
+        proj( t, t3 ) = proj_elem;
+      }
+    }
 
-        const TMatrixD& prop_mat2 = err_prop_mc_vec.at( t2 );
+    // The result is symmetric, so each task computes one row of the upper
+    // triangle and then copies it to the lower one
+    parallel_for( num_true_signal_bins, num_threads, [ & ]( size_t task ) {
+      int t = task;
+      const double* row1 = prop + t * num_mc_cols;
+
+      for ( int t2 = t; t2 < num_true_signal_bins; ++t2 ) {
+        const double* row2 = prop + t2 * num_mc_cols;
 
         double temp_elem = 0.;
+        for ( int c = 0; c < num_mc_cols; ++c ) {
+          temp_elem += row1[ c ] * col_weights[ c ] * row2[ c ];
+        }
 
         for ( int t3 = 0; t3 < num_true_signal_bins; ++t3 ) {
-
           double prior_sig = prior_true_signal( t3, 0 );
           if ( prior_sig <= 0. ) continue;
-
-          for ( int r = 0; r < num_ordinary_reco_bins; ++r ) {
-
-            double smear1 = smearcept( r, t3 );
-
-            for ( int r2 = 0; r2 < num_ordinary_reco_bins; ++r2 ) {
-
-              double smear2 = smearcept( r2, t3 );
-
-              // Calculate the covariance matrix element for the smearceptance
-              // matrix elements. Assume independent multinomial distributions
-              // for each true bin (as D'Agostini does)
-              double covariance = 0.;
-              // TODO: Account for effective statistics when using
-              // weighted events
-              // TODO: Account for situations in which the prior
-              // differs from the true event counts used to compute
-              // the smearceptance matrix elements
-              if ( r == r2 ) {
-                covariance = smear1 * ( 1. - smear1 ) / prior_sig;
-              }
-              else {
-                covariance = -1. * smear1 * smear2 / prior_sig;
-              }
-
-              temp_elem += prop_mat1( r, t3 ) * covariance
-                * prop_mat2( r2, t3 );
-            }
-          }
+          temp_elem -= proj( t, t3 ) * proj( t2, t3 ) / prior_sig;
         }
 
         mc_covmat( t, t2 ) = temp_elem;
+        mc_covmat( t2, t ) = temp_elem;
       }
-    }
+    } );
 
     // Add the MC statistical uncertainty to the other uncertainties to obtain
     // the final covariance matrix on the unfolded measurement
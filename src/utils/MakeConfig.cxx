@@ -171,6 +171,20 @@ void MakeConfig::Print(){
   std::vector< TrueBin > true_bins;
   std::vector< RecoBin > reco_bins;
 
+  // Interval tables for the bins defined using blocks. These allow
+  // UniverseMaker to find the bin for each event using a binary search.
+  std::vector< BinEdgeRecord > true_bin_edges;
+  std::vector< BinEdgeRecord > reco_bin_edges;
+  auto add_edges = []( std::vector<BinEdgeRecord>& edges, size_t bin_index,
+    Block* block, const std::vector<BinInterval>& intervals )
+  {
+    BinEdgeRecord rec;
+    rec.bin_index_ = bin_index;
+    rec.selection_ = block->GetSelection();
+    rec.intervals_ = intervals;
+    edges.push_back( rec );
+  };
+
 
   for(int i = 0; i < vect_block->size(); i++){
 
@@ -189,11 +203,17 @@ void MakeConfig::Print(){
 
       for(int j = 0; j < vect_block->at(i).block_true_->GetNBinsX(); j++){
         slice.bin_map_[ j + 1 ].insert( true_bins.size() );
+        add_edges( true_bin_edges, true_bins.size(),
+          vect_block->at(i).block_true_,
+          vect_block->at(i).block_true_->GetBinIntervals(j) );
         true_bins.emplace_back( vect_block->at(i).block_true_->GetBinDef(j),
           TrueBinType(vect_block->at(i).block_true_->GetBinType()), i );
 
       }
       for(int j = 0; j < vect_block->at(i).block_reco_->GetNBinsX(); j++){
+        add_edges( reco_bin_edges, reco_bins.size(),
+          vect_block->at(i).block_reco_,
+          vect_block->at(i).block_reco_->GetBinIntervals(j) );
         reco_bins.emplace_back( vect_block->at(i).block_reco_->GetBinDef(j),
           RecoBinType(vect_block->at(i).block_reco_->GetBinType()), i );
       }
@@ -222,6 +242,12 @@ void MakeConfig::Print(){
             yvar_idx, xvar_idx, xlow, xhigh );
         for( int k = 0; k < vect_block->at(i).block_true_->GetNBinsY(j); k++ ){
           slice.bin_map_[ k + 1 ].insert( true_bins.size() );
+          add_edges( true_bin_edges, true_bins.size(),
+            vect_block->at(i).block_true_,
+            vect_block->at(i).block_true_->GetBinIntervals(j, k) );
+          add_edges( reco_bin_edges, reco_bins.size(),
+            vect_block->at(i).block_reco_,
+            vect_block->at(i).block_reco_->GetBinIntervals(j, k) );
           true_bins.emplace_back(vect_block->at(i).block_true_->GetBinDef(j, k),
             TrueBinType(vect_block->at(i).block_true_->GetBinType()), i );
           reco_bins.emplace_back(vect_block->at(i).block_reco_->GetBinDef(j, k),
@@ -259,6 +285,12 @@ void MakeConfig::Print(){
             zvar_idx, yvar_idx, ylow, yhigh );
         for( int l = 0; l < vect_block->at(i).block_true_->GetNBinsZ(j, k); l++ ){
           slice.bin_map_[ l + 1 ].insert( true_bins.size() );
+          add_edges( true_bin_edges, true_bins.size(),
+            vect_block->at(i).block_true_,
+            vect_block->at(i).block_true_->GetBinIntervals(j, k, l) );
+          add_edges( reco_bin_edges, reco_bins.size(),
+            vect_block->at(i).block_reco_,
+            vect_block->at(i).block_reco_->GetBinIntervals(j, k, l) );
           true_bins.emplace_back(vect_block->at(i).block_true_->GetBinDef(j, k, l),
               TrueBinType(vect_block->at(i).block_true_->GetBinType()), i );
           reco_bins.emplace_back(vect_block->at(i).block_reco_->GetBinDef(j, k, l),
@@ -317,6 +349,9 @@ void MakeConfig::Print(){
       int sideband_bin_index = 0;
       for(int j = 0; j < vect_sideband->at(i).block_reco_->GetNBinsX(); j++){
         bin_sideband_slice.bin_map_[ ++sideband_bin_index ].insert( reco_bins.size() );
+        add_edges( reco_bin_edges, reco_bins.size(),
+          vect_sideband->at(i).block_reco_,
+          vect_sideband->at(i).block_reco_->GetBinIntervals(j) );
         reco_bins.emplace_back( vect_sideband->at(i).block_reco_->GetBinDef(j),
             RecoBinType(vect_sideband->at(i).block_reco_->GetBinType()), -1 );
       }
@@ -332,6 +367,9 @@ void MakeConfig::Print(){
             yvar_idx, xvar_idx, xlow, xhigh );
         for( int k = 0; k < vect_sideband->at(i).block_reco_->GetNBinsY(j); k++ ){
           slice.bin_map_[ k + 1 ].insert( reco_bins.size() );
+          add_edges( reco_bin_edges, reco_bins.size(),
+            vect_sideband->at(i).block_reco_,
+            vect_sideband->at(i).block_reco_->GetBinIntervals(j, k) );
           reco_bins.emplace_back(vect_sideband->at(i).block_reco_->GetBinDef(j, k),
               RecoBinType(vect_sideband->at(i).block_reco_->GetBinType()), -1 );
         }
@@ -362,6 +400,12 @@ void MakeConfig::Print(){
 
   out_file << reco_bins.size() << '\n';
   for ( const auto& rb : reco_bins ) out_file << rb << '\n';
+
+  out_file << BIN_EDGE_TABLE_KEYWORD << '\n';
+  out_file << true_bin_edges.size() << '\n';
+  for ( const auto& be : true_bin_edges ) out_file << be << '\n';
+  out_file << reco_bin_edges.size() << '\n';
+  for ( const auto& be : reco_bin_edges ) out_file << be << '\n';
   out_file.close();
 
   std::string slice_config_output = std::getenv( "XSEC_ANALYZER_DIR" )
@@ -705,13 +749,12 @@ void MakeConfig::make_res_plots( std::istream& in_stream,
   }
 
   std::cout << universe_key << " : " << universe_index << '\n';
-  // Get access to the Universe object that stores the histograms of summed MC
+  // Build the Universe object that stores the histograms of summed MC
   // event weights that we need
-  const auto& universe = um.universe_map().at( universe_key )
-    .at( universe_index );
+  auto universe = um.make_universe( universe_key, universe_index );
 
   TH2D* smear_hist = dynamic_cast< TH2D* >(
-      universe.hist_2d_->Clone("smear_hist") );
+      universe->hist_2d_->Clone("smear_hist") );
 
   // TODO: also reduce code duplication here
 
@@ -873,6 +916,13 @@ void MakeConfig::make_res_plots( std::istream& in_stream,
 
 
 
+// Returns the value of a bin edge as it appears in a bin definition written
+// using the "%.3f" format. Storing the edges in this form ensures that the bin
+// edge table gives exactly the same results as the bin definition strings.
+double printed_bin_edge( double edge ) {
+  return std::stod( Form("%.3f", edge) );
+}
+
 void Block1D::Init(){
   this->SetTitle( fTitle );
   this->SetName( fName );
@@ -887,6 +937,8 @@ void Block1D::Init(){
     }
     bin_def += xName + Form(" >= %.3f && ", low) + xName + Form(" < %.3f", high);
     binDef.push_back( bin_def );
+    binIntervals.push_back( { BinInterval( xName, printed_bin_edge(low),
+      printed_bin_edge(high) ) } );
   }
 }
 
@@ -1029,6 +1081,8 @@ void Block2D::Init(){
       if ( fselection.size() != 0 ) {
         bin_def = fselection + " && ";
       }
+      std::vector<BinInterval> intervals = { BinInterval( xName,
+        printed_bin_edge(slice_low), printed_bin_edge(slice_high) ) };
       if(iter->second.size() == 2 && bin_low == -DBL_MAX && bin_high == DBL_MAX){
         bin_def += xName + Form(" >= %.3f && ", slice_low)
           + xName + Form(" < %.3f", slice_high);
@@ -1038,8 +1092,11 @@ void Block2D::Init(){
         bin_def += xName + Form(" >= %.3f && ", slice_low)
           + xName + Form(" < %.3f && ", slice_high) + yName
           + Form(" >= %.3f && ", bin_low) + yName + Form(" < %.3f", bin_high);
+        intervals.emplace_back( yName, printed_bin_edge(bin_low),
+          printed_bin_edge(bin_high) );
       }
       binDef.push_back( bin_def );
+      binIntervals.push_back( intervals );
     }
   }
 }
@@ -1214,8 +1271,11 @@ void Block3D::Init(){
       double slice_high = next_slice->first;
       // update bin definition
       std::string bin_def1 = bin_def0;
+      std::vector<BinInterval> intervals0 = { BinInterval( xName,
+        printed_bin_edge(block_slice_low), printed_bin_edge(block_slice_high) ) };
       if(slice_low == -DBL_MAX && slice_high == DBL_MAX){
         binDef.push_back(bin_def0);
+        binIntervals.push_back(intervals0);
         std::vector<double> tmp_bin_edges = {0, 1};
         fblock_map_[x_count][y_count] = tmp_bin_edges;
         continue;
@@ -1230,6 +1290,12 @@ void Block3D::Init(){
         std::string bin_def2 = bin_def1;
         bin_def2 += "&&" + zName + Form("  >= %.3f && ", bin_low) + zName + Form(" < %.3f", bin_high);
         binDef.push_back( bin_def2 );
+        std::vector<BinInterval> intervals2 = intervals0;
+        intervals2.emplace_back( yName, printed_bin_edge(slice_low),
+          printed_bin_edge(slice_high) );
+        intervals2.emplace_back( zName, printed_bin_edge(bin_low),
+          printed_bin_edge(bin_high) );
+        binIntervals.push_back( intervals2 );
         //std::cout << "DEBUG : " << __FILE__ << "  " << __LINE__ <<  "  " << bin_def << std::endl;
       }
       y_count++;
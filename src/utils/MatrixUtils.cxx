@@ -6,6 +6,7 @@
 #include <limits>
 #include <memory>
 #include <sstream>
+#include <vector>
 
 // ROOT includes
 #include "TDecompQRH.h"
@@ -16,6 +17,7 @@
 
 // XSecAnalyzer includes
 #include "XSecAnalyzer/MatrixUtils.hh"
+#include "XSecAnalyzer/ThreadUtils.hh"
 
 std::unique_ptr< TMatrixD > invert_matrix( const TMatrixD& mat,
   const double inversion_tolerance )
@@ -282,3 +284,104 @@ TMatrixD direct_sum( const TMatrixD& m1, const TMatrixD& m2 ) {
   std::vector< const TMatrixD* > matrices = { &m1, &m2 };
   return direct_sum( matrices );
 }
+
+std::vector< std::unique_ptr< TMatrixD > > batch_similarity_transform(
+  const TMatrixD& transform, const std::vector< const TMatrixD* >& matrices,
+  size_t num_threads )
+{
+  int num_out = transform.GetNrows();
+  int num_in = transform.GetNcols();
+  size_t num_matrices = matrices.size();
+
+  for ( const auto* mat : matrices ) {
+    if ( mat->GetNrows() != num_in || mat->GetNcols() != num_in ) {
+      throw std::runtime_error( "Dimension mismatch in"
+        " batch_similarity_transform()" );
+    }
+  }
+
+  std::vector< std::unique_ptr< TMatrixD > > results( num_matrices );
+
+  // Split the input matrices into one contiguous group per task. Each task
+  // allocates its packed work matrices once and reuses them for its group.
+  size_t num_tasks = std::min( num_matrices, std::max( num_threads,
+    size_t(1u) ) );
+
+  parallel_for( num_tasks, num_tasks, [ & ]( size_t task ) {
+
+    size_t begin = ( task * num_matrices ) / num_tasks;
+    size_t end = ( ( task + 1u ) * num_matrices ) / num_tasks;
+    int num_group = end - begin;
+
+    // Stack the input matrices vertically so that the products M * A^T
+    // for the whole group come from a single multiplication
+    TMatrixD stacked( num_group * num_in, num_in );
+    double* stacked_data = stacked.GetMatrixArray();
+    int in_size = num_in * num_in;
+    for ( int g = 0; g < num_group; ++g ) {
+      const double* mat_data = matrices.at( begin + g )->GetMatrixArray();
+      std::copy( mat_data, mat_data + in_size, stacked_data + g * in_size );
+    }
+
+    TMatrixD right_prod( stacked, TMatrixD::kMultTranspose, transform );
+
+    // Rearrange the partial products side by side so that multiplying by
+    // A on the left also requires only a single multiplication
+    TMatrixD wide( num_in, num_group * num_out );
+    const double* right_data = right_prod.GetMatrixArray();
+    double* wide_data = wide.GetMatrixArray();
+    int wide_cols = num_group * num_out;
+    for ( int g = 0; g < num_group; ++g ) {
+      for ( int r = 0; r < num_in; ++r ) {
+        const double* src = right_data + ( g * num_in + r ) * num_out;
+        std::copy( src, src + num_out, wide_data + r * wide_cols
+          + g * num_out );
+      }
+    }
+
+    TMatrixD full_prod( transform, TMatrixD::kMult, wide );
+
+    // Unpack the results for each matrix in the group
+    const double* full_data = full_prod.GetMatrixArray();
+    for ( int g = 0; g < num_group; ++g ) {
+      auto result = std::make_unique< TMatrixD >( num_out, num_out );
+      double* result_data = result->GetMatrixArray();
+      for ( int r = 0; r < num_out; ++r ) {
+        const double* src = full_data + r * wide_cols + g * num_out;
+        std::copy( src, src + num_out, result_data + r * num_out );
+      }
+      results.at( begin + g ) = std::move( result );
+    }
+  } );
+
+  return results;
+}
+
+void batch_transform_columns( const TMatrixD& transform,
+  const std::vector< TMatrixD* >& column_vectors )
+{
+  int num_in = transform.GetNcols();
+  int num_vecs = column_vectors.size();
+  if ( num_vecs == 0 ) return;
+
+  // Pack the column vectors into the columns of a single matrix
+  TMatrixD packed( num_in, num_vecs );
+  for ( int v = 0; v < num_vecs; ++v ) {
+    const TMatrixD& vec = *column_vectors.at( v );
+    if ( vec.GetNrows() != num_in || vec.GetNcols() != 1 ) {
+      throw std::runtime_error( "Dimension mismatch in"
+        " batch_transform_columns()" );
+    }
+    for ( int r = 0; r < num_in; ++r ) packed( r, v ) = vec( r, 0 );
+  }
+
+  TMatrixD product( transform, TMatrixD::kMult, packed );
+
+  // Unpack the transformed vectors
+  int num_out = transform.GetNrows();
+  for ( int v = 0; v < num_vecs; ++v ) {
+    TMatrixD& vec = *column_vectors.at( v );
+    vec.ResizeTo( num_out, 1 );
+    for ( int r = 0; r < num_out; ++r ) vec( r, 0 ) = product( r, v );
+  }
+}
@@ -1,24 +1,58 @@
+// Standard library includes
+#include <sstream>
+
+// ROOT includes
+#include "TROOT.h"
+
 // XSecAnalyzer includes
 #include "XSecAnalyzer/SystematicsCalculator.hh"
+#include "XSecAnalyzer/ThreadUtils.hh"
 
 void set_stats_and_dir( Universe& univ ) {
-  univ.hist_reco_->SetStats( false );
-  univ.hist_reco_->SetDirectory( nullptr );
+  for ( size_t k = 0u; k < NUM_UNIVERSE_HIST_KINDS; ++k ) {
+    TH1* hist = univ.hist( static_cast<UniverseHistKind>(k) );
+    if ( !hist ) continue;
+    hist->SetStats( false );
+    hist->SetDirectory( nullptr );
+  }
+}
 
-  univ.hist_true_->SetStats( false );
-  univ.hist_true_->SetDirectory( nullptr );
+// Opens the columnar universe file that matches the universe ROOT file with
+// the given name (if one exists). A null pointer is returned if the file is
+// missing or was made using a different configuration than the universes in
+// root_tdir.
+std::unique_ptr< MappedUniverseFile > open_columnar_universes(
+  const std::string& root_file_name, TDirectoryFile& root_tdir )
+{
+  std::string columnar_file_name = columnar_universe_file_name(
+    root_file_name );
+  if ( !std::ifstream(columnar_file_name).good() ) return nullptr;
 
-  univ.hist_2d_->SetStats( false );
-  univ.hist_2d_->SetDirectory( nullptr );
+  auto columnar_file = std::make_unique< MappedUniverseFile >(
+    columnar_file_name );
+  const auto& metadata = columnar_file->metadata();
 
-  univ.hist_categ_->SetStats( false );
-  univ.hist_categ_->SetDirectory( nullptr );
+  std::string* true_bin_spec = nullptr;
+  std::string* reco_bin_spec = nullptr;
+  root_tdir.GetObject( TRUE_BIN_SPEC_NAME.c_str(), true_bin_spec );
+  root_tdir.GetObject( RECO_BIN_SPEC_NAME.c_str(), reco_bin_spec );
 
-  univ.hist_reco2d_->SetStats( false );
-  univ.hist_reco2d_->SetDirectory( nullptr );
+  bool matches = ( metadata.directory_name_ == root_tdir.GetName()
+    && true_bin_spec && *true_bin_spec == metadata.true_bin_spec_
+    && reco_bin_spec && *reco_bin_spec == metadata.reco_bin_spec_ );
 
-  univ.hist_true2d_->SetStats( false );
-  univ.hist_true2d_->SetDirectory( nullptr );
+  delete true_bin_spec;
+  delete reco_bin_spec;
+
+  if ( !matches ) {
+    std::cout << "Ignoring columnar universe file " << columnar_file_name
+      << " made with a different configuration\n";
+    return nullptr;
+  }
+
+  std::cout << "Reading reweightable universes from " << columnar_file_name
+    << '\n';
+  return columnar_file;
 }
 
 bool has_ending( const std::string& fullString, const std::string& ending ) {
@@ -85,11 +119,13 @@ SystematicsCalculator::SystematicsCalculator(
       << " empty. Using default: " << syst_config_file_name_ << '\n';
   }
 
-  // Open in "update" mode so that we can save POT-summed histograms
-  // for the combination of all analysis ntuples. Otherwise, we won't
-  // write to the file.
-  // TODO: consider adjusting this to be less dangerous
-  TFile in_tfile( input_respmat_file_name.c_str(), "update" );
+  // Open the file read-only at first. It is reopened in "update" mode below
+  // only if POT-summed histograms for the combination of all analysis
+  // ntuples need to be saved. This also ensures that no handle with pending
+  // writes exists while build_universes() reads the file using several
+  // threads.
+  auto in_tfile = std::make_unique< TFile >(
+    input_respmat_file_name.c_str(), "read" );
 
   TDirectoryFile* root_tdir = nullptr;
 
@@ -98,15 +134,15 @@ SystematicsCalculator::SystematicsCalculator(
   // one to use.
   std::string tdf_name = respmat_tdirectoryfile_name;
   if ( tdf_name.empty() ) {
-    tdf_name = in_tfile.GetListOfKeys()->At( 0 )->GetName();
+    tdf_name = in_tfile->GetListOfKeys()->At( 0 )->GetName();
     std::cout << "respmat_tdirectoryfile_name given to SystematicsCalculator"
       << " is empty. Using default: " << tdf_name << '\n';
   }
 
-  in_tfile.GetObject( tdf_name.c_str(), root_tdir );
+  in_tfile->GetObject( tdf_name.c_str(), root_tdir );
   if ( !root_tdir ) {
     std::cerr << "tdf_name.c_str():" << tdf_name.c_str() << '\n';
-    in_tfile.Print();
+    in_tfile->Print();
     throw std::runtime_error( "Invalid root TDirectoryFile!" );
   }
 
@@ -159,8 +195,23 @@ SystematicsCalculator::SystematicsCalculator(
   if ( !total_subdir ) {
 
     // We couldn't find the pre-computed POT-summed universe histograms,
-    // so make them "on the fly" and store them in this object
-    this->build_universes( *root_tdir );
+    // so make them "on the fly" and store them in this object. Use the
+    // matching columnar universe file (if one exists) to speed this up.
+    auto columnar_file = open_columnar_universes( input_respmat_file_name,
+      *root_tdir );
+    this->build_universes( *root_tdir, columnar_file.get() );
+
+    // All of the input histograms have been copied or detached by now, so
+    // the read-only handle may be replaced by a writable one
+    in_tfile = std::make_unique< TFile >( input_respmat_file_name.c_str(),
+      "update" );
+
+    root_tdir = nullptr;
+    in_tfile->GetObject( tdf_name.c_str(), root_tdir );
+    if ( !root_tdir || !in_tfile->IsWritable() ) {
+      throw std::runtime_error( "Could not reopen "
+        + input_respmat_file_name + " to save the POT-summed universes" );
+    }
 
     // Create a new TDirectoryFile as a subfolder to hold the POT-summed
     // universe histograms
@@ -212,67 +263,112 @@ SystematicsCalculator::SystematicsCalculator(
 
 void SystematicsCalculator::load_universes( TDirectoryFile& total_subdir ) {
 
+  // Any cached observables refer to the old Universe objects
+  this->clear_observable_cache();
+
   const auto& fpm = FilePropertiesManager::Instance();
 
-  // TODO: reduce code duplication between this function
-  // and SystematicsCalculator::build_universes()
-  TList* universe_key_list = total_subdir.GetListOfKeys();
-  int num_keys = universe_key_list->GetEntries();
-
-  // Loop over the keys in the TDirectoryFile. Build a universe object
-  // for each key ending in "_2d" and store it in the rw_universes_
-  // map (for reweightable systematic universes), the detvar_universes_
-  // map (for detector systematic universes), or the alt_cv_universes_
-  // map (for alternate CV model universes)
-  for ( int k = 0; k < num_keys; ++k ) {
-    // To avoid double-counting universes, search only for the 2D event
-    // count histograms
-    std::string key = universe_key_list->At( k )->GetName();
-    bool is_not_2d_hist = !has_ending( key, "_2d" );
-    if ( is_not_2d_hist ) continue;
-
-    // Get rid of the trailing "_2d" by deleting the last three
-    // characters from the current key
-    key.erase( key.length() - 3u );
-
-    // The last underscore separates the universe name from its
-    // index. Split the key into these two parts.
-    size_t temp_idx = key.find_last_of( '_' );
-
-    std::string univ_name = key.substr( 0, temp_idx );
-    std::string univ_index_str = key.substr( temp_idx + 1u );
-
-    int univ_index = std::stoi( univ_index_str );
-
-    TH1D* hist_true = nullptr;
-    TH1D* hist_reco = nullptr;
-    TH2D* hist_2d = nullptr;
-    TH2D* hist_categ = nullptr;
-    TH2D* hist_reco2d = nullptr;
-    TH2D* hist_true2d = nullptr;
-
-    total_subdir.GetObject( (key + "_true").c_str(), hist_true );
-    total_subdir.GetObject( (key + "_reco").c_str(), hist_reco );
-    total_subdir.GetObject( (key + "_2d").c_str(), hist_2d );
-    total_subdir.GetObject( (key + "_categ").c_str(), hist_categ );
-    total_subdir.GetObject( (key + "_reco2d").c_str(), hist_reco2d );
-    total_subdir.GetObject( (key + "_true2d").c_str(), hist_true2d );
-
-    if ( !hist_true || !hist_reco || !hist_2d || !hist_categ
-      || !hist_reco2d || !hist_true2d )
-    {
-      throw std::runtime_error( "Failed to retrieve histograms for the "
-        + key + " universe" );
+  // Get the names and indices of all universes stored in the TDirectoryFile.
+  // These are listed in an index object written by save_universes().
+  std::vector< std::pair<std::string, int> > universe_list;
+
+  std::string* universe_index = nullptr;
+  total_subdir.GetObject( UNIVERSE_INDEX_NAME.c_str(), universe_index );
+  if ( universe_index ) {
+    std::istringstream index_iss( *universe_index );
+    std::string univ_name;
+    int univ_index;
+    while ( index_iss >> univ_name >> univ_index ) {
+      universe_list.emplace_back( univ_name, univ_index );
     }
+    delete universe_index;
+  }
+  else {
+    // Older files lack the index. In that case, loop over the keys in the
+    // TDirectoryFile and find the universes via their 2D histograms.
+    TList* universe_key_list = total_subdir.GetListOfKeys();
+    int num_keys = universe_key_list->GetEntries();
+
+    for ( int k = 0; k < num_keys; ++k ) {
+      // To avoid double-counting universes, search only for the 2D event
+      // count histograms
+      std::string key = universe_key_list->At( k )->GetName();
+      bool is_not_2d_hist = !has_ending( key, "_2d" );
+      if ( is_not_2d_hist ) continue;
+
+      // Get rid of the trailing "_2d" by deleting the last three
+      // characters from the current key
+      key.erase( key.length() - 3u );
+
+      // The last underscore separates the universe name from its
+      // index. Split the key into these two parts.
+      size_t temp_idx = key.find_last_of( '_' );
+
+      std::string univ_name = key.substr( 0, temp_idx );
+      std::string univ_index_str = key.substr( temp_idx + 1u );
+
+      int univ_index = std::stoi( univ_index_str );
+      universe_list.emplace_back( univ_name, univ_index );
+    }
+  }
 
-    // Reconstruct the Universe object from the retrieved histograms
-    auto temp_univ = std::make_unique< Universe >( univ_name, univ_index,
-      hist_true, hist_reco, hist_2d, hist_categ, hist_reco2d, hist_true2d );
+  // Remember where the histograms are stored so that the reweightable
+  // universes can be loaded later on demand
+  {
+    std::lock_guard< std::mutex > file_lock( universe_file_mutex_ );
+    universe_files_.clear();
+  }
+
+  {
+    std::lock_guard< std::mutex > lock( universe_load_mutex_ );
+    lazy_universes_.clear();
+
+    // If the TDirectoryFile does not belong to a file on disk, then every
+    // universe will need to be loaded right away
+    TFile* in_file = total_subdir.GetFile();
+    universe_file_name_ = in_file ? in_file->GetName() : "";
+
+    // Strip the file name from the full path to the TDirectoryFile
+    std::string dir_path = total_subdir.GetPath();
+    size_t colon_idx = dir_path.find( ":/" );
+    if ( colon_idx != std::string::npos ) {
+      dir_path = dir_path.substr( colon_idx + 2u );
+    }
+    universe_dir_path_ = dir_path;
+  }
+
+  // Build a universe object for each entry in the list and store it in the
+  // rw_universes_ map (for reweightable systematic universes), the
+  // detvar_universes_ map (for detector systematic universes), or the
+  // alt_cv_universes_ map (for alternate CV model universes)
+  for ( const auto& univ_pair : universe_list ) {
+
+    const std::string& univ_name = univ_pair.first;
+    int univ_index = univ_pair.second;
+
+    auto temp_univ = std::make_unique< Universe >( univ_name, univ_index );
+
+    NFT temp_type = fpm.string_to_ntuple_type( univ_name );
+
+    // The reweightable universes (apart from the CV) are typically only
+    // needed while computing a single covariance matrix, so their histograms
+    // are loaded on demand. All others are loaded right away.
+    bool load_later = ( !universe_file_name_.empty()
+      && temp_type == NFT::kUnknown
+      && univ_name != "FakeDataMC" && univ_name != CV_UNIV_NAME );
+
+    if ( load_later ) {
+      std::lock_guard< std::mutex > lock( universe_load_mutex_ );
+      lazy_universes_[ temp_univ.get() ]
+        = std::make_unique< LazyUniverseState >();
+    }
+    else {
+      this->read_universe_histograms( total_subdir, *temp_univ );
+    }
 
     // Determine whether the current universe represents a detector
     // variation or a reweightable variation. We'll use this information to
     // decide where it should be stored.
-    NFT temp_type = fpm.string_to_ntuple_type( univ_name );
     if ( temp_type != NFT::kUnknown ) {
 
       bool is_detvar = ntuple_type_is_detVar( temp_type );
@@ -332,7 +428,7 @@ void SystematicsCalculator::load_universes( TDirectoryFile& total_subdir ) {
       }
     }
 
-  } // TDirectoryFile keys (and 2D universe histograms)
+  } // universes
 
   constexpr std::array< NFT, 2 > data_file_types = { NFT::kOnBNB,
     NFT::kExtBNB };
@@ -375,7 +471,138 @@ void SystematicsCalculator::load_universes( TDirectoryFile& total_subdir ) {
 
 }
 
-void SystematicsCalculator::build_universes( TDirectoryFile& root_tdir ) {
+void SystematicsCalculator::read_universe_histograms( TDirectory& dir,
+  Universe& univ ) const
+{
+  std::string key = univ.universe_name_ + '_'
+    + std::to_string( univ.index_ );
+
+  TH1D* hist_true = nullptr;
+  TH1D* hist_reco = nullptr;
+  TH2D* hist_2d = nullptr;
+  TH2D* hist_categ = nullptr;
+  TH2D* hist_reco2d = nullptr;
+  TH2D* hist_true2d = nullptr;
+
+  dir.GetObject( (key + "_true").c_str(), hist_true );
+  dir.GetObject( (key + "_reco").c_str(), hist_reco );
+  dir.GetObject( (key + "_2d").c_str(), hist_2d );
+  dir.GetObject( (key + "_categ").c_str(), hist_categ );
+  dir.GetObject( (key + "_reco2d").c_str(), hist_reco2d );
+  dir.GetObject( (key + "_true2d").c_str(), hist_true2d );
+
+  // The reco vs. reco and true vs. true histograms are optional (see
+  // UNIVERSE_HISTS_KEYWORD)
+  if ( !hist_true || !hist_reco || !hist_2d || !hist_categ ) {
+    throw std::runtime_error( "Failed to retrieve histograms for the "
+      + key + " universe" );
+  }
+
+  // The Universe object takes ownership of the retrieved histograms
+  univ.hist_true_.reset( hist_true );
+  univ.hist_reco_.reset( hist_reco );
+  univ.hist_2d_.reset( hist_2d );
+  univ.hist_categ_.reset( hist_categ );
+  univ.hist_reco2d_.reset( hist_reco2d );
+  univ.hist_true2d_.reset( hist_true2d );
+
+  set_stats_and_dir( univ );
+}
+
+void SystematicsCalculator::acquire_universe( const Universe& univ ) const {
+
+  // Hold the lock for the whole map only long enough to find the universe
+  // and register the new user
+  LazyUniverseState* state = nullptr;
+  {
+    std::lock_guard< std::mutex > lock( universe_load_mutex_ );
+
+    auto iter = lazy_universes_.find( &univ );
+    if ( iter == lazy_universes_.end() ) return;
+
+    state = iter->second.get();
+    ++state->use_count_;
+  }
+
+  // The histograms are only unloaded once every user has called
+  // release_universe(), so they cannot disappear while this thread holds a
+  // use count. Threads that need the same universe wait here for the first
+  // one to load it, while other universes may be loaded concurrently.
+  try {
+    std::lock_guard< std::mutex > load_lock( state->load_mutex_ );
+    if ( univ.histograms_loaded() ) return;
+
+    auto file = this->take_universe_file();
+
+    TDirectory* dir = file->GetDirectory( universe_dir_path_.c_str() );
+    if ( !dir ) throw std::runtime_error( "Missing universe directory "
+      + universe_dir_path_ + " in " + universe_file_name_ );
+
+    // The histograms just mirror the contents of the input file, so loading
+    // them does not change the logical state of the Universe object
+    this->read_universe_histograms( *dir, const_cast< Universe& >(univ) );
+
+    this->return_universe_file( std::move(file) );
+  }
+  catch ( ... ) {
+    // A failed load does not leave a user behind
+    this->release_universe( univ );
+    throw;
+  }
+}
+
+void SystematicsCalculator::release_universe( const Universe& univ ) const {
+
+  std::lock_guard< std::mutex > lock( universe_load_mutex_ );
+
+  auto iter = lazy_universes_.find( &univ );
+  if ( iter == lazy_universes_.end() ) return;
+
+  int& use_count = iter->second->use_count_;
+  if ( use_count > 0 ) --use_count;
+  if ( use_count > 0 ) return;
+
+  auto& mutable_univ = const_cast< Universe& >( univ );
+  mutable_univ.hist_true_.reset();
+  mutable_univ.hist_reco_.reset();
+  mutable_univ.hist_2d_.reset();
+  mutable_univ.hist_categ_.reset();
+  mutable_univ.hist_reco2d_.reset();
+  mutable_univ.hist_true2d_.reset();
+}
+
+std::unique_ptr< TFile > SystematicsCalculator::take_universe_file() const {
+  {
+    std::lock_guard< std::mutex > lock( universe_file_mutex_ );
+    if ( !universe_files_.empty() ) {
+      auto file = std::move( universe_files_.back() );
+      universe_files_.pop_back();
+      return file;
+    }
+  }
+
+  std::unique_ptr< TFile > file( TFile::Open(universe_file_name_.c_str(),
+    "read") );
+  if ( !file || file->IsZombie() ) {
+    throw std::runtime_error( "Could not open universe file "
+      + universe_file_name_ );
+  }
+  return file;
+}
+
+void SystematicsCalculator::return_universe_file(
+  std::unique_ptr<TFile> file ) const
+{
+  std::lock_guard< std::mutex > lock( universe_file_mutex_ );
+  universe_files_.push_back( std::move(file) );
+}
+
+void SystematicsCalculator::build_universes( TDirectoryFile& root_tdir,
+  const MappedUniverseFile* columnar_file )
+{
+
+  // Any cached observables refer to the old Universe objects
+  this->clear_observable_cache();
 
   // Set default values of flags used to signal the presence of fake data. If
   // fake data are detected, corresponding truth information will be stored and
@@ -430,6 +657,11 @@ void SystematicsCalculator::build_universes( TDirectoryFile& root_tdir ) {
     total_bnb_data_pot_ += pair.second;
   }
 
+  // Names of the TDirectoryFile subfolders for the reweightable MC ntuple
+  // files, together with the POT scaling factor to use for each one. These
+  // are processed after the loop below.
+  std::vector< std::pair<std::string, double> > rw_inputs;
+
   // Loop through the ntuple files for the various run / ntuple file type
   // pairs considered in the analysis. We will react differently in a run-
   // and type-dependent way.
@@ -456,16 +688,32 @@ void SystematicsCalculator::build_universes( TDirectoryFile& root_tdir ) {
         // value of this flag will be reconsidered below.
         bool is_fake_data = false;
 
+        // Get the TDirectoryFile name used to store histograms for the
+        // current ntuple file
+        std::string subdir_name = ntuple_subfolder_from_file_name(
+          file_name );
+
+        TDirectoryFile* subdir = nullptr;
+        root_tdir.GetObject( subdir_name.c_str(), subdir );
+        if ( !subdir ) throw std::runtime_error(
+          "Missing TDirectoryFile " + subdir_name );
+
         // Get the simulated or measured POT belonging to the current file.
         // This will be used to normalize the relevant histograms
         double file_pot = 0.;
         if ( is_mc ) {
-          // MC files have the simulated POT stored alongside the ntuple
-          // TODO: use the TDirectoryFile to handle this rather than
-          // pulling it out of the original ntuple file
-          TFile temp_mc_file( file_name.c_str(), "read" );
-          TParameter<float>* temp_pot = nullptr;
-          temp_mc_file.GetObject( "summed_pot", temp_pot );
+          // MC files have the simulated POT stored alongside the ntuple.
+          // UniverseMaker saves a copy in the TDirectoryFile, so the
+          // original ntuple file only needs to be opened for older
+          // universe files.
+          auto temp_pot = get_object_unique_ptr< TParameter<float> >(
+            SUMMED_POT_NAME, *subdir );
+          if ( !temp_pot ) {
+            TFile temp_mc_file( file_name.c_str(), "read" );
+            TParameter<float>* ntuple_pot = nullptr;
+            temp_mc_file.GetObject( SUMMED_POT_NAME.c_str(), ntuple_pot );
+            temp_pot.reset( ntuple_pot );
+          }
           if ( !temp_pot ) throw std::runtime_error(
             "Missing POT in MC file!" );
           file_pot = temp_pot->GetVal();
@@ -475,16 +723,6 @@ void SystematicsCalculator::build_universes( TDirectoryFile& root_tdir ) {
           file_pot = fpm.data_norm_map().at( file_name ).pot_;
         }
 
-        // Get the TDirectoryFile name used to store histograms for the
-        // current ntuple file
-        std::string subdir_name = ntuple_subfolder_from_file_name(
-          file_name );
-
-        TDirectoryFile* subdir = nullptr;
-        root_tdir.GetObject( subdir_name.c_str(), subdir );
-        if ( !subdir ) throw std::runtime_error(
-          "Missing TDirectoryFile " + subdir_name );
-
         // For data, just add the reco-space event counts to the total,
         // scaling to the beam-on triggers in the case of EXT data
         if ( !is_mc ) {
@@ -771,11 +1009,39 @@ void SystematicsCalculator::build_universes( TDirectoryFile& root_tdir ) {
           // its TDirectoryFile.
           // NOTE: I rely here on the reweighting universe definitions
           // being identical across all ntuples considered by the script.
-          if ( rw_universes_.empty() ) {
+          if ( rw_universes_.empty() && columnar_file
+            && !columnar_file->family_names(subdir_name).empty() )
+          {
+            // The columnar file lists the universes directly
+            for ( const auto& univ_name
+              : columnar_file->family_names(subdir_name) )
+            {
+              const auto* family = columnar_file->find_family( subdir_name,
+                univ_name );
+
+              auto& univ_vec = rw_universes_[ univ_name ];
+              for ( size_t u = 0u; u < family->num_universes_; ++u ) {
+                auto temp_univ = std::make_unique< Universe >( univ_name, u,
+                  num_true_bins, num_reco_bins );
+
+                temp_univ->drop_hists( family->hist_mask_ );
+                set_stats_and_dir( *temp_univ );
+                univ_vec.emplace_back( std::move(temp_univ) );
+              }
+            }
+          }
+          else if ( rw_universes_.empty() ) {
 
             TList* universe_key_list = subdir->GetListOfKeys();
             int num_keys = universe_key_list->GetEntries();
 
+            // Families of universes may omit some of the optional histograms
+            // (see UNIVERSE_HISTS_KEYWORD), so look up which ones exist
+            std::set< std::string > key_names;
+            for ( int k = 0; k < num_keys; ++k ) {
+              key_names.insert( universe_key_list->At(k)->GetName() );
+            }
+
             for ( int k = 0; k < num_keys; ++k ) {
               // To avoid double-counting universes, only create new
               // Universe objects for the 2D event count histograms
@@ -801,6 +1067,15 @@ void SystematicsCalculator::build_universes( TDirectoryFile& root_tdir ) {
               auto temp_univ = std::make_unique<Universe>( univ_name,
                 univ_index, num_true_bins, num_reco_bins );
 
+              UniverseHistMask mask = REQUIRED_UNIVERSE_HISTS;
+              for ( auto kind : { kReco2DUniverseHist, kTrue2DUniverseHist } )
+              {
+                if ( key_names.count(key + '_' + universe_hist_suffix(kind)) ) {
+                  mask |= universe_hist_bit( kind );
+                }
+              }
+              temp_univ->drop_hists( mask );
+
               set_stats_and_dir( *temp_univ );
 
               // If we do not already have a map entry for this kind of
@@ -822,73 +1097,12 @@ void SystematicsCalculator::build_universes( TDirectoryFile& root_tdir ) {
 
 
           // For reweightable MC ntuple files, scale the histograms for
-          // each universe to the BNB data POT for the current run
+          // each universe to the BNB data POT for the current run. The
+          // histograms themselves are added to the totals below.
           double run_bnb_pot = run_to_bnb_pot_map.at( run );
           double rw_scale_factor = run_bnb_pot / file_pot;
 
-          // Iterate over the reweighting universes, retrieve the
-          // histograms for each, and add their POT-scaled contributions
-          // from the current ntuple file to the total
-          for ( auto& rw_pair : rw_universes_ ) {
-            std::string univ_name = rw_pair.first;
-            auto& univ_vec = rw_pair.second;
-
-            for ( size_t u_idx = 0u; u_idx < univ_vec.size(); ++u_idx ) {
-              // Get a reference to the current universe object
-              auto& universe = *univ_vec.at( u_idx );
-
-              // Double-check that the universe ordering is right. The
-              // index in the map of universes should match the index
-              // stored in the Universe object itself. If this check fails,
-              // something went wrong with the key sorting imposed by the
-              // input TDirectoryFile.
-              if ( u_idx != universe.index_ ) throw std::runtime_error(
-                "Universe sorting went wrong!" );
-
-              // Retrieve the histograms for the current universe from the
-              // current TDirectoryFile
-              std::string hist_name_prefix = univ_name
-                + '_' + std::to_string( u_idx );
-
-              auto h_reco = get_object_unique_ptr< TH1D >(
-                (hist_name_prefix + "_reco"), *subdir );
-
-              auto h_true = get_object_unique_ptr< TH1D >(
-                (hist_name_prefix + "_true"), *subdir );
-
-              auto h_2d = get_object_unique_ptr< TH2D >(
-                (hist_name_prefix + "_2d"), *subdir );
-
-              auto h_categ = get_object_unique_ptr< TH2D >(
-                (hist_name_prefix + "_categ"), *subdir );
-
-              auto h_reco2d = get_object_unique_ptr< TH2D >(
-                (hist_name_prefix + "_reco2d"), *subdir );
-
-              auto h_true2d = get_object_unique_ptr< TH2D >(
-                (hist_name_prefix + "_true2d"), *subdir );
-
-              // Scale these histograms to the appropriate BNB data POT for
-              // the current run
-              h_reco->Scale( rw_scale_factor );
-              h_true->Scale( rw_scale_factor );
-              h_2d->Scale( rw_scale_factor );
-              h_categ->Scale( rw_scale_factor );
-              h_reco2d->Scale( rw_scale_factor );
-              h_true2d->Scale( rw_scale_factor );
-
-              // Add their contributions to the owned histograms for the
-              // current Universe object
-              universe.hist_reco_->Add( h_reco.get() );
-              universe.hist_true_->Add( h_true.get() );
-              universe.hist_2d_->Add( h_2d.get() );
-              universe.hist_categ_->Add( h_categ.get() );
-              universe.hist_reco2d_->Add( h_reco2d.get() );
-              universe.hist_true2d_->Add( h_true2d.get() );
-
-            } // universes indices
-
-          } // universe types
+          rw_inputs.emplace_back( subdir_name, rw_scale_factor );
 
         } // reweightable MC samples
 
@@ -898,6 +1112,182 @@ void SystematicsCalculator::build_universes( TDirectoryFile& root_tdir ) {
 
   } // run
 
+  // Now retrieve the histograms for each reweightable universe from each of
+  // the reweightable MC ntuple files, and add their POT-scaled contributions
+  // to the totals. The universes are split among several worker threads, each
+  // of which uses its own read-only handle for the input ROOT file. Since
+  // every universe is handled by a single task, which adds the contributions
+  // from the files in the same order as a serial loop would, the results do
+  // not depend on the number of threads.
+  std::vector< Universe* > rw_univ_list;
+  for ( auto& rw_pair : rw_universes_ ) {
+    auto& univ_vec = rw_pair.second;
+    for ( size_t u_idx = 0u; u_idx < univ_vec.size(); ++u_idx ) {
+      // Double-check that the universe ordering is right. The index in the
+      // map of universes should match the index stored in the Universe object
+      // itself. If this check fails, something went wrong with the key sorting
+      // imposed by the input TDirectoryFile.
+      if ( u_idx != univ_vec.at(u_idx)->index_ ) throw std::runtime_error(
+        "Universe sorting went wrong!" );
+
+      rw_univ_list.push_back( univ_vec.at(u_idx).get() );
+    }
+  }
+
+  // Additional file handles can only be opened if the input TDirectoryFile
+  // belongs to a file on disk
+  TFile* input_file = root_tdir.GetFile();
+  std::string root_tdir_path = root_tdir.GetPath();
+  size_t colon_idx = root_tdir_path.find( ":/" );
+  if ( colon_idx != std::string::npos ) {
+    root_tdir_path = root_tdir_path.substr( colon_idx + 2u );
+  }
+
+  // Reading a file through extra handles is only safe if no writes to it are
+  // pending, so use the existing handle (and a single thread) if it was
+  // opened for writing
+  size_t num_workers = std::min( num_threads_, rw_univ_list.size() );
+  if ( !input_file || input_file->IsWritable() ) num_workers = 1u;
+
+  // Use a few tasks per worker to even out the load
+  constexpr size_t TASKS_PER_WORKER = 4u;
+  size_t num_tasks = std::min( rw_univ_list.size(),
+    num_workers * TASKS_PER_WORKER );
+
+  if ( num_workers > 1u ) ROOT::EnableThreadSafety();
+
+  // Histograms created by the worker threads should not be attached to any
+  // TDirectory
+  bool add_dir_status = TH1::AddDirectoryStatus();
+  TH1::AddDirectory( false );
+
+  parallel_for( num_tasks, num_workers, [ & ]( size_t t ) {
+
+    size_t first_univ = t * rw_univ_list.size() / num_tasks;
+    size_t last_univ = ( t + 1u ) * rw_univ_list.size() / num_tasks;
+
+    // The input file is only opened if it is needed
+    std::unique_ptr< TFile > task_file;
+    TDirectory* task_root_tdir = nullptr;
+
+    // A single temporary Universe object is reused to hold the contents of
+    // each universe retrieved from the columnar file
+    std::unique_ptr< Universe > columnar_univ;
+
+    for ( const auto& rw_input : rw_inputs ) {
+      const std::string& subdir_name = rw_input.first;
+      double rw_scale_factor = rw_input.second;
+
+      TDirectoryFile* subdir = nullptr;
+
+      for ( size_t ui = first_univ; ui < last_univ; ++ui ) {
+        Universe& universe = *rw_univ_list.at( ui );
+        const std::string& univ_name = universe.universe_name_;
+        size_t u_idx = universe.index_;
+
+        // Use the columnar file for this universe if possible
+        const ColumnarUniverseFamily* family = nullptr;
+        if ( columnar_file ) {
+          family = columnar_file->find_family( subdir_name, univ_name );
+          if ( family && family->num_universes_ <= u_idx ) family = nullptr;
+        }
+
+        // Retrieve the histograms for the current universe from the
+        // columnar file or the current TDirectoryFile
+        std::unique_ptr< Universe > file_univ;
+        if ( family ) {
+          if ( !columnar_univ
+            || columnar_univ->hist_mask() != family->hist_mask_ )
+          {
+            columnar_univ = columnar_file->make_universe( *family, u_idx );
+          }
+          else {
+            columnar_file->copy_to_universe( *family, u_idx,
+              *columnar_univ );
+          }
+        }
+        else {
+          if ( !subdir ) {
+            if ( !task_root_tdir ) {
+              if ( num_workers > 1u ) {
+                task_file.reset( TFile::Open(input_file->GetName(), "read") );
+                if ( !task_file || task_file->IsZombie() ) {
+                  throw std::runtime_error( "Could not reopen the universe"
+                    " file " + std::string(input_file->GetName()) );
+                }
+                task_root_tdir = task_file->GetDirectory(
+                  root_tdir_path.c_str() );
+              }
+              else task_root_tdir = &root_tdir;
+            }
+
+            if ( task_root_tdir ) {
+              task_root_tdir->GetObject( subdir_name.c_str(), subdir );
+            }
+            if ( !subdir ) throw std::runtime_error(
+              "Missing TDirectoryFile " + subdir_name );
+          }
+
+          std::string hist_name_prefix = univ_name
+            + '_' + std::to_string( u_idx );
+
+          auto h_reco = get_object_unique_ptr< TH1D >(
+            (hist_name_prefix + "_reco"), *subdir );
+
+          auto h_true = get_object_unique_ptr< TH1D >(
+            (hist_name_prefix + "_true"), *subdir );
+
+          auto h_2d = get_object_unique_ptr< TH2D >(
+            (hist_name_prefix + "_2d"), *subdir );
+
+          auto h_categ = get_object_unique_ptr< TH2D >(
+            (hist_name_prefix + "_categ"), *subdir );
+
+          auto h_reco2d = get_object_unique_ptr< TH2D >(
+            (hist_name_prefix + "_reco2d"), *subdir );
+
+          auto h_true2d = get_object_unique_ptr< TH2D >(
+            (hist_name_prefix + "_true2d"), *subdir );
+
+          if ( !h_reco || !h_true || !h_2d || !h_categ ) {
+            throw std::runtime_error( "Missing histograms for the "
+              + hist_name_prefix + " universe in " + subdir_name );
+          }
+
+          file_univ = std::make_unique< Universe >( univ_name, u_idx,
+            h_true.release(), h_reco.release(), h_2d.release(),
+            h_categ.release(), h_reco2d.release(), h_true2d.release() );
+        }
+
+        Universe& fu = family ? *columnar_univ : *file_univ;
+
+        // Scale these histograms to the appropriate BNB data POT for
+        // the current run and add their contributions to the owned
+        // histograms for the current Universe object. Only the kinds of
+        // histograms found in the first reweightable ntuple file are kept.
+        for ( size_t k = 0u; k < NUM_UNIVERSE_HIST_KINDS; ++k ) {
+          auto kind = static_cast< UniverseHistKind >( k );
+          TH1* total_hist = universe.hist( kind );
+          if ( !total_hist ) continue;
+
+          TH1* file_hist = fu.hist( kind );
+          if ( !file_hist ) throw std::runtime_error( "Missing "
+            + universe_hist_suffix(kind) + " histogram for the "
+            + univ_name + '_' + std::to_string(u_idx) + " universe in "
+            + subdir_name );
+
+          file_hist->Scale( rw_scale_factor );
+          total_hist->Add( file_hist );
+        }
+
+      } // universes
+
+    } // reweightable MC ntuple files
+
+  } );
+
+  TH1::AddDirectory( add_dir_status );
+
   // Everything is ready to go with one possible exception: if we're working
   // with fake data ntuples, then the "data" histograms of reco-space event
   // counts will contain the "beam-on" (MC) contribution but not the "beam-off"
@@ -1001,12 +1391,13 @@ void SystematicsCalculator::save_universes( TDirectoryFile& out_tdf ) {
 
     const auto& univ_vec = pair.second;
     for ( const auto& universe : univ_vec ) {
+      UniverseGuard guard( *this, *universe );
       universe->hist_reco_->Write();
       universe->hist_true_->Write();
       universe->hist_2d_->Write();
       universe->hist_categ_->Write();
-      universe->hist_reco2d_->Write();
-      universe->hist_true2d_->Write();
+      if ( universe->hist_reco2d_ ) universe->hist_reco2d_->Write();
+      if ( universe->hist_true2d_ ) universe->hist_true2d_->Write();
     }
 
   }
@@ -1027,6 +1418,36 @@ void SystematicsCalculator::save_universes( TDirectoryFile& out_tdf ) {
 
   temp_pot.Write();
 
+  // Save an index listing all of the universes. This allows
+  // load_universes() to find them without searching through all of the keys.
+  std::ostringstream index_oss;
+  auto add_to_index = [ &index_oss ]( const Universe& univ ) {
+    index_oss << univ.universe_name_ << ' ' << univ.index_ << '\n';
+  };
+
+  for ( const auto& pair : detvar_universes_ ) add_to_index( *pair.second );
+  for ( const auto& pair : alt_cv_universes_ ) add_to_index( *pair.second );
+  for ( const auto& pair : rw_universes_ ) {
+    for ( const auto& universe : pair.second ) add_to_index( *universe );
+  }
+  if ( fake_data_universe_ ) add_to_index( *fake_data_universe_ );
+
+  std::string universe_index = index_oss.str();
+  out_tdf.WriteObject( &universe_index, UNIVERSE_INDEX_NAME.c_str() );
+
+}
+
+std::vector< double > SystematicsCalculator::evaluate_observables(
+  const Universe& univ, int flux_universe_index ) const
+{
+  size_t num_cm_bins = this->get_covariance_matrix_size();
+  std::vector< double > result( num_cm_bins, 0. );
+
+  for ( size_t b = 0u; b < num_cm_bins; ++b ) {
+    result[ b ] = this->evaluate_observable( univ, b, flux_universe_index );
+  }
+
+  return result;
 }
 
 CovMatrix SystematicsCalculator::make_covariance_matrix(
@@ -1054,14 +1475,15 @@ template < class UniversePointerContainer >
   size_t num_cm_bins = sc.get_covariance_matrix_size();
 
   // Get the expected observable values in each reco bin in the CV universe
-  std::vector< double > cv_reco_obs( num_cm_bins, 0. );
-
-  for ( size_t rb = 0u; rb < num_cm_bins; ++rb ) {
-    cv_reco_obs.at( rb ) = sc.evaluate_observable( cv_univ, rb );
-  }
+  std::vector< double > cv_reco_obs = sc.evaluate_observables( cv_univ );
 
-  // Loop over universes
+  // Stack the deviations of the observables from their CV values into a
+  // matrix with one row per covariance matrix bin and one column per
+  // universe. Storing the deviations for each bin contiguously makes the
+  // dot products computed below cheap.
   int num_universes = universes.size();
+  std::vector< double > deviations( num_cm_bins * num_universes, 0. );
+
   for ( int u_idx = 0; u_idx < num_universes; ++u_idx ) {
 
     const auto& univ = universes.at( u_idx );
@@ -1074,42 +1496,66 @@ template < class UniversePointerContainer >
     if ( is_flux_variation ) flux_u_idx = u_idx;
 
     // Get the expected observable values in each reco bin in the
-    // current universe.
-    std::vector< double > univ_reco_obs( num_cm_bins, 0. );
-
-    for ( size_t rb = 0u; rb < num_cm_bins; ++rb ) {
-      univ_reco_obs.at( rb ) = sc.evaluate_observable( *univ,
-        rb, flux_u_idx );
+    // current universe. Its histograms are loaded (if needed) only for the
+    // duration of this step.
+    std::vector< double > univ_reco_obs;
+    if ( sc.has_cached_observables(*univ, flux_u_idx) ) {
+      univ_reco_obs = sc.evaluate_observables( *univ, flux_u_idx );
+    }
+    else {
+      UniverseGuard guard( sc, *univ );
+      univ_reco_obs = sc.evaluate_observables( *univ, flux_u_idx );
     }
 
-    // We have all the needed ingredients to get the contribution of this
-    // universe to the covariance matrix. Loop over each pair covariance matrix
-    // elements and fill them.
-    // TODO: the covariance matrix are symmetric by definition. You can
-    // therefore make this more efficient by calculating only the subset of
-    // elements that you need.
     for ( size_t a = 0u; a < num_cm_bins; ++a ) {
+      deviations[ a * num_universes + u_idx ] = cv_reco_obs.at( a )
+        - univ_reco_obs.at( a );
+    }
+  } // universe
 
-      double cv_a = cv_reco_obs.at( a );
-      double univ_a = univ_reco_obs.at( a );
-
-      for ( size_t b = 0u; b < num_cm_bins; ++b ) {
+  // The covariance matrix is the product of the deviations matrix with its
+  // own transpose (summed over universes). Since it is symmetric, only the
+  // upper triangle is computed. It is stored in row-major packed form, i.e.,
+  // the elements (a, b) with b >= a for a = 0, 1, ... in sequence. The sums
+  // over universes are done in the same order as they were when the TH2D was
+  // filled directly for each universe.
+  std::vector< double > packed_cov( num_cm_bins * (num_cm_bins + 1u) / 2u, 0. );
 
-        double cv_b = cv_reco_obs.at( b );
-        double univ_b = univ_reco_obs.at( b );
+  size_t packed_idx = 0u;
+  for ( size_t a = 0u; a < num_cm_bins; ++a ) {
+    const double* dev_a = deviations.data() + a * num_universes;
 
-        double covariance  = ( cv_a - univ_a ) * ( cv_b - univ_b );
+    for ( size_t b = a; b < num_cm_bins; ++b ) {
+      const double* dev_b = deviations.data() + b * num_universes;
 
-        // We cheat here by noting that the lower bound of each covariance
-        // matrix TH2D bin is the bin index. Filling using the zero-based bin
-        // indices and the covariance as the weight yields the desired behavior
-        // (increment the existing element by the current covariance value) in
-        // an easy-to-read (if slightly evil) way.
-        cov_mat.cov_matrix_->Fill( a, b, covariance );
-      } // reco bin index b
-    } // reco bin index a
+      double covariance = 0.;
+      for ( int u_idx = 0; u_idx < num_universes; ++u_idx ) {
+        covariance += dev_a[ u_idx ] * dev_b[ u_idx ];
+      }
 
-  } // universe
+      packed_cov[ packed_idx ] = covariance;
+      ++packed_idx;
+    } // reco bin index b
+  } // reco bin index a
+
+  // Add the result to the covariance matrix TH2D. Note the one-based bin
+  // indices used by ROOT histograms.
+  TH2D* cov_hist = cov_mat.cov_matrix_.get();
+  packed_idx = 0u;
+  for ( size_t a = 0u; a < num_cm_bins; ++a ) {
+    for ( size_t b = a; b < num_cm_bins; ++b ) {
+      double covariance = packed_cov[ packed_idx ];
+      ++packed_idx;
+
+      cov_hist->SetBinContent( a + 1, b + 1,
+        cov_hist->GetBinContent( a + 1, b + 1 ) + covariance );
+
+      if ( a != b ) {
+        cov_hist->SetBinContent( b + 1, a + 1,
+          cov_hist->GetBinContent( b + 1, a + 1 ) + covariance );
+      }
+    }
+  }
 
   // If requested, average the final covariance matrix elements over all
   // universes
@@ -1134,225 +1580,284 @@ void make_cov_mat( const SystematicsCalculator& sc, CovMatrix& cov_mat,
     is_flux_variation );
 }
 
-std::unique_ptr< CovMatrixMap > SystematicsCalculator::get_covariances() const
+std::vector< CovMatrixDefinition >
+  SystematicsCalculator::read_covariance_definitions() const
 {
-  // Make an empty map to store the covariance matrices
-  auto matrix_map_ptr = std::make_unique< CovMatrixMap >();
-  auto& matrix_map = *matrix_map_ptr;
+  std::vector< CovMatrixDefinition > cov_defs;
 
-  // Read in the definition of each covariance matrix and calculate it. Each
-  // definition contains at least a name and a type specifier
+  // Keys are covariance matrix names, values are indices in cov_defs
+  std::map< std::string, size_t > def_indices;
+
+  // Read in the definition of each covariance matrix. Each definition
+  // contains at least a name and a type specifier followed by a fixed
+  // number of arguments that depends on the type.
   std::ifstream config_file( syst_config_file_name_ );
   std::string name, type;
   while ( config_file >> name >> type ) {
 
-    CovMatrix temp_cov_mat = this->make_covariance_matrix( name );
+    CovMatrixDefinition def;
+    def.name_ = name;
+    def.type_ = type;
 
-    // If the current covariance matrix is defined as a sum of others, then
-    // just add the existing ones together to compute it
+    int num_args = 0;
     if ( type == "sum" ) {
-      int count = 0;
-      config_file >> count;
+      // A "sum" matrix lists the number of terms followed by their names.
+      // Each term must be defined earlier in the configuration file.
+      config_file >> num_args;
       std::string cm_name;
-      for ( int cm = 0; cm < count; ++cm ) {
+      for ( int cm = 0; cm < num_args; ++cm ) {
         config_file >> cm_name;
-        if ( !matrix_map.count(cm_name) ) {
+        auto iter = def_indices.find( cm_name );
+        if ( iter == def_indices.end() ) {
           throw std::runtime_error( "Undefined covariance matrix " + cm_name );
         }
-        temp_cov_mat += matrix_map.at( cm_name );
-      } // terms in the sum
-
-    } // sum type
-
-    else if ( type == "MCstat" ) {
-
-      size_t num_cm_bins = this->get_covariance_matrix_size();
-      const auto& cv_univ = this->cv_universe();
-
-      for ( size_t rb1 = 0u; rb1 < num_cm_bins; ++rb1 ) {
-        for ( size_t rb2 = 0u; rb2 < num_cm_bins; ++rb2 ) {
-          // Calculate the MC statistical covariance for the current pair of
-          // reco bins for the observable of interest. Use the CV universe.
-          double mc_cov = this->evaluate_mc_stat_covariance( cv_univ,
-            rb1, rb2 );
-
-          // Note the one-based reco bin index used by ROOT histograms
-          temp_cov_mat.cov_matrix_->SetBinContent( rb1 + 1, rb2 + 1, mc_cov );
-        }
+        def.args_.push_back( cm_name );
+        def.dependencies_.push_back( iter->second );
       }
+      num_args = 0;
+    }
+    else if ( type == "MCstat" || type == "BNBstat" || type == "EXTstat"
+      || type == "AltUniv" )
+    {
+      num_args = 0;
+    }
+    else if ( type == "MCFullCorr" || type == "DV" ) num_args = 1;
+    else if ( type == "MCFullCorrCategory" || type == "RW"
+      || type == "FluxRW" )
+    {
+      num_args = 2;
+    }
+    // Complain if we don't know how to calculate the requested covariance
+    // matrix
+    else throw std::runtime_error( "Unrecognized covariance matrix type \""
+      + type + '\"' );
 
-    } // MCstat type
-
-    else if ( type == "BNBstat" || type == "EXTstat" ) {
+    std::string arg;
+    for ( int a = 0; a < num_args; ++a ) {
+      config_file >> arg;
+      def.args_.push_back( arg );
+    }
 
-      bool use_ext = false;
-      if ( type == "EXTstat" ) use_ext = true;
+    // If an entry already exists with the same name, throw an exception.
+    if ( def_indices.count(name) ) {
+      throw std::runtime_error( "Duplicate covariance matrix definition for "
+        + name );
+    }
+    def_indices[ name ] = cov_defs.size();
+    cov_defs.push_back( def );
 
-      size_t num_cm_bins = this->get_covariance_matrix_size();
+  } // Covariance matrix definitions
 
-      for ( size_t rb1 = 0u; rb1 < num_cm_bins; ++rb1 ) {
-        for ( size_t rb2 = 0u; rb2 < num_cm_bins; ++rb2 ) {
-          double stat_cov = this->evaluate_data_stat_covariance( rb1,
-            rb2, use_ext );
+  return cov_defs;
+}
 
-          // Note the one-based reco bin index used by ROOT histograms
-          temp_cov_mat.cov_matrix_->SetBinContent( rb1 + 1, rb2 + 1, stat_cov );
-        }
-      }
+void SystematicsCalculator::fill_covariance_matrix(
+  const CovMatrixDefinition& def, CovMatrix& temp_cov_mat ) const
+{
+  const std::string& type = def.type_;
+  const auto& args = def.args_;
 
-    } // BNBstat and EXTstat types
+  if ( type == "MCstat" ) {
 
-    else if ( type == "MCFullCorr" ) {
-      // Read in the fractional uncertainty from the configuration file
-      double frac_unc = 0.;
-      config_file >> frac_unc;
+    size_t num_cm_bins = this->get_covariance_matrix_size();
+    const auto& cv_univ = this->cv_universe();
 
-      const double frac2 = std::pow( frac_unc, 2 );
-      int num_cm_bins = this->get_covariance_matrix_size();
+    for ( size_t rb1 = 0u; rb1 < num_cm_bins; ++rb1 ) {
+      for ( size_t rb2 = 0u; rb2 < num_cm_bins; ++rb2 ) {
+        // Calculate the MC statistical covariance for the current pair of
+        // reco bins for the observable of interest. Use the CV universe.
+        double mc_cov = this->evaluate_mc_stat_covariance( cv_univ,
+          rb1, rb2 );
 
-      const auto& cv_univ = this->cv_universe();
-      for ( size_t a = 0u; a < num_cm_bins; ++a ) {
+        // Note the one-based reco bin index used by ROOT histograms
+        temp_cov_mat.cov_matrix_->SetBinContent( rb1 + 1, rb2 + 1, mc_cov );
+      }
+    }
 
-        double cv_a = this->evaluate_observable( cv_univ, a );
+  } // MCstat type
 
-        for ( int b = 0u; b < num_cm_bins; ++b ) {
+  else if ( type == "BNBstat" || type == "EXTstat" ) {
 
-          double cv_b = this->evaluate_observable( cv_univ, b );
+    bool use_ext = false;
+    if ( type == "EXTstat" ) use_ext = true;
 
-          double covariance = cv_a * cv_b * frac2;
+    size_t num_cm_bins = this->get_covariance_matrix_size();
 
-          temp_cov_mat.cov_matrix_->SetBinContent( a + 1, b + 1, covariance );
+    for ( size_t rb1 = 0u; rb1 < num_cm_bins; ++rb1 ) {
+      for ( size_t rb2 = 0u; rb2 < num_cm_bins; ++rb2 ) {
+        double stat_cov = this->evaluate_data_stat_covariance( rb1,
+          rb2, use_ext );
 
-        } // reco bin b
+        // Note the one-based reco bin index used by ROOT histograms
+        temp_cov_mat.cov_matrix_->SetBinContent( rb1 + 1, rb2 + 1, stat_cov );
+      }
+    }
 
-      } // reco bin a
+  } // BNBstat and EXTstat types
 
-    } // MCFullCorr type
+  else if ( type == "MCFullCorr" || type == "MCFullCorrCategory" ) {
+    // Read in the fractional uncertainty from the configuration file
+    double frac_unc = std::stod( args.at(0) );
 
-    else if ( type == "MCFullCorrCategory" ) {
-      // Read in the fractional uncertainty from the configuration file
-      double frac_unc = 0.;
-      config_file >> frac_unc;
+    const double frac2 = std::pow( frac_unc, 2 );
+    int num_cm_bins = this->get_covariance_matrix_size();
 
-      // Read in the category from the configuration file
-      std::string event_category;
-      config_file >> event_category;
+    // Evaluate the CV observable either in all bins or (for the category
+    // version) in a single event category
+    const auto& cv_univ = this->cv_universe();
+    std::vector< double > cv_obs;
+    if ( type == "MCFullCorr" ) {
+      cv_obs = this->evaluate_observables( cv_univ );
+    }
+    else {
+      const std::string& event_category = args.at( 1 );
+      for ( int b = 0; b < num_cm_bins; ++b ) {
+        cv_obs.push_back( this->evaluate_observable(cv_univ, b,
+          event_category) );
+      }
+    }
 
-      const double frac2 = std::pow( frac_unc, 2 );
-      int num_cm_bins = this->get_covariance_matrix_size();
+    for ( int a = 0; a < num_cm_bins; ++a ) {
 
-      const auto& cv_univ = this->cv_universe();
-      for ( size_t a = 0u; a < num_cm_bins; ++a ) {
+      double cv_a = cv_obs.at( a );
 
-        double cv_a = this->evaluate_observable( cv_univ, a, event_category );
+      for ( int b = 0; b < num_cm_bins; ++b ) {
 
-        for ( int b = 0u; b < num_cm_bins; ++b ) {
+        double cv_b = cv_obs.at( b );
 
-          double cv_b = this->evaluate_observable( cv_univ, b, event_category );
+        double covariance = cv_a * cv_b * frac2;
 
-          double covariance = cv_a * cv_b * frac2;
+        temp_cov_mat.cov_matrix_->SetBinContent( a + 1, b + 1, covariance );
 
-          temp_cov_mat.cov_matrix_->SetBinContent( a + 1, b + 1, covariance );
+      } // reco bin b
 
-        } // reco bin b
+    } // reco bin a
 
-      } // reco bin a
+  } // MCFullCorr and MCFullCorrCategory types
 
-    } // MCFullCorrCategory type
+  else if ( type == "DV" ) {
+    // Get the detector variation type represented by the current universe
+    const std::string& ntuple_type_str = args.at( 0 );
 
-    else if ( type == "DV" ) {
-      // Get the detector variation type represented by the current universe
-      std::string ntuple_type_str;
-      config_file >> ntuple_type_str;
+    const auto& fpm = FilePropertiesManager::Instance();
+    auto ntuple_type = fpm.string_to_ntuple_type( ntuple_type_str );
 
-      const auto& fpm = FilePropertiesManager::Instance();
-      auto ntuple_type = fpm.string_to_ntuple_type( ntuple_type_str );
+    // Check that it's valid. If not, then complain.
+    bool is_not_detVar = !ntuple_type_is_detVar( ntuple_type );
+    if ( is_not_detVar ) {
+      throw std::runtime_error( "Invalid NtupleFileType!" );
+    }
 
-      // Check that it's valid. If not, then complain.
-      bool is_not_detVar = !ntuple_type_is_detVar( ntuple_type );
-      if ( is_not_detVar ) {
-        throw std::runtime_error( "Invalid NtupleFileType!" );
+    // Use a bare pointer for the CV universe so that we can reassign it
+    // below if needed. References can't be reassigned after they are
+    // initialized.
+    const auto* detVar_cv_u = detvar_universes_.at( NFT::kDetVarMCCV ).get();
+    const auto& detVar_alt_u = detvar_universes_.at( ntuple_type );
+
+    // The Recomb2 and SCE variations use an alternate "extra CV" universe
+    // since they were generated with smaller MC statistics.
+    // TODO: revisit this if your detVar samples change in the future
+    // BNB only
+    if (!useNuMI) {
+      if ( ntuple_type == NFT::kDetVarMCSCE
+        || ntuple_type == NFT::kDetVarMCRecomb2 )
+      {
+        detVar_cv_u = detvar_universes_.at( NFT::kDetVarMCCVExtra ).get();
       }
+    }
 
-      // Use a bare pointer for the CV universe so that we can reassign it
-      // below if needed. References can't be reassigned after they are
-      // initialized.
-      const auto* detVar_cv_u = detvar_universes_.at( NFT::kDetVarMCCV ).get();
-      const auto& detVar_alt_u = detvar_universes_.at( ntuple_type );
-
-      // The Recomb2 and SCE variations use an alternate "extra CV" universe
-      // since they were generated with smaller MC statistics.
-      // TODO: revisit this if your detVar samples change in the future
-      // BNB only
-      if (!useNuMI) {
-        if ( ntuple_type == NFT::kDetVarMCSCE
-          || ntuple_type == NFT::kDetVarMCRecomb2 )
-        {
-          detVar_cv_u = detvar_universes_.at( NFT::kDetVarMCCVExtra ).get();
-        }
-      }
+    make_cov_mat( *this, temp_cov_mat, *detVar_cv_u,
+      *detVar_alt_u, false, false );
+  } // DV type
 
-      make_cov_mat( *this, temp_cov_mat, *detVar_cv_u,
-        *detVar_alt_u, false, false );
-    } // DV type
+  else if ( type == "RW" || type == "FluxRW" ) {
 
-    else if ( type == "RW" || type == "FluxRW" ) {
+    // Treat flux variations in a special way by setting a flag
+    bool is_flux_variation = false;
+    if ( type == "FluxRW" ) is_flux_variation = true;
 
-      // Treat flux variations in a special way by setting a flag
-      bool is_flux_variation = false;
-      if ( type == "FluxRW" ) is_flux_variation = true;
+    // Get the key to use when looking up weights in the map of reweightable
+    // systematic variation universes
+    const std::string& weight_key = args.at( 0 );
 
-      // Get the key to use when looking up weights in the map of reweightable
-      // systematic variation universes
-      std::string weight_key;
-      config_file >> weight_key;
+    // Retrieve the vector of universes
+    auto end = rw_universes_.cend();
+    auto iter = rw_universes_.find( weight_key );
+    if ( iter == end ) {
+      throw std::runtime_error( "Missing weight key " + weight_key );
+    }
+    const auto& alt_univ_vec = iter->second;
 
-      // Retrieve the vector of universes
-      auto end = rw_universes_.cend();
-      auto iter = rw_universes_.find( weight_key );
-      if ( iter == end ) {
-        throw std::runtime_error( "Missing weight key " + weight_key );
-      }
-      const auto& alt_univ_vec = iter->second;
+    // Also read in the flag for whether we should average over universes
+    // or not for the current covariance matrix
+    bool avg_over_universes = false;
+    std::istringstream avg_iss( args.at(1) );
+    avg_iss >> avg_over_universes;
 
-      // Also read in the flag for whether we should average over universes
-      // or not for the current covariance matrix
-      bool avg_over_universes = false;
-      config_file >> avg_over_universes;
+    const auto& cv_univ = this->cv_universe();
+    make_cov_mat( *this, temp_cov_mat, cv_univ, alt_univ_vec,
+      avg_over_universes, is_flux_variation );
 
-      const auto& cv_univ = this->cv_universe();
-      make_cov_mat( *this, temp_cov_mat, cv_univ, alt_univ_vec,
-        avg_over_universes, is_flux_variation );
+  } // RW and FluxRW types
 
-    } // RW and FluxRW types
+  else if ( type == "AltUniv" ) {
 
-    else if ( type == "AltUniv" ) {
+    std::vector< const Universe* > alt_univ_vec;
+    for ( const auto& univ_pair : alt_cv_universes_ ) {
+      const auto* univ_ptr = univ_pair.second.get();
+      alt_univ_vec.push_back( univ_ptr );
+    }
 
-      std::vector< const Universe* > alt_univ_vec;
-      for ( const auto& univ_pair : alt_cv_universes_ ) {
-        const auto* univ_ptr = univ_pair.second.get();
-        alt_univ_vec.push_back( univ_ptr );
-      }
+    const auto& cv_univ = this->cv_universe();
+    make_cov_mat( *this, temp_cov_mat, cv_univ, alt_univ_vec,
+      true, false );
+  }
 
-      const auto& cv_univ = this->cv_universe();
-      make_cov_mat( *this, temp_cov_mat, cv_univ, alt_univ_vec,
-        true, false );
-    }
+  else throw std::runtime_error( "Unrecognized covariance matrix type \""
+    + type + '\"' );
+}
 
-    // Complain if we don't know how to calculate the requested covariance
-    // matrix
-    else throw std::runtime_error( "Unrecognized covariance matrix type \""
-      + type + '\"' );
+std::unique_ptr< CovMatrixMap > SystematicsCalculator::get_covariances() const
+{
+  // Read in the definition of each covariance matrix. Each "sum" matrix
+  // depends only on matrices that appear earlier in the configuration file,
+  // while all other matrices are independent of each other.
+  auto cov_defs = this->read_covariance_definitions();
+  size_t num_defs = cov_defs.size();
+
+  // Create the (empty) covariance matrix histograms on the main thread
+  std::vector< CovMatrix > cov_mats;
+  std::vector< size_t > independent_indices;
+  for ( size_t d = 0u; d < num_defs; ++d ) {
+    cov_mats.push_back( this->make_covariance_matrix(cov_defs[d].name_) );
+    if ( cov_defs[ d ].type_ != "sum" ) independent_indices.push_back( d );
+  }
 
-    // Add the finished covariance matrix to the map. If an entry already
-    // exists with the same name, throw an exception.
-    if ( matrix_map.count(name) ) {
-      throw std::runtime_error( "Duplicate covariance matrix definition for "
-        + name );
+  // Compute the independent covariance matrices concurrently. Each task
+  // writes only to its own CovMatrix.
+  size_t num_workers = std::min( num_threads_, independent_indices.size() );
+  if ( num_workers > 1u ) ROOT::EnableThreadSafety();
+
+  parallel_for( independent_indices.size(), num_workers, [ & ]( size_t t ) {
+    size_t d = independent_indices.at( t );
+    this->fill_covariance_matrix( cov_defs.at(d), cov_mats.at(d) );
+  } );
+
+  // Add up the terms for each "sum" matrix. Processing them in the original
+  // order guarantees that any "sum" terms are already complete.
+  for ( size_t d = 0u; d < num_defs; ++d ) {
+    for ( size_t dep : cov_defs[ d ].dependencies_ ) {
+      cov_mats[ d ] += cov_mats.at( dep );
     }
-    matrix_map[ name ] = std::move( temp_cov_mat );
+  }
 
-  } // Covariance matrix definitions
+  // Make a map to store the finished covariance matrices
+  auto matrix_map_ptr = std::make_unique< CovMatrixMap >();
+  auto& matrix_map = *matrix_map_ptr;
+
+  for ( size_t d = 0u; d < num_defs; ++d ) {
+    matrix_map[ cov_defs[d].name_ ] = std::move( cov_mats[d] );
+  }
 
   return matrix_map_ptr;
 }
@@ -1545,9 +2050,12 @@ void SystematicsCalculator::dump_universe_helper( std::ostream& out,
 
   // Write the expected observable values in the requested universe to the
   // output file
+  UniverseGuard guard( *this, univ );
+  std::vector< double > obs_vals = this->evaluate_observables( univ,
+    flux_u_index );
+
   for ( size_t b = 0u; b < num_cm_bins; ++b ) {
-    double obs_val = this->evaluate_observable( univ, b, flux_u_index );
-    out << ' ' << obs_val;
+    out << ' ' << obs_vals.at( b );
   }
 }
 
@@ -1,7 +1,85 @@
+// Standard library includes
+#include <algorithm>
+#include <vector>
+
+// ROOT includes
+#include "TROOT.h"
+
 // XSecAnalyzer includes
 #include "XSecAnalyzer/SystematicsCalculator.hh"
+#include "XSecAnalyzer/ThreadUtils.hh"
 #include "XSecAnalyzer/Unfolder.hh"
 
+namespace {
+
+  // Number of threads available to the unfolding algorithm when it is called
+  // on a worker thread by Unfolder::blockwise_unfold(). A value of zero means
+  // that no limit beyond Unfolder::num_threads() applies.
+  thread_local size_t block_thread_budget = 0u;
+
+  // Sets the thread budget for the current thread and restores the previous
+  // value upon destruction (including when an exception is thrown)
+  struct ThreadBudgetGuard {
+    ThreadBudgetGuard( size_t budget ) : old_budget_( block_thread_budget )
+      { block_thread_budget = budget; }
+    ~ThreadBudgetGuard() { block_thread_budget = old_budget_; }
+    size_t old_budget_;
+  };
+
+  // Returns the submatrix of m built from the listed rows and columns
+  TMatrixD gather_elements( const TMatrixD& m,
+    const std::vector< size_t >& rows, const std::vector< size_t >& cols )
+  {
+    int num_rows = rows.size();
+    int num_cols = cols.size();
+    int m_cols = m.GetNcols();
+
+    TMatrixD sub( num_rows, num_cols );
+    const double* m_data = m.GetMatrixArray();
+    double* sub_data = sub.GetMatrixArray();
+
+    for ( int r = 0; r < num_rows; ++r ) {
+      const double* m_row = m_data + rows[ r ] * m_cols;
+      double* sub_row = sub_data + r * num_cols;
+      for ( int c = 0; c < num_cols; ++c ) sub_row[ c ] = m_row[ cols[ c ] ];
+    }
+
+    return sub;
+  }
+
+  // Copies the elements of sub into the listed rows and columns of m
+  void scatter_elements( const TMatrixD& sub,
+    const std::vector< size_t >& rows, const std::vector< size_t >& cols,
+    TMatrixD& m )
+  {
+    int num_rows = rows.size();
+    int num_cols = cols.size();
+    int m_cols = m.GetNcols();
+
+    if ( sub.GetNrows() != num_rows || sub.GetNcols() != num_cols ) {
+      throw std::runtime_error( "Dimension mismatch while combining unfolded"
+        " blocks" );
+    }
+
+    const double* sub_data = sub.GetMatrixArray();
+    double* m_data = m.GetMatrixArray();
+
+    for ( int r = 0; r < num_rows; ++r ) {
+      const double* sub_row = sub_data + r * num_cols;
+      double* m_row = m_data + rows[ r ] * m_cols;
+      for ( int c = 0; c < num_cols; ++c ) m_row[ cols[ c ] ] = sub_row[ c ];
+    }
+  }
+
+}
+
+size_t Unfolder::worker_threads() const {
+  if ( block_thread_budget > 0u ) {
+    return std::min( block_thread_budget, num_threads_ );
+  }
+  return num_threads_;
+}
+
 UnfoldedMeasurement Unfolder::unfold(
   const SystematicsCalculator& syst_calc ) const
 {
@@ -105,6 +183,18 @@ UnfoldedMeasurement Unfolder::blockwise_unfold( const TMatrixD& data_signal,
 
   // TODO: add sanity checks of the block definitions
 
+  // Store pointers to the bin indices for each block in a vector so that the
+  // blocks can be handed out to worker threads by position
+  std::vector< const std::pair< const int, BlockBins >* > blocks;
+  for ( const auto& block_pair : block_map ) {
+    const auto& block_bins = block_pair.second;
+    if ( block_bins.true_bin_indices_.empty() ) throw std::runtime_error(
+      "Block with zero true bins encountered" );
+    if ( block_bins.reco_bin_indices_.empty() ) throw std::runtime_error(
+      "Block with zero reco bins encountered" );
+    blocks.push_back( &block_pair );
+  }
+
   // Create a single-column TMatrixD with the same number of true bins as the
   // prior. This will be used to combine the unfolded true bin counts from the
   // blocks to produce a final result.
@@ -140,118 +230,56 @@ UnfoldedMeasurement Unfolder::blockwise_unfold( const TMatrixD& data_signal,
 
   std::cout << "\nTotal number of blocks to unfold: " << block_map.size() << "\n" << std::endl;
 
-  // Loop over the blocks. For each block, populate the input matrices and
-  // unfold.
-  for ( const auto& block_pair : block_map ) {
-
-    int b_idx = block_pair.first;
-    const auto& block_bins = block_pair.second;
-
-    std::cout << "\t - Unfolding block: " << b_idx << '\n';
-
-    // Get the dimensions of the current block
-    int num_block_true_bins = block_bins.true_bin_indices_.size();
-    int num_block_reco_bins = block_bins.reco_bin_indices_.size();
-
-    if ( num_block_true_bins < 1 ) throw std::runtime_error( "Block with zero"
-      " true bins encountered" );
-    if ( num_block_reco_bins < 1 ) throw std::runtime_error( "Block with zero"
-      " reco bins encountered" );
-
-    // Prepare matrices to store the block contents
-    TMatrixD block_data_signal( num_block_reco_bins, 1 );
-    TMatrixD block_data_covmat( num_block_reco_bins, num_block_reco_bins );
-    TMatrixD block_smearcept( num_block_reco_bins, num_block_true_bins );
-    TMatrixD block_prior_true_signal( num_block_true_bins, 1 );
-
-    // Populate the matrices for the current block
-    for ( int block_tb = 0; block_tb < num_block_true_bins; ++block_tb ) {
-      // Convert the current true bin index at the block level to the
-      // one at the global level
-      int tb = block_bins.true_bin_indices_.at( block_tb );
-
-      // Copy the prior true bin contents into the block
-      block_prior_true_signal( block_tb, 0 ) = prior_true_signal( tb, 0 );
+  for ( const auto* block : blocks ) {
+    std::cout << "\t - Unfolding block: " << block->first << '\n';
+  }
 
-      for ( int block_rb = 0; block_rb < num_block_reco_bins; ++block_rb ) {
-        // Convert the current reco bin index at the block level to the one
-        // at the global level
-        int rb = block_bins.reco_bin_indices_.at( block_rb );
+  // The blocks are independent, so unfold them concurrently. Split the
+  // available threads between the blocks so that unfolding algorithms which
+  // are themselves multithreaded do not oversubscribe the machine.
+  size_t num_blocks = blocks.size();
+  size_t num_workers = std::min( num_threads_, num_blocks );
+  size_t threads_per_block = std::max( num_threads_ / num_workers,
+    size_t(1u) );
 
-        // Copy the smearceptance matrix contents into the block
-        block_smearcept( block_rb, block_tb ) = smearcept( rb, tb );
-      }
-    }
+  if ( num_workers > 1u ) ROOT::EnableThreadSafety();
 
-    for ( int block_rb1 = 0; block_rb1 < num_block_reco_bins; ++block_rb1 ) {
-      // Convert the current reco bin index at the block level to the one
-      // at the global level
-      int rb1 = block_bins.reco_bin_indices_.at( block_rb1 );
+  // Each bin belongs to exactly one block, so every task writes to its own
+  // disjoint set of elements in the matrices describing the full measurement
+  const std::vector< size_t > first_column( 1, 0u );
 
-      // Copy the background-subtracted reco bin contents into the block
-      block_data_signal( block_rb1, 0 ) = data_signal( rb1, 0 );
+  parallel_for( num_blocks, num_workers, [ & ]( size_t b ) {
 
-      for ( int block_rb2 = 0; block_rb2 < num_block_reco_bins; ++block_rb2 ) {
-        // Convert the current reco bin index at the block level to the one
-        // at the global level
-        int rb2 = block_bins.reco_bin_indices_.at( block_rb2 );
+    const auto& block_bins = blocks.at( b )->second;
+    const auto& tbins = block_bins.true_bin_indices_;
+    const auto& rbins = block_bins.reco_bin_indices_;
 
-        // Copy the reco-space covariance matrix element into the block
-        block_data_covmat( block_rb1, block_rb2 ) = data_covmat( rb1, rb2 );
-      }
-    }
+    // Extract the inputs for the current block
+    TMatrixD block_data_signal = gather_elements( data_signal, rbins,
+      first_column );
+    TMatrixD block_data_covmat = gather_elements( data_covmat, rbins, rbins );
+    TMatrixD block_smearcept = gather_elements( smearcept, rbins, tbins );
+    TMatrixD block_prior_true_signal = gather_elements( prior_true_signal,
+      tbins, first_column );
 
     // Unfold the measurement for the current block
+    ThreadBudgetGuard budget_guard( threads_per_block );
     auto block_result = this->unfold( block_data_signal, block_data_covmat,
       block_smearcept, block_prior_true_signal );
 
     // Store the partial results for this block in the appropriate parts of the
     // matrices describing the full measurement
-    for ( int block_tb = 0; block_tb < num_block_true_bins; ++block_tb ) {
-
-      // Convert the current true bin index at the block level to the one
-      // at the global level
-      int tb = block_bins.true_bin_indices_.at( block_tb );
-
-      // Copy the unfolded true bin contents from the current block
-      unfolded_signal->operator()( tb, 0 )
-        = block_result.unfolded_signal_->operator()( block_tb, 0 );
-
-      for ( int block_rb = 0; block_rb < num_block_reco_bins; ++block_rb ) {
-
-        // Convert the current reco bin index at the block level to the one
-        // at the global level
-        int rb = block_bins.reco_bin_indices_.at( block_rb );
-
-        // Copy the measurement error propagation matrix element from the
-        // current block
-        err_prop->operator()( tb, rb ) = block_result.err_prop_matrix_
-          ->operator()( block_tb, block_rb );
-
-        // Copy the unfolding matrix element from the current block
-        unfold_mat->operator()( tb, rb ) = block_result.unfolding_matrix_
-          ->operator()( block_tb, block_rb );
-
-        // Copy the response ("smearceptance") matrix element from the
-        // current block
-        resp_mat->operator()( rb, tb ) = block_result.response_matrix_
-          ->operator()( block_rb, block_tb );
-      }
-
-      for ( int block_tb2 = 0; block_tb2 < num_block_true_bins; ++block_tb2 ) {
-
-        // Convert the current true bin index at the block level to the one
-        // at the global level
-        int tb2 = block_bins.true_bin_indices_.at( block_tb2 );
-
-        // Copy the additional smearing matrix element from the current block
-        add_smear->operator()( tb, tb2 ) = block_result.add_smear_matrix_
-          ->operator()( block_tb, block_tb2 );
-      }
-
-    }
-
-  } // block loop
+    scatter_elements( *block_result.unfolded_signal_, tbins, first_column,
+      *unfolded_signal );
+    scatter_elements( *block_result.err_prop_matrix_, tbins, rbins,
+      *err_prop );
+    scatter_elements( *block_result.unfolding_matrix_, tbins, rbins,
+      *unfold_mat );
+    scatter_elements( *block_result.response_matrix_, rbins, tbins,
+      *resp_mat );
+    scatter_elements( *block_result.add_smear_matrix_, tbins, tbins,
+      *add_smear );
+  } );
 
   std::cout << "\nFinished unfolding " << block_map.size() << " block(s)\n\n\n";
 
@@ -1,10 +1,144 @@
+// Standard library includes
+#include <set>
+#if defined( __x86_64__ )
+#include <immintrin.h>
+#endif
+
+// ROOT includes
+#include "TParameter.h"
+#include "TROOT.h"
+
 // XSecAnalyzer includes
+#include "XSecAnalyzer/ColumnarUniverseFile.hh"
+#include "XSecAnalyzer/ThreadUtils.hh"
 #include "XSecAnalyzer/TreeUtils.hh"
 #include "XSecAnalyzer/UniverseMaker.hh"
 
 // Define this static member of the Universe class
 size_t Universe::num_categories_;
 
+namespace {
+
+  // Saves the total simulated POT for a set of ntuple files to the output
+  // directory. This allows SystematicsCalculator to normalize the universes
+  // without reopening the ntuples. Nothing is written unless every file
+  // has a POT value.
+  void write_summed_pot( const std::vector< std::string >& file_names,
+    TDirectory& out_dir )
+  {
+    if ( file_names.empty() ) return;
+
+    float summed_pot = 0.;
+    for ( const auto& file_name : file_names ) {
+      TFile temp_file( file_name.c_str(), "read" );
+      TParameter< float >* temp_pot = nullptr;
+      temp_file.GetObject( SUMMED_POT_NAME.c_str(), temp_pot );
+      if ( !temp_pot ) return;
+
+      summed_pot += temp_pot->GetVal();
+      delete temp_pot;
+    }
+
+    TParameter< float > pot_param( SUMMED_POT_NAME.c_str(), summed_pot );
+    out_dir.WriteTObject( &pot_param, SUMMED_POT_NAME.c_str(), "Overwrite" );
+  }
+
+  // Disables every branch of a TChain except for the named ones. The
+  // trailing wildcard also enables the sub-branches of split objects (e.g.,
+  // the components of a TVector3). It may enable a few extra branches that
+  // share the same prefix, but that is harmless.
+  void select_branches( TChain& chain,
+    const std::set< std::string >& branch_names )
+  {
+    chain.SetBranchStatus( "*", false );
+    for ( const auto& name : branch_names ) {
+      std::string pattern = name + '*';
+      chain.SetBranchStatus( pattern.c_str(), true );
+    }
+  }
+
+  // Splits the families of universes (including the unweighted one) among
+  // up to num_workers workers. The cost of each family is taken to be its
+  // number of universes. Each family is given in turn (from the most to the
+  // least costly) to the worker with the smallest total cost so far. The
+  // assignment does not affect the results, since each family is always
+  // filled by a single worker.
+  std::vector< std::vector< std::string > > assign_weight_branches(
+    const std::map< std::string, UniverseStore >& universes,
+    size_t num_workers )
+  {
+    std::vector< std::pair< size_t, std::string > > families;
+    for ( const auto& pair : universes ) {
+      families.emplace_back( pair.second.num_universes(), pair.first );
+    }
+
+    std::stable_sort( families.begin(), families.end(),
+      []( const auto& a, const auto& b ) { return a.first > b.first; } );
+
+    num_workers = std::max( std::min( num_workers, families.size() ),
+      size_t(1u) );
+
+    std::vector< std::vector< std::string > > assignments( num_workers );
+    std::vector< size_t > costs( num_workers, 0u );
+    for ( const auto& family : families ) {
+      size_t w = std::min_element( costs.begin(), costs.end() )
+        - costs.begin();
+      assignments.at( w ).push_back( family.second );
+      costs.at( w ) += family.first;
+    }
+
+    return assignments;
+  }
+
+  // Scalar version of apply_safe_weights()
+  void apply_safe_weights_scalar( const double* in, size_t n, double factor,
+    double* out )
+  {
+    for ( size_t u = 0u; u < n; ++u ) out[ u ] = safe_weight( in[u] * factor );
+  }
+
+  #if defined( __x86_64__ ) && ( defined( __GNUC__ ) || defined( __clang__ ) )
+  #define XSEC_HAVE_AVX2_WEIGHT_KERNEL
+
+  // AVX2 version of apply_safe_weights(). The ordered comparisons used here
+  // are false for NaN, and infinite values always fall outside of the allowed
+  // range, so the results are identical to those of safe_weight().
+  __attribute__(( target("avx2") )) void apply_safe_weights_avx2(
+    const double* in, size_t n, double factor, double* out )
+  {
+    const __m256d vfactor = _mm256_set1_pd( factor );
+    const __m256d vmin = _mm256_set1_pd( MIN_WEIGHT );
+    const __m256d vmax = _mm256_set1_pd( MAX_WEIGHT );
+    const __m256d vone = _mm256_set1_pd( 1. );
+
+    size_t u = 0u;
+    for ( ; u + 4u <= n; u += 4u ) {
+      __m256d w = _mm256_mul_pd( _mm256_loadu_pd(in + u), vfactor );
+      __m256d ok = _mm256_and_pd( _mm256_cmp_pd(w, vmin, _CMP_GE_OQ),
+        _mm256_cmp_pd(w, vmax, _CMP_LE_OQ) );
+      _mm256_storeu_pd( out + u, _mm256_blendv_pd(vone, w, ok) );
+    }
+
+    apply_safe_weights_scalar( in + u, n - u, factor, out + u );
+  }
+  #endif
+
+}
+
+void apply_safe_weights( const double* in, size_t n, double factor,
+  double* out )
+{
+  #ifdef XSEC_HAVE_AVX2_WEIGHT_KERNEL
+  static const bool use_avx2 = __builtin_cpu_supports( "avx2" );
+  if ( use_avx2 ) {
+    apply_safe_weights_avx2( in, n, factor, out );
+    return;
+  }
+  #endif
+
+  apply_safe_weights_scalar( in, n, factor, out );
+}
+
 UniverseMaker::UniverseMaker( const std::string& config_file_name ) {
   std::ifstream in_file( config_file_name );
   this->init( in_file );
@@ -74,80 +208,232 @@ void UniverseMaker::init( std::istream& in_file ) {
     reco_bins_.push_back( temp_bin );
   }
 
+  // Load the optional sections that may follow the bin definitions. A
+  // configuration file without a bin edge table is handled using the full
+  // bin definitions only. Any other trailing contents are ignored.
+  std::string keyword;
+  while ( in_file >> keyword ) {
+    if ( keyword == BIN_EDGE_TABLE_KEYWORD ) {
+      this->read_bin_edge_table( in_file );
+    }
+    else if ( keyword == UNIVERSE_HISTS_KEYWORD ) {
+      this->read_hist_masks( in_file );
+    }
+    else break;
+  }
+
 }
 
-void UniverseMaker::add_input_file( const std::string& input_file_name )
+void UniverseMaker::read_bin_edge_table( std::istream& in_file ) {
+
+  size_t num_true_edges;
+  in_file >> num_true_edges;
+  for ( size_t e = 0u; e < num_true_edges; ++e ) {
+    BinEdgeRecord temp_rec;
+    in_file >> temp_rec;
+    true_bin_edges_.push_back( temp_rec );
+  }
+
+  size_t num_reco_edges;
+  in_file >> num_reco_edges;
+  for ( size_t e = 0u; e < num_reco_edges; ++e ) {
+    BinEdgeRecord temp_rec;
+    in_file >> temp_rec;
+    reco_bin_edges_.push_back( temp_rec );
+  }
+
+  if ( !in_file ) throw std::runtime_error( "Failed to read the bin edge"
+    " table" );
+}
+
+void UniverseMaker::read_hist_masks( std::istream& in_file ) {
+
+  size_t num_entries = 0u;
+  in_file >> num_entries;
+
+  for ( size_t e = 0u; e < num_entries; ++e ) {
+    std::string weight_name;
+    size_t num_kinds = 0u;
+    in_file >> weight_name >> num_kinds;
+
+    UniverseHistMask mask = 0u;
+    for ( size_t n = 0u; n < num_kinds; ++n ) {
+      std::string suffix;
+      in_file >> suffix;
+
+      bool found = false;
+      for ( size_t k = 0u; k < NUM_UNIVERSE_HIST_KINDS; ++k ) {
+        auto kind = static_cast< UniverseHistKind >( k );
+        if ( suffix == universe_hist_suffix(kind) ) {
+          mask |= universe_hist_bit( kind );
+          found = true;
+        }
+      }
+
+      if ( !found ) throw std::runtime_error( "Unrecognized universe"
+        " histogram kind \"" + suffix + "\" for " + weight_name );
+    }
+
+    if ( !in_file ) throw std::runtime_error( "Failed to read the universe"
+      " histogram settings" );
+
+    if ( ( mask & REQUIRED_UNIVERSE_HISTS ) != REQUIRED_UNIVERSE_HISTS ) {
+      throw std::runtime_error( "The true, reco, 2d, and categ histograms"
+        " must be stored for " + weight_name );
+    }
+
+    hist_masks_[ weight_name ] = mask;
+  }
+}
+
+UniverseHistMask UniverseMaker::hist_mask( const std::string& weight_name )
+  const
 {
-  // Check to make sure that the input file contains the expected ntuple
-  TFile temp_file( input_file_name.c_str(), "read" );
+  // The unweighted and CV universes are used for the MC statistical
+  // uncertainties, so they always keep every histogram
+  if ( weight_name == UNWEIGHTED_NAME || weight_name == TUNE_WEIGHT_NAME
+    || weight_name == PPFX_WEIGHT_NAME )
+  {
+    return ALL_UNIVERSE_HISTS;
+  }
 
-  // Temporary storage
-  TTree* temp_tree;
+  auto iter = hist_masks_.find( weight_name );
+  if ( iter == hist_masks_.end() ) iter = hist_masks_.find( ANY_WEIGHT_NAME );
+  if ( iter == hist_masks_.end() ) return ALL_UNIVERSE_HISTS;
+  return iter->second;
+}
 
-  std::string tree_name = input_chain_.GetName();
-  temp_file.GetObject( tree_name.c_str(), temp_tree );
-  if ( !temp_tree ) throw std::runtime_error( "Missing ntuple TTree "
-    + tree_name + " in the input ntuple file " + input_file_name );
+void UniverseMaker::add_input_file( const std::string& input_file_name )
+{
+  // Check to make sure that the input file contains the expected ntuple
+  this->check_input_file( input_file_name );
 
   // If we've made it here, then the input file has passed all of the checks.
   // Add it to the input TChain.
   input_chain_.AddFile( input_file_name.c_str() );
+  input_file_names_.push_back( input_file_name );
 }
 
-void UniverseMaker::prepare_formulas() {
+UniverseMaker& UniverseMaker::add_configuration(
+  const std::string& config_file_name )
+{
+  std::ifstream in_file( config_file_name );
+  if ( !in_file.good() ) {
+    throw std::runtime_error( "Could not read UniverseMaker configuration"
+      " from the file \"" + config_file_name + '\"' );
+  }
 
-  // Remove any pre-existing TTreeFormula objects from the owned vectors
-  true_bin_formulas_.clear();
-  reco_bin_formulas_.clear();
-  category_formulas_.clear();
+  auto config = std::make_unique< UniverseMaker >( in_file );
 
-  // Create one TTreeFormula for each true bin definition
-  for ( size_t tb = 0u; tb < true_bins_.size(); ++tb ) {
-    const auto& bin_def = true_bins_.at( tb );
-    std::string formula_name = "true_formula_" + std::to_string( tb );
+  if ( std::string( config->input_chain_.GetName() )
+    != input_chain_.GetName() )
+  {
+    throw std::runtime_error( "The configuration in " + config_file_name
+      + " uses a different ntuple TTree name" );
+  }
 
-    auto tbf = std::make_unique< TTreeFormula >( formula_name.c_str(),
-      bin_def.signal_cuts_.c_str(), &input_chain_ );
+  for ( const auto* other : this->configurations() ) {
+    if ( other->output_directory_name_ == config->output_directory_name_ ) {
+      throw std::runtime_error( "The configuration in " + config_file_name
+        + " reuses the output directory name "
+        + config->output_directory_name_ );
+    }
+  }
 
-    tbf->SetQuickLoad( true );
+  config->sparse_matrices_ = sparse_matrices_;
 
-    true_bin_formulas_.emplace_back( std::move(tbf) );
-  }
+  extra_configs_.push_back( std::move(config) );
+  return *extra_configs_.back();
+}
 
-  // Create one TTreeFormula for each reco bin definition
-  for ( size_t rb = 0u; rb < reco_bins_.size(); ++rb ) {
-    const auto& bin_def = reco_bins_.at( rb );
-    std::string formula_name = "reco_formula_" + std::to_string( rb );
+std::vector< const UniverseMaker* > UniverseMaker::configurations() const {
+  std::vector< const UniverseMaker* > configs = { this };
+  for ( const auto& config : extra_configs_ ) configs.push_back( config.get() );
+  return configs;
+}
 
-    auto rbf = std::make_unique< TTreeFormula >( formula_name.c_str(),
-      bin_def.selection_cuts_.c_str(), &input_chain_ );
+uint64_t UniverseMaker::bin_config_hash() const {
+  std::string true_bin_spec, reco_bin_spec;
+  this->get_bin_specs( true_bin_spec, reco_bin_spec );
 
-    rbf->SetQuickLoad( true );
+  std::ostringstream oss;
+  oss << input_chain_.GetName() << '\n' << true_bin_spec << reco_bin_spec
+    << sel_for_categories_->name() << '\n';
 
-    reco_bin_formulas_.emplace_back( std::move(rbf) );
+  for ( const auto& category_pair : sel_for_categories_->category_map() ) {
+    oss << static_cast< int >( category_pair.first ) << '\n';
   }
 
-  // Create one TTreeFormula for each true event category
+  for ( const auto& rec : true_bin_edges_ ) oss << rec << '\n';
+  for ( const auto& rec : reco_bin_edges_ ) oss << rec << '\n';
+
+  return fnv1a_hash( oss.str() );
+}
+
+std::string UniverseMaker::bin_cache_file_name(
+  const std::string& input_file_name ) const
+{
+  std::ostringstream oss;
+  oss << bin_cache_dir_ << '/'
+    << ntuple_subfolder_from_file_name( input_file_name ) << '.'
+    << std::hex << this->bin_config_hash() << ".bincache";
+  return oss.str();
+}
+
+void UniverseMaker::check_input_file( const std::string& input_file_name )
+  const
+{
+  TFile temp_file( input_file_name.c_str(), "read" );
+
+  // Temporary storage
+  TTree* temp_tree;
+
+  std::string tree_name = input_chain_.GetName();
+  temp_file.GetObject( tree_name.c_str(), temp_tree );
+  if ( !temp_tree ) throw std::runtime_error( "Missing ntuple TTree "
+    + tree_name + " in the input ntuple file " + input_file_name );
+}
+
+std::vector< std::string > UniverseMaker::category_cuts() const {
+  std::vector< std::string > cuts;
   const auto& category_map = sel_for_categories_->category_map();
-  Universe::set_num_categories( category_map.size() );
   for ( const auto& category_pair : category_map ) {
 
     int cur_category = static_cast< int >( category_pair.first );
     std::string str_category = std::to_string( cur_category );
 
-    std::string category_formula_name = "category_formula_" + str_category;
-
-    std::string category_cuts = sel_for_categories_->name()
-      + "_EventCategory == " + str_category;
-
-    auto cbf = std::make_unique< TTreeFormula >(
-      category_formula_name.c_str(), category_cuts.c_str(), &input_chain_ );
+    cuts.push_back( sel_for_categories_->name()
+      + "_EventCategory == " + str_category );
+  }
+  return cuts;
+}
 
-    cbf->SetQuickLoad( true );
+void UniverseMaker::prepare_formulas( TChain& chain,
+  BinMatchWorkerConfig& config, const std::string& formula_prefix ) const
+{
+  // Collect the cut expressions for each kind of bin
+  std::vector< std::string > true_cuts;
+  for ( const auto& bin_def : true_bins_ ) {
+    true_cuts.push_back( bin_def.signal_cuts_ );
+  }
 
-    category_formulas_.emplace_back( std::move(cbf) );
+  std::vector< std::string > reco_cuts;
+  for ( const auto& bin_def : reco_bins_ ) {
+    reco_cuts.push_back( bin_def.selection_cuts_ );
   }
 
+  // Use one cut for each true event category
+  std::vector< std::string > category_cuts = this->category_cuts();
+
+  // Compile each set of cuts. Shared sub-expressions (e.g., a common
+  // selection) are evaluated only once per entry within each set. Bins
+  // listed in the edge tables are found using a binary search instead.
+  config.true_bin_lookup_ = std::make_unique< BinLookup >( true_cuts,
+    true_bin_edges_, chain, formula_prefix + "true_formula_" );
+  config.reco_bin_lookup_ = std::make_unique< BinLookup >( reco_cuts,
+    reco_bin_edges_, chain, formula_prefix + "reco_formula_" );
+  config.category_program_ = std::make_unique< CutProgram >( category_cuts,
+    chain, formula_prefix + "category_formula_" );
 }
 
 void UniverseMaker::build_universes(
@@ -166,235 +452,704 @@ void UniverseMaker::build_universes(
     return;
   }
 
+  Universe::set_num_categories( sel_for_categories_->category_map().size() );
+
+  std::vector< std::map<std::string, UniverseStore>* > universes
+    = { &universes_ };
+  for ( auto& config : extra_configs_ ) {
+    universes.push_back( &config->universes_ );
+  }
+
+  this->fill_universes( input_chain_, input_file_names_,
+    universe_branch_names, num_threads_, universes );
+}
+
+void UniverseMaker::build_and_save_universes(
+  const std::vector<UniverseMakerInput>& inputs,
+  const std::string& output_file_name, bool update_file )
+{
+  // Check all of the input files before doing any real work
+  for ( const auto& input : inputs ) {
+    this->check_input_file( input.file_name_ );
+  }
+
+  Universe::set_num_categories( sel_for_categories_->category_map().size() );
+
+  size_t num_workers = std::min( num_threads_, inputs.size() );
+  if ( num_workers > 1u ) ROOT::EnableThreadSafety();
+
+  // Passing in this fake list of explicit branch names instructs
+  // fill_universes() to ignore all event weights
+  const std::vector< std::string > no_weight_branches = { "FAKE_BRANCH_NAME" };
+
+  std::string tfile_option( "recreate" );
+  if ( update_file ) {
+    tfile_option = "update";
+  }
+  TFile out_file( output_file_name.c_str(), tfile_option.c_str() );
+
+  // Only the primary configuration is written to the columnar file, which
+  // holds a single set of bin definitions
+  std::unique_ptr< ColumnarUniverseWriter > columnar_writer;
+  if ( write_columnar_ ) {
+    ColumnarUniverseMetadata metadata;
+    metadata.ntuple_name_ = input_chain_.GetName();
+    metadata.directory_name_ = output_directory_name_;
+    this->get_bin_specs( metadata.true_bin_spec_, metadata.reco_bin_spec_ );
+    metadata.sel_for_categ_ = sel_for_categories_->name();
+
+    columnar_writer = std::make_unique< ColumnarUniverseWriter >(
+      columnar_universe_file_name(output_file_name), metadata );
+  }
+
+  auto configs = this->configurations();
+  size_t num_configs = configs.size();
+
+  // If there are fewer files than threads, then the spare threads are split
+  // evenly among the files. Every file gets the same share regardless of its
+  // position in the list of inputs.
+  size_t threads_per_file = std::max( num_threads_
+    / std::max(num_workers, size_t(1u)), size_t(1u) );
+
+  // Process the input files in waves of num_workers at a time. Each file is
+  // handled by its own task using a separate TChain and universe stores. The
+  // results from each wave are written to the output file in input order
+  // before the next wave starts, so only num_workers sets of universes are
+  // held in memory at once. Each file is processed by fill_universes() in
+  // the same way as by build_universes(). Since every universe store is
+  // filled by a single thread in TChain entry order there, the results do
+  // not depend on the number of threads used for a file.
+  for ( size_t first_input = 0u; first_input < inputs.size();
+    first_input += num_workers )
+  {
+    size_t num_tasks = std::min( num_workers, inputs.size() - first_input );
+
+    // Outer index is the task, inner index is the configuration
+    std::vector< std::vector< std::map<std::string, UniverseStore> > >
+      results( num_tasks );
+
+    parallel_for( num_tasks, num_workers, [ & ]( size_t t ) {
+      const auto& input = inputs.at( first_input + t );
+
+      TChain chain( input_chain_.GetName() );
+      chain.AddFile( input.file_name_.c_str() );
+
+      const std::vector< std::string >* branch_names = nullptr;
+      if ( !input.use_event_weights_ ) branch_names = &no_weight_branches;
+
+      auto& task_results = results.at( t );
+      task_results.resize( num_configs );
+
+      std::vector< std::map<std::string, UniverseStore>* > universes;
+      for ( auto& result : task_results ) universes.push_back( &result );
+
+      this->fill_universes( chain, { input.file_name_ }, branch_names,
+        threads_per_file, universes );
+    } );
+
+    for ( size_t t = 0u; t < num_tasks; ++t ) {
+      const std::string& file_name = inputs.at( first_input + t ).file_name_;
+      std::cout << '\t' << first_input + t << '/' << inputs.size() << " - "
+        << file_name << '\n';
+
+      for ( size_t c = 0u; c < num_configs; ++c ) {
+        TDirectoryFile* sub_tdir = configs.at( c )->prepare_output_directory(
+          out_file, file_name );
+        sub_tdir->cd();
+        configs.at( c )->write_universes( results.at(t).at(c) );
+        write_summed_pot( { file_name }, *sub_tdir );
+      }
+
+      if ( columnar_writer ) {
+        std::string subdir_name = ntuple_subfolder_from_file_name(
+          file_name );
+        for ( const auto& pair : results.at(t).front() ) {
+          columnar_writer->write_store( subdir_name, pair.second );
+        }
+      }
+
+      results.at( t ).clear();
+    }
+  }
+
+  if ( columnar_writer ) columnar_writer->close();
+}
+
+void UniverseMaker::fill_universes( TChain& chain,
+  const std::vector<std::string>& file_names,
+  const std::vector<std::string>* universe_branch_names, size_t num_threads,
+  std::vector< std::map<std::string, UniverseStore>* >& universes ) const
+{
+  auto configs = this->configurations();
+  if ( universes.size() != configs.size() ) {
+    throw std::runtime_error( "Universe store count mismatch in"
+      " UniverseMaker::fill_universes()" );
+  }
+
   WeightHandler wh;
-  wh.set_branch_addresses( input_chain_, universe_branch_names );
+  wh.set_branch_addresses( chain, universe_branch_names );
 
   // Make sure that we always have branches set up for the CV correction
   // weights, i.e., the spline and tune weights. Don't throw an exception if
   // these are missing in the input TTree (we could be working with real data)
-  wh.add_branch( input_chain_, SPLINE_WEIGHT_NAME, false );
-  wh.add_branch( input_chain_, TUNE_WEIGHT_NAME, false );
-  if (useNuMI) wh.add_branch( input_chain_, PPFX_WEIGHT_NAME, false );
+  wh.add_branch( chain, SPLINE_WEIGHT_NAME, false );
+  wh.add_branch( chain, TUNE_WEIGHT_NAME, false );
+  if (useNuMI) wh.add_branch( chain, PPFX_WEIGHT_NAME, false );
 
-  this->prepare_formulas();
+  // Get the first TChain entry so that we can know the number of universes
+  // used in each vector of weights
+  chain.GetEntry( 0 );
+
+  // Now prepare the universe stores with the correct sizes for each
+  // configuration
+  for ( size_t c = 0u; c < configs.size(); ++c ) {
+    configs.at( c )->prepare_universes( wh, *universes.at(c) );
+  }
+
+  chain.ResetBranchAddresses();
+
+  long long num_entries = chain.GetEntries();
+  if ( num_threads > 1u ) ROOT::EnableThreadSafety();
+
+  // Use the bin assignment cache if it is enabled. Each cache file describes
+  // a single ntuple file, so the cache is only used when one is processed by
+  // itself. For each configuration, either read an existing cache file or
+  // record the matches to write a new one.
+  size_t num_configs = configs.size();
+  std::vector< std::unique_ptr<MappedBinAssignmentCache> > cache_readers(
+    num_configs );
+  std::vector< std::unique_ptr<BinAssignmentCacheWriter> > cache_writers(
+    num_configs );
+  std::vector< const MappedBinAssignmentCache* > caches( num_configs,
+    nullptr );
+
+  if ( !bin_cache_dir_.empty() && file_names.size() == 1u ) {
+    const std::string& file_name = file_names.front();
+    auto stamp = NtupleFileStamp::from_file( file_name );
+
+    for ( size_t c = 0u; c < num_configs; ++c ) {
+      const auto* config = configs.at( c );
+      std::string cache_file_name = config->bin_cache_file_name( file_name );
+      uint64_t hash = config->bin_config_hash();
+
+      cache_readers.at( c ) = open_bin_assignment_cache( cache_file_name,
+        hash, stamp, num_entries );
+
+      if ( cache_readers.at(c) ) {
+        caches.at( c ) = cache_readers.at( c ).get();
+      }
+      else {
+        cache_writers.at( c ) = std::make_unique< BinAssignmentCacheWriter >(
+          cache_file_name, hash, stamp, num_entries );
+      }
+    }
+  }
+
+  // The entries are processed in blocks of entries_per_chunk_. For each
+  // block, the matched bins are first found in parallel, with each match
+  // worker handling its own contiguous share of the entries. The universe
+  // stores are then filled in parallel, with each fill worker handling its
+  // own subset of the weight branches for every entry in the block. Since
+  // each store is always filled by a single thread in entry order, the sums
+  // are bit-for-bit identical to those of a serial event loop regardless of
+  // the number of threads or the block size.
+  size_t num_match_workers = std::min( num_threads,
+    static_cast< size_t >( std::max(num_entries, 1LL) ) );
+
+  auto fill_assignments = assign_weight_branches( *universes.front(),
+    num_threads );
+
+  // Each worker owns its own TChain and other mutable state. These are
+  // created up front on the calling thread.
+  std::vector< std::unique_ptr<BinMatchWorker> > match_workers;
+  for ( size_t w = 0u; w < num_match_workers; ++w ) {
+    match_workers.push_back( this->make_match_worker(file_names, caches) );
+  }
+
+  std::vector< std::unique_ptr<UniverseWorker> > fill_workers;
+  for ( const auto& weight_names : fill_assignments ) {
+    fill_workers.push_back( this->make_fill_worker(file_names, weight_names,
+      universes) );
+  }
+
+  for ( long long first = 0; first < num_entries;
+    first += entries_per_chunk_ )
+  {
+    long long last = std::min( first + entries_per_chunk_, num_entries );
+    long long block_size = last - first;
+
+    parallel_for( num_match_workers, num_match_workers, [ & ]( size_t t ) {
+      long long begin = first + block_size * static_cast< long long >( t )
+        / static_cast< long long >( num_match_workers );
+      long long end = first + block_size * static_cast< long long >( t + 1u )
+        / static_cast< long long >( num_match_workers );
+      this->find_matches( *match_workers.at(t), begin, end );
+    } );
+
+    // The cache records are appended in entry order
+    for ( const auto& match_worker : match_workers ) {
+      for ( size_t c = 0u; c < num_configs; ++c ) {
+        if ( !cache_writers.at(c) ) continue;
+        cache_writers.at( c )->append(
+          match_worker->configs_.at( c ).matches_ );
+      }
+    }
+
+    parallel_for( fill_workers.size(), fill_workers.size(),
+      [ & ]( size_t t ) {
+        this->fill_entries( *fill_workers.at(t), match_workers );
+      } );
+  }
+
+  for ( auto& writer : cache_writers ) {
+    if ( writer ) writer->close();
+  }
+}
+
+std::unique_ptr< BinMatchWorker > UniverseMaker::make_match_worker(
+  const std::vector<std::string>& file_names,
+  const std::vector< const MappedBinAssignmentCache* >& caches ) const
+{
+  auto worker = std::make_unique< BinMatchWorker >();
+
+  TChain& chain = worker->chain_;
+  chain.SetName( input_chain_.GetName() );
+  for ( const auto& file_name : file_names ) {
+    chain.AddFile( file_name.c_str() );
+  }
+
+  // Set up the compiled cuts for each configuration unless cached bin
+  // assignments will be used instead. The TTreeFormula names for the extra
+  // configurations get a distinct prefix.
+  auto configs = this->configurations();
+  worker->configs_.resize( configs.size() );
+
+  std::set< std::string > branch_names;
+  for ( size_t c = 0u; c < configs.size(); ++c ) {
+    auto& worker_config = worker->configs_.at( c );
+
+    worker_config.cache_ = caches.at( c );
+    if ( worker_config.cache_ ) continue;
+
+    std::string prefix;
+    if ( c > 0u ) prefix = "config" + std::to_string( c ) + '_';
+    configs.at( c )->prepare_formulas( chain, worker_config, prefix );
+
+    worker_config.true_bin_lookup_->add_used_branches( branch_names );
+    worker_config.reco_bin_lookup_->add_used_branches( branch_names );
+    worker_config.category_program_->add_used_branches( branch_names );
+  }
 
   // Set up storage for the "is_mc" boolean flag branch. If we're not working
   // with MC events, then we shouldn't do anything with the true bin counts.
-  bool is_mc;
-  input_chain_.SetBranchAddress( "is_mc", &is_mc );
+  chain.SetBranchAddress( "is_mc", &worker->is_mc_ );
+  branch_names.insert( "is_mc" );
+
+  // Only the branches that are actually used will be read for each entry
+  select_branches( chain, branch_names );
+
+  return worker;
+}
+
+std::unique_ptr< UniverseWorker > UniverseMaker::make_fill_worker(
+  const std::vector<std::string>& file_names,
+  const std::vector<std::string>& weight_names,
+  std::vector< std::map<std::string, UniverseStore>* >& universes ) const
+{
+  auto worker = std::make_unique< UniverseWorker >();
+
+  TChain& chain = worker->chain_;
+  chain.SetName( input_chain_.GetName() );
+  for ( const auto& file_name : file_names ) {
+    chain.AddFile( file_name.c_str() );
+  }
+
+  auto is_owned = [ &weight_names ]( const std::string& name ) {
+    return std::find( weight_names.cbegin(), weight_names.cend(), name )
+      != weight_names.cend();
+  };
+
+  // Read the weight branches filled by this worker together with those
+  // needed for the CV corrections
+  std::vector< std::string > branch_names;
+  for ( const auto& name : weight_names ) {
+    if ( name != UNWEIGHTED_NAME ) branch_names.push_back( name );
+  }
+
+  WeightHandler& wh = worker->wh_;
+  wh.set_branch_addresses( chain, &branch_names );
+  wh.add_branch( chain, SPLINE_WEIGHT_NAME, false );
+  wh.add_branch( chain, TUNE_WEIGHT_NAME, false );
+  if (useNuMI) wh.add_branch( chain, PPFX_WEIGHT_NAME, false );
+
+  chain.SetBranchAddress( "is_mc", &worker->is_mc_ );
 
   // set CV weight addresses, NuMI-specific
-  float tune_weight_numi = 1;
-  float ppfx_weight_numi = 1;
-  float normalisation_weight_numi = 1;
   if (useNuMI) {
-    input_chain_.SetBranchAddress( "tuned_cv_weight", &tune_weight_numi );
-    input_chain_.SetBranchAddress( "ppfx_cv_weight", &ppfx_weight_numi );
-    input_chain_.SetBranchAddress( "normalisation_weight", &normalisation_weight_numi );
+    chain.SetBranchAddress( "tuned_cv_weight", &worker->tune_weight_numi_ );
+    chain.SetBranchAddress( "ppfx_cv_weight", &worker->ppfx_weight_numi_ );
+    chain.SetBranchAddress( "normalisation_weight",
+      &worker->normalisation_weight_numi_ );
   }
 
-  // Get the first TChain entry so that we can know the number of universes
-  // used in each vector of weights
-  input_chain_.GetEntry( 0 );
+  std::set< std::string > used_branches = { "is_mc" };
+  for ( const auto& pair : wh.weight_map() ) {
+    used_branches.insert( pair.first );
+  }
+  if ( useNuMI ) {
+    used_branches.insert( "tuned_cv_weight" );
+    used_branches.insert( "ppfx_cv_weight" );
+    used_branches.insert( "normalisation_weight" );
+  }
+  select_branches( chain, used_branches );
 
-  // Now prepare the vectors of Universe objects with the correct sizes
-  this->prepare_universes( wh );
+  // Look up the stores and CV correction type for each weight branch once
+  // here rather than for every event
+  size_t num_configs = universes.size();
+  worker->weight_stores_.resize( num_configs );
 
-  int treenumber = 0;
-  for ( long long entry = 0; entry < input_chain_.GetEntries(); ++entry ) {
-    // Load the TTree for the current TChain entry
-    input_chain_.LoadTree( entry );
+  size_t max_num_universes = 0u;
+  for ( const auto& pair : wh.weight_map() ) {
+    bool owned = is_owned( pair.first );
+    for ( size_t c = 0u; c < num_configs; ++c ) {
+      UniverseStore* store = nullptr;
+      if ( owned ) {
+        store = &universes.at( c )->at( pair.first );
+        max_num_universes = std::max( max_num_universes,
+          store->num_universes() );
+      }
+      worker->weight_stores_.at( c ).push_back( store );
+    }
+    worker->cv_types_.push_back( get_cv_correction_type(pair.first) );
+  }
+  worker->safe_weights_.resize( max_num_universes );
 
-    // If the current entry is in a new TTree, then have all of the
-    // TTreeFormula objects make the necessary updates
-    if ( treenumber != input_chain_.GetTreeNumber() ) {
-      treenumber = input_chain_.GetTreeNumber();
-      for ( auto& tbf : true_bin_formulas_ ) tbf->Notify();
-      for ( auto& rbf : reco_bin_formulas_ ) rbf->Notify();
-      for ( auto& cbf : category_formulas_ ) cbf->Notify();
+  if ( is_owned(UNWEIGHTED_NAME) ) {
+    for ( auto* config_universes : universes ) {
+      worker->unweighted_stores_.push_back(
+        &config_universes->at(UNWEIGHTED_NAME) );
     }
+  }
 
-    // Find the reco bin(s) that should be filled for the current event
-    std::vector< FormulaMatch > matched_reco_bins;
-    for ( size_t rb = 0u; rb < reco_bin_formulas_.size(); ++rb ) {
-      auto& rbf = reco_bin_formulas_.at( rb );
-      int num_formula_elements = rbf->GetNdata();
-      for ( int el = 0; el < num_formula_elements; ++el ) {
-        double formula_wgt = rbf->EvalInstance( el );
-        if ( formula_wgt ) matched_reco_bins.emplace_back( rb, formula_wgt );
+  return worker;
+}
+
+void UniverseMaker::find_matches( BinMatchWorker& worker,
+  long long first, long long last ) const
+{
+  worker.first_entry_ = first;
+  worker.num_entries_ = last - first;
+
+  bool need_entries = false;
+  for ( auto& config : worker.configs_ ) {
+    config.matches_.clear();
+    if ( !config.cache_ ) need_entries = true;
+  }
+
+  // Nothing needs to be read if every configuration uses a cache
+  if ( !need_entries ) return;
+
+  TChain& chain = worker.chain_;
+
+  // Reusable storage for the matches found for the current entry
+  std::vector< FormulaMatch > reco_matches;
+  std::vector< FormulaMatch > categ_matches;
+  std::vector< FormulaMatch > true_matches;
+
+  for ( long long entry = first; entry < last; ++entry ) {
+    // Read the enabled branches for the current TChain entry. This loads the
+    // right TTree as needed. All of the compiled cuts use the values read
+    // here.
+    chain.GetEntry( entry );
+
+    // If the current entry is in a new TTree, then have all of the
+    // compiled cuts make the necessary updates
+    if ( worker.tree_number_ != chain.GetTreeNumber() ) {
+      worker.tree_number_ = chain.GetTreeNumber();
+      for ( auto& config : worker.configs_ ) {
+        if ( config.cache_ ) continue;
+        config.true_bin_lookup_->notify();
+        config.reco_bin_lookup_->notify();
+        config.category_program_->notify();
       }
     }
 
-    // Find the EventCategory label(s) that apply to the current event
-    std::vector< FormulaMatch > matched_category_indices;
-    for ( size_t c = 0u; c < category_formulas_.size(); ++c ) {
-      auto& cbf = category_formulas_.at( c );
-      int num_formula_elements = cbf->GetNdata();
-      for ( int el = 0; el < num_formula_elements; ++el ) {
-        double formula_wgt = cbf->EvalInstance( el );
-        if ( formula_wgt ) {
-          matched_category_indices.emplace_back( c, formula_wgt );
-        }
+    for ( auto& config : worker.configs_ ) {
+      if ( config.cache_ ) continue;
+
+      reco_matches.clear();
+      categ_matches.clear();
+      true_matches.clear();
+
+      // Find the reco bin(s) that should be filled for the current event
+      config.reco_bin_lookup_->evaluate( [ & ]( size_t rb, double wgt ) {
+        reco_matches.emplace_back( rb, wgt );
+      } );
+
+      // Find the EventCategory label(s) that apply to the current event
+      config.category_program_->evaluate( [ & ]( size_t cat, double wgt ) {
+        categ_matches.emplace_back( cat, wgt );
+      } );
+
+      // If we're working with an MC sample, then find the true bin(s)
+      // that should be filled for the current event
+      if ( worker.is_mc_ ) {
+        config.true_bin_lookup_->evaluate( [ & ]( size_t tb, double wgt ) {
+          true_matches.emplace_back( tb, wgt );
+        } );
       }
-    }
 
-    input_chain_.GetEntry( entry );
-
-    std::vector< FormulaMatch > matched_true_bins;
-    double spline_weight = 0.;
-    double tune_weight = 0.;
-    double ppfx_weight = 0.;           // NuMI-specific
-    double normalisation_weight = 0.;  // NuMI-specific
-
-    // If we're working with an MC sample, then find the true bin(s)
-    // that should be filled for the current event
-    if ( is_mc ) {
-      for ( size_t tb = 0u; tb < true_bin_formulas_.size(); ++tb ) {
-        auto& tbf = true_bin_formulas_.at( tb );
-        int num_formula_elements = tbf->GetNdata();
-        for ( int el = 0; el < num_formula_elements; ++el ) {
-          double formula_wgt = tbf->EvalInstance( el );
-          if ( formula_wgt ) matched_true_bins.emplace_back( tb, formula_wgt );
-        }
-      } // true bins
-
-      // If we have event weights in the map at all, then get the current
-      // event's CV correction weights here for potentially frequent re-use
-      // below
-      // NuMI
-      // access CV weights (NuMI-specific)
-      if (useNuMI) {
-        spline_weight = 1; // not filled in NuMI
-        tune_weight = tune_weight_numi;
-        ppfx_weight = ppfx_weight_numi;
-        normalisation_weight = normalisation_weight_numi;
+      auto& buffer = config.matches_;
+      buffer.begin_entry( true_matches.size(), reco_matches.size(),
+        categ_matches.size() );
+      for ( const auto& m : true_matches ) {
+        buffer.add_match( m.bin_index_, m.weight_ );
       }
-      else {
-        auto& wm = wh.weight_map();
-        if ( wm.size() > 0u ) {
-          spline_weight = wm.at( SPLINE_WEIGHT_NAME )->front();
-          tune_weight = wm.at( TUNE_WEIGHT_NAME )->front();
-        }
+      for ( const auto& m : reco_matches ) {
+        buffer.add_match( m.bin_index_, m.weight_ );
       }
-    } // MC event
-
-    for ( const auto& pair : wh.weight_map() ) {
-      const std::string& wgt_name = pair.first;
-      const auto& wgt_vec = pair.second;
-
-      auto& u_vec = universes_.at( wgt_name );
+      for ( const auto& m : categ_matches ) {
+        buffer.add_match( m.bin_index_, m.weight_ );
+      }
+    } // configurations
+  } // TChain entries
+}
 
-      for ( size_t u = 0u; u < wgt_vec->size(); ++u ) {
+void UniverseMaker::fill_entries( UniverseWorker& worker,
+  const std::vector< std::unique_ptr<BinMatchWorker> >& match_workers ) const
+{
+  TChain& chain = worker.chain_;
+  WeightHandler& wh = worker.wh_;
+  const bool& is_mc = worker.is_mc_;
+
+  // Reusable storage for the bins and categories matched by the current
+  // entry in each configuration
+  size_t num_configs = worker.weight_stores_.size();
+  std::vector< std::vector<FormulaMatch> > matched_reco_bins( num_configs );
+  std::vector< std::vector<FormulaMatch> > matched_category_indices(
+    num_configs );
+  std::vector< std::vector<FormulaMatch> > matched_true_bins( num_configs );
+
+  // The match workers cover consecutive ranges of entries
+  for ( const auto& match_worker : match_workers ) {
+    for ( long long i = 0; i < match_worker->num_entries_; ++i ) {
+      long long entry = match_worker->first_entry_ + i;
+
+      // Read the weights for the current TChain entry
+      chain.GetEntry( entry );
+
+      for ( size_t c = 0u; c < num_configs; ++c ) {
+        auto& reco_matches = matched_reco_bins[ c ];
+        auto& categ_matches = matched_category_indices[ c ];
+        auto& true_matches = matched_true_bins[ c ];
+        reco_matches.clear();
+        categ_matches.clear();
+        true_matches.clear();
+
+        auto on_match = [ & ]( BinAssignmentKind kind, uint32_t index,
+          double wgt )
+        {
+          switch ( kind ) {
+            case kTrueBinAssignment:
+              true_matches.emplace_back( index, wgt );
+              break;
+            case kRecoBinAssignment:
+              reco_matches.emplace_back( index, wgt );
+              break;
+            case kCategoryAssignment:
+              categ_matches.emplace_back( index, wgt );
+              break;
+          }
+        };
 
-        // No need to use the slightly slower "at" here since we're directly
-        // looping over the weight vector
-        double w = wgt_vec->operator[]( u );
+        // Retrieve the matches found by the match worker (or by an earlier
+        // run if the cache is used)
+        const auto& match_config = match_worker->configs_[ c ];
+        if ( match_config.cache_ ) {
+          match_config.cache_->read_entry( entry, on_match );
+        }
+        else match_config.matches_.read_entry( i, on_match );
+      } // configurations
+
+      double spline_weight = 0.;
+      double tune_weight = 0.;
+      double ppfx_weight = 0.;           // NuMI-specific
+      double normalisation_weight = 0.;  // NuMI-specific
+
+      if ( is_mc ) {
+        // If we have event weights in the map at all, then get the current
+        // event's CV correction weights here for potentially frequent re-use
+        // below
+        // NuMI
+        // access CV weights (NuMI-specific)
+        if (useNuMI) {
+          spline_weight = 1; // not filled in NuMI
+          tune_weight = worker.tune_weight_numi_;
+          ppfx_weight = worker.ppfx_weight_numi_;
+          normalisation_weight = worker.normalisation_weight_numi_;
+        }
+        else {
+          auto& wm = wh.weight_map();
+          if ( wm.size() > 0u ) {
+            spline_weight = wm.at( SPLINE_WEIGHT_NAME )->front();
+            tune_weight = wm.at( TUNE_WEIGHT_NAME )->front();
+          }
+        }
+      } // MC event
+
+      size_t branch_index = 0u;
+      for ( const auto& pair : wh.weight_map() ) {
+        const std::string& wgt_name = pair.first;
+        const auto& wgt_vec = pair.second;
+
+        // Skip branches that are only read for the CV corrections. All
+        // configurations share the same universe counts.
+        const auto* first_store = worker.weight_stores_.front()[ branch_index ];
+        if ( !first_store ) {
+          ++branch_index;
+          continue;
+        }
 
-        // Multiply by any needed CV correction weights
-        if (useNuMI) apply_cv_correction_weights( wgt_name, w, spline_weight, tune_weight, ppfx_weight, normalisation_weight );
-        else apply_cv_correction_weights( wgt_name, w, spline_weight, tune_weight );
+        CVCorrectionType cv_type = worker.cv_types_[ branch_index ];
 
-        // Deal with NaNs, etc. to make a "safe weight" in all cases
-        double safe_wgt = safe_weight( w );
+        size_t num_universes = wgt_vec->size();
+        if ( num_universes > first_store->num_universes() ) {
+          throw std::runtime_error( "Too many universes found for "
+            + wgt_name + " in entry " + std::to_string(entry) );
+        }
 
-        // Get the universe object that should be filled with the processed
-        // event weight
-        auto& universe = u_vec.at( u );
+        // Multiply by any needed CV correction weights and deal with NaNs,
+        // etc. to make a "safe weight" in all universes. This is done only
+        // once for all of the configurations.
+        double cv_factor;
+        if (useNuMI) cv_factor = cv_correction_factor( cv_type, spline_weight, tune_weight, ppfx_weight, normalisation_weight );
+        else cv_factor = cv_correction_factor( cv_type, spline_weight, tune_weight );
+
+        double* safe_wgts = worker.safe_weights_.data();
+        apply_safe_weights( wgt_vec->data(), num_universes, cv_factor,
+          safe_wgts );
+
+        for ( size_t c = 0u; c < num_configs; ++c ) {
+          auto& store = *worker.weight_stores_[ c ][ branch_index ];
+          const auto& reco_matches = matched_reco_bins[ c ];
+          const auto& categ_matches = matched_category_indices[ c ];
+          const auto& true_matches = matched_true_bins[ c ];
+
+          // The reco vs. reco and true vs. true histograms need a number of
+          // fills that grows quadratically with the number of matches, so skip
+          // them entirely when they are not stored
+          bool fill_reco2d = store.has_hist( kReco2DUniverseHist );
+          bool fill_true2d = store.has_hist( kTrue2DUniverseHist );
 
-        for ( const auto& tb : matched_true_bins ) {
           // TODO: consider including the TTreeFormula weight(s) in the check
           // applied via safe_weight() above
-          universe.hist_true_->Fill( tb.bin_index_, tb.weight_ * safe_wgt );
-          for ( const auto& rb : matched_reco_bins ) {
-            universe.hist_2d_->Fill( tb.bin_index_, rb.bin_index_,
-              tb.weight_ * rb.weight_ * safe_wgt );
+          for ( const auto& tb : true_matches ) {
+            store.fill_true( tb.bin_index_, tb.weight_, safe_wgts,
+              num_universes );
+
+            for ( const auto& rb : reco_matches ) {
+              store.fill_2d( tb.bin_index_, rb.bin_index_,
+                tb.weight_ * rb.weight_, safe_wgts, num_universes );
+            } // reco bins
+
+            if ( !fill_true2d ) continue;
+
+            for ( const auto& other_tb : true_matches ) {
+              store.fill_true2d( tb.bin_index_, other_tb.bin_index_,
+                tb.weight_ * other_tb.weight_, safe_wgts, num_universes );
+            } // true bins
+
+          } // true bins
+
+          for ( const auto& rb : reco_matches ) {
+            store.fill_reco( rb.bin_index_, rb.weight_, safe_wgts,
+              num_universes );
+
+            for ( const auto& cat : categ_matches ) {
+              store.fill_categ( cat.bin_index_, rb.bin_index_,
+                cat.weight_ * rb.weight_, safe_wgts, num_universes );
+            }
+
+            if ( !fill_reco2d ) continue;
+
+            for ( const auto& other_rb : reco_matches ) {
+              store.fill_reco2d( rb.bin_index_, other_rb.bin_index_,
+                rb.weight_ * other_rb.weight_, safe_wgts, num_universes );
+            }
+          } // reco bins
+        } // configurations
+
+        ++branch_index;
+      } // weight names
+
+      // Fill the unweighted histograms now that we're done with the
+      // weighted ones. Note that "unweighted" in this context applies to
+      // the universe event weights, but that any implicit weights from
+      // the TTreeFormula evaluations will still be applied.
+      // These are only filled by the worker that owns them.
+      for ( size_t c = 0u; c < worker.unweighted_stores_.size(); ++c ) {
+        auto& unw_store = *worker.unweighted_stores_[ c ];
+        const auto& reco_matches = matched_reco_bins[ c ];
+        const auto& categ_matches = matched_category_indices[ c ];
+        const auto& true_matches = matched_true_bins[ c ];
+
+        for ( const auto& tb : true_matches ) {
+          unw_store.fill_true( 0u, tb.bin_index_, tb.weight_ );
+          for ( const auto& rb : reco_matches ) {
+            unw_store.fill_2d( 0u, tb.bin_index_, rb.bin_index_,
+              tb.weight_ * rb.weight_ );
           } // reco bins
 
-          for ( const auto& other_tb : matched_true_bins ) {
-            universe.hist_true2d_->Fill( tb.bin_index_, other_tb.bin_index_,
-              tb.weight_ * other_tb.weight_ * safe_wgt );
+          for ( const auto& other_tb : true_matches ) {
+            unw_store.fill_true2d( 0u, tb.bin_index_, other_tb.bin_index_,
+              tb.weight_ * other_tb.weight_ );
           } // true bins
 
         } // true bins
 
-        for ( const auto& rb : matched_reco_bins ) {
-          universe.hist_reco_->Fill( rb.bin_index_, rb.weight_ * safe_wgt );
+        for ( const auto& rb : reco_matches ) {
 
-          for ( const auto& c : matched_category_indices ) {
-            universe.hist_categ_->Fill( c.bin_index_, rb.bin_index_,
-              c.weight_ * rb.weight_ * safe_wgt );
-          }
+          unw_store.fill_reco( 0u, rb.bin_index_, rb.weight_ );
 
-          for ( const auto& other_rb : matched_reco_bins ) {
-            universe.hist_reco2d_->Fill( rb.bin_index_, other_rb.bin_index_,
-              rb.weight_ * other_rb.weight_ * safe_wgt );
+          for ( const auto& cat : categ_matches ) {
+            unw_store.fill_categ( 0u, cat.bin_index_, rb.bin_index_,
+              cat.weight_ * rb.weight_ );
           }
-        } // reco bins
-      } // universes
-    } // weight names
-
-    // Fill the unweighted histograms now that we're done with the
-    // weighted ones. Note that "unweighted" in this context applies to
-    // the universe event weights, but that any implicit weights from
-    // the TTreeFormula evaluations will still be applied.
-    auto& univ = universes_.at( UNWEIGHTED_NAME ).front();
-    for ( const auto& tb : matched_true_bins ) {
-      univ.hist_true_->Fill( tb.bin_index_, tb.weight_ );
-      for ( const auto& rb : matched_reco_bins ) {
-        univ.hist_2d_->Fill( tb.bin_index_, rb.bin_index_,
-          tb.weight_ * rb.weight_ );
-      } // reco bins
-
-      for ( const auto& other_tb : matched_true_bins ) {
-        univ.hist_true2d_->Fill( tb.bin_index_, other_tb.bin_index_,
-          tb.weight_ * other_tb.weight_ );
-      } // true bins
-
-    } // true bins
-
-    for ( const auto& rb : matched_reco_bins ) {
-
-      univ.hist_reco_->Fill( rb.bin_index_, rb.weight_ );
-
-      for ( const auto& c : matched_category_indices ) {
-        univ.hist_categ_->Fill( c.bin_index_, rb.bin_index_,
-          c.weight_ * rb.weight_ );
-      }
-
-      for ( const auto& other_rb : matched_reco_bins ) {
-        univ.hist_reco2d_->Fill( rb.bin_index_, other_rb.bin_index_,
-          rb.weight_ * other_rb.weight_ );
-      }
 
-    } // reco bins
+          for ( const auto& other_rb : reco_matches ) {
+            unw_store.fill_reco2d( 0u, rb.bin_index_, other_rb.bin_index_,
+              rb.weight_ * other_rb.weight_ );
+          }
 
-  } // TChain entries
+        } // reco bins
+      } // configurations
 
-  input_chain_.ResetBranchAddresses();
+    } // TChain entries
+  } // match workers
 }
 
-void UniverseMaker::prepare_universes( const WeightHandler& wh ) {
 
+void UniverseMaker::prepare_universes( const WeightHandler& wh,
+  std::map< std::string, UniverseStore >& universes ) const
+{
   size_t num_true_bins = true_bins_.size();
   size_t num_reco_bins = reco_bins_.size();
+  size_t num_categories = sel_for_categories_->category_map().size();
 
   for ( const auto& pair : wh.weight_map() ) {
     const std::string& weight_name = pair.first;
     size_t num_universes = pair.second->size();
 
-    std::vector< Universe > u_vec;
-
-    for ( size_t u = 0u; u < num_universes; ++u ) {
-      u_vec.emplace_back( weight_name, u, num_true_bins, num_reco_bins );
-    }
-
-    universes_[ weight_name ] = std::move( u_vec );
+    universes.erase( weight_name );
+    universes.emplace( weight_name, UniverseStore( weight_name,
+      num_universes, num_true_bins, num_reco_bins, num_categories,
+      sparse_matrices_, this->hist_mask(weight_name) ) );
   }
 
   // Add the special "unweighted" universe unconditionally
-  std::vector< Universe > temp_uvec;
-  temp_uvec.emplace_back( UNWEIGHTED_NAME, 0, num_true_bins, num_reco_bins );
-  universes_[ UNWEIGHTED_NAME ] = std::move( temp_uvec );
+  universes.erase( UNWEIGHTED_NAME );
+  universes.emplace( UNWEIGHTED_NAME, UniverseStore( UNWEIGHTED_NAME, 1u,
+    num_true_bins, num_reco_bins, num_categories, sparse_matrices_ ) );
 
 }
 
@@ -412,6 +1167,24 @@ void UniverseMaker::save_histograms(
   }
   TFile out_file( output_file_name.c_str(), tfile_option.c_str() );
 
+  // Each configuration is saved to its own root TDirectoryFile
+  for ( const auto* config : this->configurations() ) {
+    TDirectoryFile* sub_tdir = config->prepare_output_directory( out_file,
+      subdirectory_name );
+
+    // Now we've found (or created) the TDirectoryFile where the output
+    // will be saved. Ensure that it is the active file here before writing
+    // out the histograms.
+    sub_tdir->cd();
+
+    config->write_universes( config->universes_ );
+    write_summed_pot( input_file_names_, *sub_tdir );
+  }
+}
+
+TDirectoryFile* UniverseMaker::prepare_output_directory( TFile& out_file,
+  const std::string& subdirectory_name ) const
+{
   // Navigate to the subdirectory within the output ROOT file where the
   // universe histograms will be saved. Create new TDirectoryFile objects as
   // needed.
@@ -432,20 +1205,9 @@ void UniverseMaker::save_histograms(
   // match the current configuration. In the event of a mismatch, throw an
   // exception to avoid data corruption.
   std::string tree_name, true_bin_spec, reco_bin_spec;
-  tree_name = this->input_chain().GetName();
+  tree_name = input_chain_.GetName();
 
-  std::ostringstream oss_true, oss_reco;
-
-  for ( const auto& tbin : true_bins_ ) {
-    oss_true << tbin << '\n';
-  }
-
-  for ( const auto& rbin : reco_bins_ ) {
-    oss_reco << rbin << '\n';
-  }
-
-  true_bin_spec = oss_true.str();
-  reco_bin_spec = oss_reco.str();
+  this->get_bin_specs( true_bin_spec, reco_bin_spec );
 
   std::string* saved_tree_name = nullptr;
   std::string* saved_tb_spec = nullptr;
@@ -504,25 +1266,48 @@ void UniverseMaker::save_histograms(
       "", root_tdir );
   }
 
-  // Now we've found (or created) the TDirectoryFile where the output
-  // will be saved. Ensure that it is the active file here before writing
-  // out the histograms.
-  sub_tdir->cd();
+  return sub_tdir;
+}
 
-  for ( auto& pair : universes_ ) {
-    auto& u_vec = pair.second;
-    for ( auto& univ : u_vec ) {
-      // Always save the reco histograms
-      univ.hist_reco_->Write();
-      univ.hist_reco2d_->Write();
+void UniverseMaker::get_bin_specs( std::string& true_bin_spec,
+  std::string& reco_bin_spec ) const
+{
+  std::ostringstream oss_true, oss_reco;
+
+  for ( const auto& tbin : true_bins_ ) {
+    oss_true << tbin << '\n';
+  }
+
+  for ( const auto& rbin : reco_bins_ ) {
+    oss_reco << rbin << '\n';
+  }
+
+  true_bin_spec = oss_true.str();
+  reco_bin_spec = oss_reco.str();
+}
+
+void UniverseMaker::write_universes(
+  const std::map< std::string, UniverseStore >& universes ) const
+{
+  // Build the histograms for one universe at a time so that only a single
+  // set needs to be held in memory while writing
+  for ( const auto& pair : universes ) {
+    const auto& store = pair.second;
+    for ( size_t u = 0u; u < store.num_universes(); ++u ) {
+      auto univ = store.make_universe( u );
+
+      // Always save the reco histograms. The reco vs. reco and true vs. true
+      // histograms are only present if they were requested for this family.
+      univ->hist_reco_->Write();
+      if ( univ->hist_reco2d_ ) univ->hist_reco2d_->Write();
 
       // Save the others if the true histogram was filled at least once
       // (used to infer that we have MC truth information)
-      if ( univ.hist_true_->GetEntries() > 0. ) {
-        univ.hist_true_->Write();
-        univ.hist_2d_->Write();
-        univ.hist_categ_->Write();
-        univ.hist_true2d_->Write();
+      if ( univ->hist_true_->GetEntries() > 0. ) {
+        univ->hist_true_->Write();
+        univ->hist_2d_->Write();
+        univ->hist_categ_->Write();
+        if ( univ->hist_true2d_ ) univ->hist_true2d_->Write();
       }
     } // universes
   } // weight names
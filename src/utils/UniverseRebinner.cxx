@@ -0,0 +1,495 @@
+// Standard library includes
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+// ROOT includes
+#include "TFile.h"
+#include "TH2D.h"
+#include "TKey.h"
+
+// XSecAnalyzer includes
+#include "XSecAnalyzer/UniverseRebinner.hh"
+
+namespace {
+
+  // Checks that a single section of a bin merge map uses every new bin index
+  // in a contiguous range and returns the number of new bins
+  size_t check_merge_map( const std::vector< int >& map,
+    const std::string& kind )
+  {
+    int max_index = -1;
+    for ( int idx : map ) {
+      if ( idx < -1 ) throw std::runtime_error( "Invalid new " + kind
+        + " bin index " + std::to_string(idx) + " in the bin merge map" );
+      if ( idx > max_index ) max_index = idx;
+    }
+
+    size_t num_new_bins = max_index + 1;
+    std::vector< bool > used( num_new_bins, false );
+    for ( int idx : map ) {
+      if ( idx >= 0 ) used.at( idx ) = true;
+    }
+
+    for ( size_t b = 0u; b < num_new_bins; ++b ) {
+      if ( !used.at(b) ) throw std::runtime_error( "The new " + kind
+        + " bin " + std::to_string(b) + " is not used by the bin merge map" );
+    }
+
+    return num_new_bins;
+  }
+
+  // Shared implementation of merge_true_bins() and merge_reco_bins()
+  template < typename Bin > std::vector< Bin > merge_bins(
+    const std::vector< Bin >& bins, const std::vector< int >& map,
+    size_t num_new_bins, std::string Bin::* cuts )
+  {
+    std::vector< Bin > merged( num_new_bins );
+    std::vector< size_t > num_merged( num_new_bins, 0u );
+
+    for ( size_t b = 0u; b < bins.size(); ++b ) {
+      int new_b = map.at( b );
+      if ( new_b < 0 ) continue;
+
+      const Bin& old_bin = bins.at( b );
+      Bin& new_bin = merged.at( new_b );
+
+      if ( num_merged.at(new_b) == 0u ) {
+        new_bin = old_bin;
+      }
+      else {
+        if ( old_bin.type_ != new_bin.type_
+          || old_bin.block_index_ != new_bin.block_index_ )
+        {
+          throw std::runtime_error( "Cannot merge bin " + std::to_string(b)
+            + " into new bin " + std::to_string(new_b) + " because their"
+            " types or block indices differ" );
+        }
+
+        if ( num_merged.at(new_b) == 1u ) {
+          new_bin.*cuts = '(' + new_bin.*cuts + ')';
+        }
+        new_bin.*cuts += " || (" + old_bin.*cuts + ')';
+      }
+
+      ++num_merged.at( new_b );
+    }
+
+    return merged;
+  }
+
+  // Returns the summed squared weights for a global histogram bin. If they
+  // are not stored, then the bin content is used as for TH1::GetBinError().
+  double get_sumw2( const TH1& hist, int bin ) {
+    if ( hist.GetSumw2N() == 0 ) return hist.GetBinContent( bin );
+    return hist.GetSumw2()->At( bin );
+  }
+
+  // Checks that the original bins merged into each new bin can be combined
+  // exactly, using the unweighted universe histograms stored in a single
+  // ntuple subfolder. Adding the summed squared weights of the merged bins is
+  // only correct if no event fills more than one of them, and combining their
+  // cuts with a logical OR is only correct if those cuts do not also apply an
+  // event weight. An event that fills two bins leaves an entry off the
+  // diagonal of the matching bin-bin histogram, while a bin that only ever
+  // receives unit weights has equal summed weights and squared weights.
+  void check_merged_bins( TDirectory& dir, const std::vector< int >& map,
+    size_t num_new_bins, UniverseHistKind kind, UniverseHistKind kind_2d )
+  {
+    std::vector< std::vector< int > > sources( num_new_bins );
+    bool any_merged = false;
+    for ( size_t b = 0u; b < map.size(); ++b ) {
+      int new_b = map.at( b );
+      if ( new_b < 0 ) continue;
+      sources.at( new_b ).push_back( b );
+      if ( sources.at(new_b).size() > 1u ) any_merged = true;
+    }
+    if ( !any_merged ) return;
+
+    std::string name = UNWEIGHTED_NAME + "_0_" + universe_hist_suffix( kind );
+    std::string name_2d = UNWEIGHTED_NAME + "_0_"
+      + universe_hist_suffix( kind_2d );
+
+    TH1* hist = nullptr;
+    TH1* hist_2d = nullptr;
+    dir.GetObject( name.c_str(), hist );
+    dir.GetObject( name_2d.c_str(), hist_2d );
+    std::unique_ptr< TH1 > hist_owner( hist );
+    std::unique_ptr< TH1 > hist_2d_owner( hist_2d );
+
+    if ( !hist || !hist_2d ) {
+      throw std::runtime_error( "Cannot merge " + universe_hist_suffix(kind)
+        + " bins without the histograms " + name + " and " + name_2d
+        + " needed to check them in " + dir.GetName() );
+    }
+    hist->SetDirectory( nullptr );
+    hist_2d->SetDirectory( nullptr );
+
+    if ( map.size() != static_cast<size_t>(hist->GetNbinsX())
+      || map.size() != static_cast<size_t>(hist_2d->GetNbinsX()) )
+    {
+      throw std::runtime_error( "The bin merge map does not match the"
+        " histogram " + name + " in " + dir.GetName() );
+    }
+
+    for ( size_t new_b = 0u; new_b < num_new_bins; ++new_b ) {
+      const auto& src = sources.at( new_b );
+      if ( src.size() < 2u ) continue;
+
+      for ( int b1 : src ) {
+        if ( hist->GetBinContent(b1 + 1) != get_sumw2(*hist, b1 + 1) ) {
+          throw std::runtime_error( "Cannot merge " + universe_hist_suffix(kind)
+            + " bin " + std::to_string(b1) + " into new bin "
+            + std::to_string(new_b) + " because its cuts apply non-unit"
+            " event weights in " + dir.GetName() );
+        }
+
+        for ( int b2 : src ) {
+          if ( b2 == b1 ) continue;
+          int bin = hist_2d->GetBin( b1 + 1, b2 + 1 );
+          if ( hist_2d->GetBinContent(bin) != 0.
+            || get_sumw2(*hist_2d, bin) != 0. )
+          {
+            throw std::runtime_error( "Cannot merge overlapping "
+              + universe_hist_suffix(kind) + " bins " + std::to_string(b1)
+              + " and " + std::to_string(b2) + " into new bin "
+              + std::to_string(new_b) + ": some events in " + dir.GetName()
+              + " fill both of them" );
+          }
+        }
+      }
+    }
+  }
+
+  // Applies the bin merge maps to a universe histogram. A null map leaves the
+  // bins along that axis unchanged. A TH1D should be given a null y_map.
+  std::unique_ptr< TH1 > rebin_hist( const TH1& hist,
+    const std::vector< int >* x_map, size_t num_new_x,
+    const std::vector< int >* y_map, size_t num_new_y )
+  {
+    int num_old_x = hist.GetNbinsX();
+    int num_old_y = hist.GetNbinsY();
+
+    if ( !x_map ) num_new_x = num_old_x;
+    if ( !y_map ) num_new_y = num_old_y;
+
+    if ( ( x_map && x_map->size() != static_cast<size_t>(num_old_x) )
+      || ( y_map && y_map->size() != static_cast<size_t>(num_old_y) ) )
+    {
+      throw std::runtime_error( std::string("The bin merge map does not match"
+        " the histogram ") + hist.GetName() );
+    }
+
+    std::unique_ptr< TH1 > result;
+    if ( hist.GetDimension() == 1 ) {
+      result = std::make_unique< TH1D >( hist.GetName(), hist.GetTitle(),
+        num_new_x, 0., num_new_x );
+    }
+    else {
+      result = std::make_unique< TH2D >( hist.GetName(), hist.GetTitle(),
+        num_new_x, 0., num_new_x, num_new_y, 0., num_new_y );
+    }
+    result->SetDirectory( nullptr );
+    result->GetXaxis()->SetTitle( hist.GetXaxis()->GetTitle() );
+    result->GetYaxis()->SetTitle( hist.GetYaxis()->GetTitle() );
+    result->Sumw2();
+
+    TArrayD& new_sumw2 = *result->GetSumw2();
+
+    for ( int x = 1; x <= num_old_x; ++x ) {
+      int new_x = x_map ? x_map->at( x - 1 ) + 1 : x;
+      if ( new_x <= 0 ) continue;
+
+      for ( int y = 1; y <= num_old_y; ++y ) {
+        int new_y = y_map ? y_map->at( y - 1 ) + 1 : y;
+        if ( new_y <= 0 ) continue;
+
+        int old_bin = hist.GetBin( x, y );
+        int new_bin = result->GetBin( new_x, new_y );
+
+        result->AddBinContent( new_bin, hist.GetBinContent(old_bin) );
+        new_sumw2[ new_bin ] += get_sumw2( hist, old_bin );
+      }
+    }
+
+    result->ResetStats();
+    result->SetEntries( hist.GetEntries() );
+    return result;
+  }
+
+  // Returns true if str ends with the given suffix
+  bool ends_with( const std::string& str, const std::string& suffix ) {
+    return str.size() >= suffix.size() && str.compare( str.size()
+      - suffix.size(), suffix.size(), suffix ) == 0;
+  }
+
+  // Rebins every universe histogram in a single ntuple subfolder and writes
+  // it to out_dir. Any other objects (e.g., the summed POT) are copied as-is.
+  void rebin_subfolder( TDirectory& in_dir, TDirectory& out_dir,
+    const BinMergeMap& merge_map )
+  {
+    const auto* true_map = &merge_map.true_map();
+    const auto* reco_map = &merge_map.reco_map();
+    size_t num_true = merge_map.num_new_true_bins();
+    size_t num_reco = merge_map.num_new_reco_bins();
+
+    // Keys are listed with the highest cycle first, so only the first key
+    // with a given name needs to be processed
+    std::set< std::string > seen_names;
+
+    for ( auto* obj : *in_dir.GetListOfKeys() ) {
+      auto* key = static_cast< TKey* >( obj );
+      std::string name = key->GetName();
+      if ( !seen_names.insert(name).second ) continue;
+
+      std::unique_ptr< TObject > in_obj( key->ReadObj() );
+
+      auto* hist = dynamic_cast< TH1* >( in_obj.get() );
+      if ( !hist ) {
+        out_dir.WriteTObject( in_obj.get(), name.c_str() );
+        continue;
+      }
+
+      std::unique_ptr< TH1 > result;
+      if ( ends_with(name, "_true") ) {
+        result = rebin_hist( *hist, true_map, num_true, nullptr, 0u );
+      }
+      else if ( ends_with(name, "_reco") ) {
+        result = rebin_hist( *hist, reco_map, num_reco, nullptr, 0u );
+      }
+      else if ( ends_with(name, "_2d") ) {
+        result = rebin_hist( *hist, true_map, num_true, reco_map, num_reco );
+      }
+      else if ( ends_with(name, "_categ") ) {
+        result = rebin_hist( *hist, nullptr, 0u, reco_map, num_reco );
+      }
+      else if ( ends_with(name, "_reco2d") ) {
+        result = rebin_hist( *hist, reco_map, num_reco, reco_map, num_reco );
+      }
+      else if ( ends_with(name, "_true2d") ) {
+        result = rebin_hist( *hist, true_map, num_true, true_map, num_true );
+      }
+      else throw std::runtime_error( "Unrecognized universe histogram "
+        + name );
+
+      out_dir.WriteTObject( result.get(), name.c_str() );
+    }
+  }
+
+}
+
+BinMergeMap::BinMergeMap( const std::string& config_file_name ) {
+
+  std::ifstream in_file( config_file_name );
+  if ( !in_file.good() ) throw std::runtime_error( "Could not open the bin"
+    " merge map file " + config_file_name );
+
+  // Remove comment lines before parsing the remaining contents
+  std::string line, contents;
+  while ( std::getline(in_file, line) ) {
+    if ( !line.empty() && line.front() == '#' ) continue;
+    contents += line + '\n';
+  }
+
+  std::istringstream iss( contents );
+  std::string kind;
+  while ( iss >> kind ) {
+
+    std::vector< int >* map = nullptr;
+    if ( kind == "true" ) {
+      if ( has_true_map_ ) throw std::runtime_error( "Duplicate true section"
+        " in the bin merge map file " + config_file_name );
+      map = &true_map_;
+      has_true_map_ = true;
+    }
+    else if ( kind == "reco" ) {
+      if ( has_reco_map_ ) throw std::runtime_error( "Duplicate reco section"
+        " in the bin merge map file " + config_file_name );
+      map = &reco_map_;
+      has_reco_map_ = true;
+    }
+    else throw std::runtime_error( "Unrecognized section \"" + kind
+      + "\" in the bin merge map file " + config_file_name );
+
+    size_t num_old_bins = 0u;
+    iss >> num_old_bins;
+    for ( size_t b = 0u; b < num_old_bins && iss; ++b ) {
+      int new_b;
+      iss >> new_b;
+      map->push_back( new_b );
+    }
+
+    if ( !iss ) throw std::runtime_error( "Incomplete " + kind
+      + " section in the bin merge map file " + config_file_name );
+  }
+}
+
+void BinMergeMap::resolve( size_t num_old_true_bins,
+  size_t num_old_reco_bins )
+{
+  auto resolve_map = [ & ]( std::vector< int >& map, bool has_map,
+    size_t num_old_bins, const std::string& kind ) -> size_t
+  {
+    if ( !has_map ) {
+      map.resize( num_old_bins );
+      for ( size_t b = 0u; b < num_old_bins; ++b ) map[ b ] = b;
+    }
+    else if ( map.size() != num_old_bins ) {
+      throw std::runtime_error( "The bin merge map expects "
+        + std::to_string(map.size()) + ' ' + kind + " bins, but "
+        + std::to_string(num_old_bins) + " were found" );
+    }
+    return check_merge_map( map, kind );
+  };
+
+  num_new_true_bins_ = resolve_map( true_map_, has_true_map_,
+    num_old_true_bins, "true" );
+  num_new_reco_bins_ = resolve_map( reco_map_, has_reco_map_,
+    num_old_reco_bins, "reco" );
+}
+
+std::vector< TrueBin > merge_true_bins( const std::vector< TrueBin >& bins,
+  const BinMergeMap& merge_map )
+{
+  return merge_bins( bins, merge_map.true_map(),
+    merge_map.num_new_true_bins(), &TrueBin::signal_cuts_ );
+}
+
+std::vector< RecoBin > merge_reco_bins( const std::vector< RecoBin >& bins,
+  const BinMergeMap& merge_map )
+{
+  return merge_bins( bins, merge_map.reco_map(),
+    merge_map.num_new_reco_bins(), &RecoBin::selection_cuts_ );
+}
+
+std::string rebin_universe_file( const std::string& input_file_name,
+  const std::string& output_file_name, BinMergeMap& merge_map,
+  const std::string& input_dir_name )
+{
+  TFile in_tfile( input_file_name.c_str(), "read" );
+  if ( in_tfile.IsZombie() ) throw std::runtime_error( "Could not open the"
+    " universe file " + input_file_name );
+
+  std::string dir_name = input_dir_name;
+  if ( dir_name.empty() ) {
+    dir_name = in_tfile.GetListOfKeys()->At( 0 )->GetName();
+  }
+
+  TDirectoryFile* root_tdir = nullptr;
+  in_tfile.GetObject( dir_name.c_str(), root_tdir );
+  if ( !root_tdir ) throw std::runtime_error( "Missing root TDirectoryFile "
+    + dir_name + " in the universe file " + input_file_name );
+
+  std::string* tree_name = nullptr;
+  std::string* true_bin_spec = nullptr;
+  std::string* reco_bin_spec = nullptr;
+  std::string* sel_for_categ = nullptr;
+  root_tdir->GetObject( "ntuple_name", tree_name );
+  root_tdir->GetObject( TRUE_BIN_SPEC_NAME.c_str(), true_bin_spec );
+  root_tdir->GetObject( RECO_BIN_SPEC_NAME.c_str(), reco_bin_spec );
+  root_tdir->GetObject( "sel_for_categ", sel_for_categ );
+
+  std::unique_ptr< std::string > tree_name_owner( tree_name );
+  std::unique_ptr< std::string > tb_spec_owner( true_bin_spec );
+  std::unique_ptr< std::string > rb_spec_owner( reco_bin_spec );
+  std::unique_ptr< std::string > sel_owner( sel_for_categ );
+
+  if ( !tree_name || !true_bin_spec || !reco_bin_spec || !sel_for_categ ) {
+    throw std::runtime_error( "Failed to load the bin configuration from the"
+      " universe file " + input_file_name );
+  }
+
+  // Parse the original bin definitions in the same way as
+  // SystematicsCalculator
+  std::vector< TrueBin > true_bins;
+  std::istringstream iss_true( *true_bin_spec );
+  TrueBin temp_true_bin;
+  while ( iss_true >> temp_true_bin ) true_bins.push_back( temp_true_bin );
+
+  std::vector< RecoBin > reco_bins;
+  std::istringstream iss_reco( *reco_bin_spec );
+  RecoBin temp_reco_bin;
+  while ( iss_reco >> temp_reco_bin ) reco_bins.push_back( temp_reco_bin );
+
+  merge_map.resolve( true_bins.size(), reco_bins.size() );
+
+  std::cout << "Rebinning " << true_bins.size() << " true bins and "
+    << reco_bins.size() << " reco bins into " << merge_map.num_new_true_bins()
+    << " true bins and " << merge_map.num_new_reco_bins() << " reco bins\n";
+
+  // Build the bin specifications for the new binning using the same format
+  // as UniverseMaker::get_bin_specs()
+  std::ostringstream oss_true, oss_reco;
+  for ( const auto& tbin : merge_true_bins(true_bins, merge_map) ) {
+    oss_true << tbin << '\n';
+  }
+  for ( const auto& rbin : merge_reco_bins(reco_bins, merge_map) ) {
+    oss_reco << rbin << '\n';
+  }
+  std::string new_true_bin_spec = oss_true.str();
+  std::string new_reco_bin_spec = oss_reco.str();
+
+  // Find the ntuple subfolders to rebin. The POT-summed universes made by
+  // SystematicsCalculator use the same prefix for the subfolder name in all
+  // cases.
+  const std::string total_prefix = "total_";
+
+  std::vector< std::string > subfolder_names;
+  std::set< std::string > seen_names;
+  for ( auto* obj : *root_tdir->GetListOfKeys() ) {
+    auto* key = static_cast< TKey* >( obj );
+    std::string name = key->GetName();
+    if ( !seen_names.insert(name).second ) continue;
+
+    if ( !key->IsFolder() ) continue;
+
+    if ( name.find(total_prefix) == 0u ) {
+      std::cout << "Skipping POT-summed subfolder " << name << '\n';
+      continue;
+    }
+
+    subfolder_names.push_back( name );
+  }
+
+  // Check every subfolder before anything is written so that a bad merge map
+  // does not leave a partial output file behind
+  for ( const auto& name : subfolder_names ) {
+    TDirectory* in_subdir = nullptr;
+    root_tdir->GetObject( name.c_str(), in_subdir );
+    if ( !in_subdir ) continue;
+
+    check_merged_bins( *in_subdir, merge_map.true_map(),
+      merge_map.num_new_true_bins(), kTrueUniverseHist,
+      kTrue2DUniverseHist );
+    check_merged_bins( *in_subdir, merge_map.reco_map(),
+      merge_map.num_new_reco_bins(), kRecoUniverseHist,
+      kReco2DUniverseHist );
+  }
+
+  TFile out_tfile( output_file_name.c_str(), "recreate" );
+  if ( out_tfile.IsZombie() ) throw std::runtime_error( "Could not write to"
+    " the output file " + output_file_name );
+
+  TDirectory* out_root_tdir = out_tfile.mkdir( dir_name.c_str() );
+  out_root_tdir->WriteObject( tree_name, "ntuple_name" );
+  out_root_tdir->WriteObject( &new_true_bin_spec, TRUE_BIN_SPEC_NAME.c_str() );
+  out_root_tdir->WriteObject( &new_reco_bin_spec, RECO_BIN_SPEC_NAME.c_str() );
+  out_root_tdir->WriteObject( sel_for_categ, "sel_for_categ" );
+
+  // Process one ntuple subfolder at a time
+  for ( const auto& name : subfolder_names ) {
+    TDirectory* in_subdir = nullptr;
+    root_tdir->GetObject( name.c_str(), in_subdir );
+    if ( !in_subdir ) continue;
+
+    std::cout << "Rebinning universes for " << name << '\n';
+
+    TDirectory* out_subdir = out_root_tdir->mkdir( name.c_str() );
+    rebin_subfolder( *in_subdir, *out_subdir, merge_map );
+  }
+
+  return dir_name;
+}